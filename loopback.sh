@@ -0,0 +1,65 @@
+#!/bin/bash
+# End-to-end forwarding benchmark, needs root (or sudo) but no other hosts
+#
+#  netns rw-wan                                      netns rw-lan
+#  rw-eth 192.168.69.2  <->  ./loopback (rustwall)  <->  rw-cli 192.168.69.1
+#  loopback_traffic blast                            loopback_traffic sink
+#
+# Usage: loopback.sh [datagrams] [pps]
+# Runs a small datagram and a fragmented datagram pass, both wan -> lan.
+set -e
+
+COUNT=${1:-100000}
+PPS=${2:-20000}
+ETH=rw-eth
+CLI=rw-cli
+WAN=rw-wan
+LAN=rw-lan
+
+cleanup() {
+  [ -n "$FORWARDER" ] && kill $FORWARDER 2>/dev/null && wait $FORWARDER
+  ip netns del $WAN 2>/dev/null || true
+  ip netns del $LAN 2>/dev/null || true
+  ip link del $ETH 2>/dev/null || true
+  ip link del $CLI 2>/dev/null || true
+}
+trap cleanup EXIT
+cleanup
+
+# persistent TAPs, attached to by the forwarder before they move away
+ip tuntap add dev $ETH mode tap
+ip tuntap add dev $CLI mode tap
+./loopback $ETH $CLI &
+FORWARDER=$!
+sleep 0.5
+
+ip netns add $WAN
+ip netns add $LAN
+ip link set $ETH netns $WAN
+ip link set $CLI netns $LAN
+for ns in $WAN $LAN; do
+  ip netns exec $ns sysctl -qw net.ipv6.conf.all.disable_ipv6=1
+  ip netns exec $ns ip link set lo up
+done
+ip netns exec $WAN ip addr add 192.168.69.2/24 dev $ETH
+ip netns exec $WAN ip link set $ETH up
+# the client has the MAC address that rustwall expects (`client_mac()`)
+ip netns exec $LAN ip link set $CLI address 02:00:00:00:00:01
+ip netns exec $LAN ip addr add 192.168.69.1/24 dev $CLI
+ip netns exec $LAN ip link set $CLI up
+sleep 0.5
+
+run_pass() {
+  echo
+  echo "== $1: $COUNT datagrams at $PPS/s, $2 to $3 bytes of payload"
+  ip netns exec $LAN ./loopback_traffic sink $COUNT > sink.out &
+  local sink=$!
+  sleep 0.5
+  ip netns exec $WAN ./loopback_traffic blast $ETH $COUNT $PPS $2 $3
+  wait $sink
+  cat sink.out
+  rm -f sink.out
+}
+
+run_pass small 64 64
+run_pass fragmented 2000 8000
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Per traffic class speedup of rustwall between build profiles
+#
+# Builds and runs bench_overhead once per profile (see `PROFILE` in the
+# Makefile) and prints the rustwall ns per frame of every traffic class and
+# direction, with the speedup over the first profile.
+# `pgo-use` runs `make pgo` first if there is no merged profile yet.
+#
+# Usage: perf/compare_profiles.sh [profile...]
+set -e
+
+PROFILES=${@:-debug release}
+OUT=$(mktemp -d)
+trap "rm -rf $OUT" EXIT
+
+for p in $PROFILES; do
+  if [ "$p" = pgo-use ] && [ ! -f target/pgo-data/merged.profdata ]; then
+    make pgo > /dev/null
+  fi
+  echo "building and running bench_overhead with PROFILE=$p" >&2
+  # keep the table rows only: "<class> <tx|rx> <9 columns in total>"
+  make bench-overhead PROFILE=$p 2> /dev/null \
+    | awk '($2 == "tx" || $2 == "rx") && NF == 9 { print $1, $2, $4 }' \
+    > $OUT/$p
+done
+
+awk -v profiles="$PROFILES" '
+  BEGIN { n = split(profiles, names, " ") }
+  FNR == 1 { file++ }
+  {
+    key = $1 " " $2
+    if (file == 1) { keys[++count] = key }
+    ns[file, key] = $3
+  }
+  END {
+    printf "%-12s %3s", "class", "dir"
+    for (i = 1; i <= n; i++) { printf " %12s", names[i] " ns" }
+    for (i = 2; i <= n; i++) { printf " %12s", names[i] }
+    printf "\n"
+    for (k = 1; k <= count; k++) {
+      split(keys[k], kd, " ")
+      printf "%-12s %3s", kd[1], kd[2]
+      for (i = 1; i <= n; i++) { printf " %12.1f", ns[i, keys[k]] }
+      for (i = 2; i <= n; i++) {
+        printf " %11.2fx", (ns[i, keys[k]] > 0) ? ns[1, keys[k]] / ns[i, keys[k]] : 0
+      }
+      printf "\n"
+    }
+  }' $(for p in $PROFILES; do echo $OUT/$p; done)
@@ -0,0 +1,102 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use smoltcp::wire::{ArpOperation, ArpPacket, ArpRepr};
+use smoltcp::wire::{EthernetFrame, EthernetProtocol, Ipv4Address};
+
+use config;
+use constants;
+use utils;
+
+/// ARP requests from the wire answered on behalf of the client
+pub static REPLIES: AtomicUsize = AtomicUsize::new(0);
+/// Replies the ethdriver didn't take
+pub static REPLY_FAILURES: AtomicUsize = AtomicUsize::new(0);
+
+lazy_static! {
+    /// IPv4 addresses of the client, the configured one first and then the
+    /// ones it announced over ARP, oldest first
+    static ref CLIENT_ADDRESSES: ::spin::Mutex<Vec<Ipv4Address>> = {
+        let mut addresses = Vec::with_capacity(constants::MAX_CLIENT_ADDRESSES);
+        if let Some(address) = config::get().client_ip {
+            addresses.push(address);
+        }
+        ::spin::Mutex::new(addresses)
+    };
+}
+
+/// Remember the sender address of an ARP `frame` from the client. Only the
+/// client's own ARP counts: any IPv4 source it merely sends from, e.g. when
+/// it routes, isn't an address it has to answer for.
+pub fn learn(frame: &[u8]) {
+    if !config::get().arp_responder {
+        return;
+    }
+    let eth_frame = match EthernetFrame::new_checked(frame) {
+        Ok(f) => f,
+        Err(_) => return,
+    };
+    if eth_frame.ethertype() != EthernetProtocol::Arp {
+        return;
+    }
+    let address = match ArpPacket::new_checked(eth_frame.payload()).and_then(|p| ArpRepr::parse(&p)) {
+        Ok(ArpRepr::EthernetIpv4 { source_protocol_addr, .. }) => source_protocol_addr,
+        _ => return,
+    };
+    if !address.is_unicast() {
+        return;
+    }
+
+    let mut addresses = CLIENT_ADDRESSES.lock();
+    if addresses.contains(&address) {
+        return;
+    }
+    if addresses.len() >= constants::MAX_CLIENT_ADDRESSES {
+        // keep the configured address
+        let oldest = if config::get().client_ip.is_some() { 1 } else { 0 };
+        addresses.remove(oldest);
+    }
+    debug_print!("Firewall arp: learned client address {}", address);
+    addresses.push(address);
+}
+
+/// If `frame` from the wire is an ARP request for one of the client's
+/// addresses, the reply the client would send, from `CLIENT_MAC_ADDRESS`
+pub fn reply_to(frame: &[u8]) -> Option<Vec<u8>> {
+    if !config::get().arp_responder {
+        return None;
+    }
+    let eth_frame = EthernetFrame::new_checked(frame).ok()?;
+    let request = ArpPacket::new_checked(eth_frame.payload()).and_then(|p| ArpRepr::parse(&p)).ok()?;
+    let (source_hardware_addr, source_protocol_addr, target_protocol_addr) = match request {
+        ArpRepr::EthernetIpv4 {
+            operation: ArpOperation::Request,
+            source_hardware_addr,
+            source_protocol_addr,
+            target_protocol_addr,
+            ..
+        } => (source_hardware_addr, source_protocol_addr, target_protocol_addr),
+        _ => return None,
+    };
+    // gratuitous ARP is news for the client, not a question
+    if source_protocol_addr == target_protocol_addr
+        || !CLIENT_ADDRESSES.lock().contains(&target_protocol_addr)
+    {
+        return None;
+    }
+
+    let client_mac = *utils::CLIENT_MAC_ADDRESS;
+    let reply = ArpRepr::EthernetIpv4 {
+        operation: ArpOperation::Reply,
+        source_hardware_addr: client_mac,
+        source_protocol_addr: target_protocol_addr,
+        target_hardware_addr: source_hardware_addr,
+        target_protocol_addr: source_protocol_addr,
+    };
+    let mut eth_reply = EthernetFrame::new(vec![0; EthernetFrame::<&[u8]>::buffer_len(reply.buffer_len())]);
+    eth_reply.set_dst_addr(source_hardware_addr);
+    eth_reply.set_src_addr(client_mac);
+    eth_reply.set_ethertype(EthernetProtocol::Arp);
+    reply.emit(&mut ArpPacket::new(eth_reply.payload_mut()));
+    REPLIES.fetch_add(1, Ordering::Relaxed);
+    Some(eth_reply.into_inner())
+}
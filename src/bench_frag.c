@@ -0,0 +1,282 @@
+/**
+ * Adversarial fragment reassembly benchmark
+ *
+ * Generates fragmented UDP datagrams programmatically and sends them through
+ * `client_tx()`, for a series of increasingly hostile scenarios: large
+ * datagrams, random fragment order, duplicated and overlapping fragments,
+ * fragments that never arrive, and many datagrams from many sources
+ * interleaved with each other.
+ *
+ * For every scenario it reports the reassemblies per second, the memory held
+ * by the reassembly buffers, the rate of fragments dropped with
+ * `FragmentSetFull` and `TooManyFragments`, and the completion latency,
+ * i.e. the time from the first fragment of a datagram entering the firewall
+ * until its reassembled packet leaves it.
+ *
+ * Usage: bench_frag [datagrams per scenario] [seed]
+ */
+#include "bench_glue.h"
+#include "rustwall.h"
+#include "pktgen.h"
+#include <inttypes.h>
+
+#define DEFAULT_DATAGRAMS 5000
+#define MAX_UDP_LEN PKTGEN_MAX_L4_LEN
+#define MAX_FRAME_LEN 1514
+
+/* UDP dst port, anything but the one dropped by `packet_out` */
+#define DST_PORT 5000
+
+struct scenario {
+  const char *name;
+  /* UDP datagram length including the header */
+  int min_len;
+  int max_len;
+  /* IP payload carried by each fragment, multiple of 8 */
+  int frag_payload;
+  /* datagrams being sent at the same time, their fragments interleaved */
+  int concurrency;
+  /* number of distinct source addresses */
+  int sources;
+  bool shuffle;
+  /* chance in percent of duplicating / overlapping each fragment */
+  int dup_pct;
+  int overlap_pct;
+  /* chance in percent of a datagram losing one of its fragments */
+  int missing_pct;
+};
+
+static struct scenario scenarios[] = {
+  { "in-order", 1000, 4000, 1480, 1, 1, false, 0, 0, 0 },
+  { "shuffled", 1000, 4000, 1480, 1, 1, true, 0, 0, 0 },
+  { "64k", 32000, MAX_UDP_LEN, 1480, 1, 1, true, 0, 0, 0 },
+  { "tiny-frags", 2000, 4000, 64, 1, 1, true, 0, 0, 0 },
+  { "interleave-8", 1000, 8000, 1480, 8, 8, true, 0, 0, 0 },
+  { "dup-overlap", 1000, 8000, 1480, 4, 4, true, 20, 20, 0 },
+  { "missing", 1000, 8000, 1480, 4, 4, true, 0, 0, 10 },
+  { "flood-2000", 1000, 4000, 1480, 2000, 256, true, 0, 0, 0 },
+  { "hostile", 1000, MAX_UDP_LEN, 512, 1000, 256, true, 10, 10, 10 },
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+struct fragment {
+  int offset;
+  int len;
+  bool more;
+};
+
+struct datagram {
+  uint16_t ident;
+  uint32_t src;
+  int len;
+  struct fragment *frags;
+  int frag_count;
+  int frag_capacity;
+  int next;
+  uint64_t first_ns;
+  bool done;
+};
+
+/* xorshift64, reproducible across runs for a given seed */
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (uint32_t) (rng_state >> 32);
+}
+
+static int rng_range(int min, int max)
+{
+  return min + (int) (rng() % (uint32_t) (max - min + 1));
+}
+
+static bool rng_pct(int pct)
+{
+  return (int) (rng() % 100) < pct;
+}
+
+static uint16_t next_ident = 0;
+
+static void push_fragment(struct datagram *d, int offset, int len, bool more)
+{
+  if (d->frag_count == d->frag_capacity) {
+    d->frag_capacity = d->frag_capacity ? d->frag_capacity * 2 : 64;
+    d->frags = realloc(d->frags, d->frag_capacity * sizeof(struct fragment));
+    if (d->frags == NULL) {
+      printf("Out of memory\n");
+      exit(1);
+    }
+  }
+  d->frags[d->frag_count].offset = offset;
+  d->frags[d->frag_count].len = len;
+  d->frags[d->frag_count].more = more;
+  d->frag_count++;
+}
+
+/**
+ * Start a new datagram in `d` and plan the fragments it will be sent as
+ */
+static void plan_datagram(struct datagram *d, const struct scenario *s)
+{
+  d->ident = next_ident++;
+  d->src = rng() % s->sources;
+  d->len = rng_range(s->min_len, s->max_len);
+  d->frag_count = 0;
+  d->next = 0;
+  d->first_ns = 0;
+  d->done = false;
+
+  for (int offset = 0; offset < d->len; offset += s->frag_payload) {
+    int len = d->len - offset;
+    if (len > s->frag_payload) {
+      len = s->frag_payload;
+    }
+    bool more = offset + len < d->len;
+    if ((offset > 0) && rng_pct(s->overlap_pct)) {
+      // repeat the tail of the previous fragment, with the same data
+      push_fragment(d, offset - 8, len + 8, more);
+    } else {
+      push_fragment(d, offset, len, more);
+    }
+  }
+
+  if ((d->frag_count > 1) && rng_pct(s->missing_pct)) {
+    int lost = rng() % d->frag_count;
+    d->frags[lost] = d->frags[--d->frag_count];
+  }
+
+  int planned = d->frag_count;
+  for (int i = 0; i < planned; i++) {
+    if (rng_pct(s->dup_pct)) {
+      push_fragment(d, d->frags[i].offset, d->frags[i].len, d->frags[i].more);
+    }
+  }
+
+  if (s->shuffle) {
+    for (int i = d->frag_count - 1; i > 0; i--) {
+      int j = rng() % (i + 1);
+      struct fragment tmp = d->frags[i];
+      d->frags[i] = d->frags[j];
+      d->frags[j] = tmp;
+    }
+  }
+}
+
+/**
+ * Write fragment `f` of datagram `d` as an Ethernet frame into `frame`,
+ * returns the frame length
+ */
+static int build_fragment(uint8_t *frame, const struct datagram *d,
+    const struct fragment *f)
+{
+  // 10.1.x.y -> 10.0.0.1
+  struct pktgen_flow flow = {
+    .src_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 },
+    .dst_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .src_ip = 0x0a010000 | (d->src & 0xffff),
+    .dst_ip = 0x0a000001,
+    .src_port = 4000,
+    .dst_port = DST_PORT,
+  };
+  // overlapping fragments repeat 8 bytes on top of a full one
+  return pktgen_ipv4_fragment(frame, MAX_FRAME_LEN + 8, &flow,
+      PKTGEN_PROTO_UDP, d->ident, d->len, f->offset, f->len, f->more,
+      d->ident & 0xff);
+}
+
+static void run_scenario(const struct scenario *s, int datagrams)
+{
+  static uint8_t frame[MAX_FRAME_LEN + 8];
+  struct datagram *active = calloc(s->concurrency, sizeof(struct datagram));
+  uint64_t *latencies = malloc(datagrams * sizeof(uint64_t));
+  if ((active == NULL) || (latencies == NULL)) {
+    printf("Out of memory\n");
+    exit(1);
+  }
+
+  struct firewall_stats before, after;
+  firewall_stats_reset_high_water();
+  firewall_stats_get(&before);
+
+  int started = 0, completed = 0, in_flight = 0;
+  uint64_t fragments = 0;
+  for (int i = 0; (i < s->concurrency) && (started < datagrams); i++) {
+    plan_datagram(&active[i], s);
+    started++;
+    in_flight++;
+  }
+
+  uint64_t start = bench_now_ns();
+  while (in_flight > 0) {
+    struct datagram *d = &active[rng() % s->concurrency];
+    if (d->next == d->frag_count) {
+      continue;
+    }
+    int len = build_fragment(frame, d, &d->frags[d->next++]);
+    uint64_t sent = bench_tx_frames;
+    if (d->first_ns == 0) {
+      d->first_ns = bench_now_ns();
+    }
+    bench_client_tx(frame, len);
+    fragments++;
+
+    // the fragment that completes a datagram releases it immediately
+    if ((bench_tx_frames != sent) && !d->done) {
+      d->done = true;
+      latencies[completed++] = bench_last_tx_ns - d->first_ns;
+    }
+
+    if (d->next == d->frag_count) {
+      if (started < datagrams) {
+        plan_datagram(d, s);
+        started++;
+      } else {
+        in_flight--;
+      }
+    }
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  firewall_stats_get(&after);
+
+  bench_sort(latencies, completed);
+  double set_full = after.fragments_tx_set_full_drops
+      - before.fragments_tx_set_full_drops;
+  double too_many = after.fragments_tx_too_many_drops
+      - before.fragments_tx_too_many_drops;
+  printf("%-13s %7d %8" PRIu64 " %10.0f %8.1f%% %8.2f%% %8.2f%%"
+      " %5" PRIu64 " %9" PRIu64 " %8.1f %8.1f %9.1f\n",
+      s->name, datagrams, fragments, completed * 1e9 / elapsed,
+      100.0 * completed / datagrams, 100.0 * set_full / fragments,
+      100.0 * too_many / fragments,
+      after.fragments_tx_slots_max, after.fragments_tx_bytes_max,
+      bench_percentile(latencies, completed, 50) / 1e3,
+      bench_percentile(latencies, completed, 99) / 1e3,
+      bench_percentile(latencies, completed, 100) / 1e3);
+
+  for (int i = 0; i < s->concurrency; i++) {
+    free(active[i].frags);
+  }
+  free(active);
+  free(latencies);
+}
+
+int main(int argc, char **argv)
+{
+  int datagrams = (argc > 1) ? atoi(argv[1]) : DEFAULT_DATAGRAMS;
+  rng_state = (argc > 2) ? strtoull(argv[2], NULL, 0) : 0x2545f4914f6cdd1dull;
+  if ((datagrams <= 0) || (rng_state == 0)) {
+    printf("Usage: %s [datagrams per scenario] [non-zero seed]\n", argv[0]);
+    exit(1);
+  }
+
+  printf("%-13s %7s %8s %10s %9s %9s %9s %5s %9s %8s %8s %9s\n",
+      "scenario", "dgrams", "frags", "reasm/s", "complete", "set-full",
+      "too-many", "slots", "bytes", "p50 us", "p99 us", "max us");
+  for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+    run_scenario(&scenarios[i], datagrams);
+  }
+  return 0;
+}
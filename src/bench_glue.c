@@ -0,0 +1,221 @@
+/**
+ * Shared Linux stubs and helpers for the rustwall benchmarks
+ */
+#include "bench_glue.h"
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+__thread uint64_t bench_tx_frames = 0;
+__thread uint64_t bench_tx_bytes = 0;
+__thread uint64_t bench_last_tx_ns = 0;
+__thread uint64_t bench_rx_frames = 0;
+__thread uint64_t bench_rx_bytes = 0;
+__thread uint64_t bench_last_rx_ns = 0;
+
+/**
+ * Note: this code is normally autogenerated during seL4 build
+ */
+struct
+{
+  char content[65535];
+} from_ethdriver_data;
+
+void * ethdriver_buf = (void *) &from_ethdriver_data;
+
+/* every benchmark thread is its own client */
+static __thread struct
+{
+  char content[65535];
+} to_client_1_data;
+
+void *client_buf(seL4_Word client_id)
+{
+  switch (client_id) {
+    case 1:
+      return (void *) &to_client_1_data;
+    default:
+      return NULL;
+  }
+}
+
+void client_emit(unsigned int badge)
+{
+}
+
+pthread_mutex_t mutex_ethdriver_buf = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t mutex_client_buf = PTHREAD_MUTEX_INITIALIZER;
+void ethdriver_buf_lock(void)
+{
+  pthread_mutex_lock(&mutex_ethdriver_buf);
+}
+
+void ethdriver_buf_unlock(void)
+{
+  pthread_mutex_unlock(&mutex_ethdriver_buf);
+}
+
+void client_buf_lock(void)
+{
+  pthread_mutex_lock(&mutex_client_buf);
+}
+
+void client_buf_unlock(void)
+{
+  pthread_mutex_unlock(&mutex_client_buf);
+}
+
+/**
+ * Normally provided by the seL4 runtime, referenced by `post_init()`
+ */
+void putchar_putchar(uint8_t c)
+{
+  putchar(c);
+}
+
+void set_putchar(void (*f)(uint8_t))
+{
+}
+/**
+ * END OF AUTOGENERATED CODE
+ */
+
+/**
+ * Dummy version
+ * Normally returns the MAC address of the ethernet driver
+ */
+void ethdriver_mac(uint8_t *b1, uint8_t *b2, uint8_t *b3, uint8_t *b4,
+    uint8_t *b5, uint8_t *b6)
+{
+  static uint8_t mac[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+  *b1 = mac[0];
+  *b2 = mac[1];
+  *b3 = mac[2];
+  *b4 = mac[3];
+  *b5 = mac[4];
+  *b6 = mac[5];
+}
+
+/**
+ * Dummy version
+ * The frame in `ethdriver_buf` is considered sent as soon as we are called
+ */
+int ethdriver_tx(int len)
+{
+  bench_tx_frames++;
+  bench_tx_bytes += len;
+  bench_last_tx_ns = bench_now_ns();
+  return 0;
+}
+
+/* frame handed to the next `ethdriver_rx()` call of this thread */
+static __thread const uint8_t *pending_rx_frame = NULL;
+static __thread int pending_rx_len = 0;
+
+/**
+ * Dummy version
+ * Delivers the frame queued by `bench_inject_rx()`, if any.
+ * Called by the firewall with `ethdriver_buf` locked.
+ */
+int ethdriver_rx(int* len)
+{
+  if (pending_rx_frame == NULL) {
+    return -1;
+  }
+  memcpy(ethdriver_buf, pending_rx_frame, pending_rx_len);
+  *len = pending_rx_len;
+  pending_rx_frame = NULL;
+  return 0;
+}
+
+uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * CPU timestamp counter, 0 where we don't know how to read it
+ */
+uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Busy wait, sleeping would add scheduler latency to every sample
+ */
+void bench_wait_until(uint64_t t_ns)
+{
+  while (bench_now_ns() < t_ns) {
+  }
+}
+
+/**
+ * Copy `frame` into this thread's client buffer and transmit it
+ */
+int bench_client_tx(const uint8_t *frame, int len)
+{
+  memcpy(client_buf(1), frame, len);
+  return client_tx(len);
+}
+
+/**
+ * Make `frame` available to the next `client_rx()` call of this thread
+ */
+void bench_inject_rx(const uint8_t *frame, int len)
+{
+  pending_rx_frame = frame;
+  pending_rx_len = len;
+}
+
+/**
+ * Call `client_rx()` until the firewall has no data left for the client,
+ * returns the number of frames copied to the client buffer
+ */
+int bench_client_rx_drain(void)
+{
+  int frames = 0;
+  int len = 0;
+  int ret;
+  do {
+    ret = client_rx(&len);
+    if (ret != -1) {
+      frames++;
+      bench_rx_frames++;
+      bench_rx_bytes += len;
+      bench_last_rx_ns = bench_now_ns();
+    }
+  } while (ret == 1);
+  return frames;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+void bench_sort(uint64_t *values, size_t count)
+{
+  qsort(values, count, sizeof(uint64_t), compare_u64);
+}
+
+/**
+ * `p` in [0, 100], `sorted` must be sorted in ascending order
+ */
+uint64_t bench_percentile(const uint64_t *sorted, size_t count, double p)
+{
+  if (count == 0) {
+    return 0;
+  }
+  size_t idx = (size_t) (p / 100.0 * (count - 1) + 0.5);
+  return sorted[idx];
+}
@@ -0,0 +1,67 @@
+/**
+ * Shared Linux stubs and helpers for the rustwall benchmarks
+ *
+ * Replaces the ethdriver and the client dataplane with in-memory versions:
+ * frames handed to `bench_client_tx()` / `bench_inject_rx()` go straight into
+ * `client_tx()` / `client_rx()`, and frames leaving the firewall are only
+ * counted and timestamped.
+ * The client buffer and the pending RX frame are per thread, so several
+ * threads can act as independent callers.
+ */
+#ifndef BENCH_GLUE_H
+#define BENCH_GLUE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * A helper define to make this look more like an actual seL4 file
+ */
+typedef uint32_t seL4_Word;
+
+// Rust
+extern void client_mac(uint8_t *b1, uint8_t *b2, uint8_t *b3, uint8_t *b4,
+    uint8_t *b5, uint8_t *b6);
+extern int client_tx(int len);
+extern int client_rx(int *len);
+extern void ethdriver_has_data_callback(seL4_Word badge);
+
+// Local
+int ethdriver_tx(int len);
+int ethdriver_rx(int* len);
+void ethdriver_mac(uint8_t *b1, uint8_t *b2, uint8_t *b3, uint8_t *b4,
+    uint8_t *b5, uint8_t *b6);
+
+extern void * ethdriver_buf;
+extern void *client_buf(seL4_Word client_id);
+
+/**
+ * Per thread counters of frames leaving the firewall, and the time
+ * the last one left (the moment `ethdriver_tx` or `client_rx` returned it)
+ */
+extern __thread uint64_t bench_tx_frames;
+extern __thread uint64_t bench_tx_bytes;
+extern __thread uint64_t bench_last_tx_ns;
+extern __thread uint64_t bench_rx_frames;
+extern __thread uint64_t bench_rx_bytes;
+extern __thread uint64_t bench_last_rx_ns;
+
+// Time
+uint64_t bench_now_ns(void);
+uint64_t bench_cycles(void);
+void bench_wait_until(uint64_t t_ns);
+
+// Traffic
+int bench_client_tx(const uint8_t *frame, int len);
+void bench_inject_rx(const uint8_t *frame, int len);
+int bench_client_rx_drain(void);
+
+// Statistics
+void bench_sort(uint64_t *values, size_t count);
+uint64_t bench_percentile(const uint64_t *sorted, size_t count, double p);
+
+#endif /* BENCH_GLUE_H */
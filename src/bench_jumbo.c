@@ -0,0 +1,172 @@
+/**
+ * Jumbo frame benchmark
+ *
+ * Configures both ports of the firewall with the same MTU and sends UDP
+ * datagrams of increasing size through both directions. Datagrams that
+ * don't fit the MTU arrive as fragments, like from a host on that link, and
+ * are reassembled, filtered and fragmented again to the egress MTU.
+ *
+ * Reports the cost per datagram, per KiB of payload and in payload bytes per
+ * CPU cycle. Most of the work is per frame, so running it at 1500 and at
+ * 9000 shows the per-byte cost dropping with the larger MTU.
+ * With large send the client hands every datagram over in a single
+ * `client_tx()` call instead of fragmenting it itself.
+ * Running it over IPv4 and IPv6 at the same MTU compares the two pipelines.
+ *
+ * Usage: bench_jumbo [mtu] [datagrams per size] [large send, 0 or 1]
+ *            [ip version, 4 or 6]
+ */
+#include "bench_glue.h"
+#include "rustwall.h"
+#include "pktgen.h"
+
+#define DEFAULT_MTU 9000
+#define DEFAULT_DATAGRAMS 2000
+#define WARMUP_DATAGRAMS 100
+#define MAX_FRAME_LEN (PKTGEN_ETH_HEADER_LEN + PKTGEN_MAX_MTU)
+/* a whole datagram, for large send */
+#define MAX_LARGE_FRAME_LEN 65535
+/* fragments of the largest payload at the smallest MTU */
+#define MAX_DATAGRAM_FRAMES 128
+
+/* IPv6 filters of `external_firewall.c` */
+int32_t packet_in6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len);
+int32_t packet_out6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len);
+
+enum direction {
+  DIR_TX, DIR_RX
+};
+
+/* UDP payload sizes, the largest one still fits a reassembly slot */
+static const int payloads[] = { 64, 1472, 4000, 8972, 16000, 32000, 60000 };
+#define PAYLOAD_COUNT (sizeof(payloads) / sizeof(payloads[0]))
+
+static uint8_t frames[MAX_DATAGRAM_FRAMES][MAX_FRAME_LEN];
+static int lens[MAX_DATAGRAM_FRAMES];
+static uint8_t large_frame[MAX_LARGE_FRAME_LEN];
+static int large_len;
+
+/**
+ * Build the frames of one datagram with `payload` bytes, fragmented to
+ * `mtu`, returns their number. The unfragmented datagram goes to
+ * `large_frame`.
+ */
+static int build_datagram(int mtu, int payload, bool ipv6)
+{
+  // the client MAC of rustwall, any port but the ones the filters drop
+  struct pktgen_flow flow = {
+    .src_mac = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x02 },
+    .dst_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .src_ip = 0xc0a84502,
+    .dst_ip = 0xc0a84501,
+    .src_port = 40000,
+    .dst_port = 7000,
+  };
+  int l4_len = PKTGEN_L4_HEADER_LEN + payload;
+  if (ipv6) {
+    large_len = pktgen_udp6(large_frame, sizeof(large_frame), &flow, payload,
+        0);
+    if (l4_len <= mtu - PKTGEN_IPV6_HEADER_LEN) {
+      lens[0] = pktgen_udp6(frames[0], MAX_FRAME_LEN, &flow, payload, 0);
+      return 1;
+    }
+  } else {
+    large_len = pktgen_udp(large_frame, sizeof(large_frame), &flow, 1,
+        payload, 0);
+    if (l4_len <= mtu - PKTGEN_IPV4_HEADER_LEN) {
+      lens[0] = pktgen_udp(frames[0], MAX_FRAME_LEN, &flow, 1, payload, 0);
+      return 1;
+    }
+  }
+  int frag_len = ipv6 ? (mtu - PKTGEN_IPV6_HEADER_LEN
+      - PKTGEN_IPV6_FRAG_HEADER_LEN) & ~7 : (mtu - PKTGEN_IPV4_HEADER_LEN) & ~7;
+  int count = 0;
+  for (int offset = 0; offset < l4_len; offset += frag_len) {
+    int len = (l4_len - offset < frag_len) ? l4_len - offset : frag_len;
+    bool more = offset + len < l4_len;
+    if (ipv6) {
+      lens[count] = pktgen_ipv6_fragment(frames[count], MAX_FRAME_LEN, &flow,
+          1, l4_len, offset, len, more, 0);
+    } else {
+      lens[count] = pktgen_ipv4_fragment(frames[count], MAX_FRAME_LEN, &flow,
+          PKTGEN_PROTO_UDP, 1, l4_len, offset, len, more, 0);
+    }
+    count++;
+  }
+  return count;
+}
+
+static void send_datagram(int count, enum direction dir, bool large_send)
+{
+  if (large_send && (dir == DIR_TX)) {
+    bench_client_tx(large_frame, large_len);
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    if (dir == DIR_TX) {
+      bench_client_tx(frames[i], lens[i]);
+    } else {
+      bench_inject_rx(frames[i], lens[i]);
+      bench_client_rx_drain();
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int mtu = (argc > 1) ? atoi(argv[1]) : DEFAULT_MTU;
+  int count = (argc > 2) ? atoi(argv[2]) : DEFAULT_DATAGRAMS;
+  bool large_send = (argc > 3) && (atoi(argv[3]) == 1);
+  int version = (argc > 4) ? atoi(argv[4]) : 4;
+  if ((mtu < 576) || (mtu > PKTGEN_MAX_MTU) || (count <= 0)
+      || ((version != 4) && (version != 6))) {
+    printf("Usage: %s [mtu] [datagrams per size] [large send, 0 or 1] "
+        "[ip version, 4 or 6]\n", argv[0]);
+    exit(1);
+  }
+
+  // the dataports of `bench_glue.c` take any frame
+  char config[128];
+  snprintf(config, sizeof(config), "mtu=%d\nbuffer_size=65535\n"
+      "large_send=%d\n", mtu, large_send);
+  if (firewall_configure(config, strlen(config)) != 0) {
+    printf("MTU %d rejected by the firewall\n", mtu);
+    exit(1);
+  }
+  firewall_ipv6_filters(packet_in6, packet_out6);
+
+  printf("jumbo: IPv%d, mtu %d, %d datagrams per size%s\n", version, mtu,
+      count, large_send ? ", large send" : "");
+  printf("%8s %3s %7s %8s %14s %10s %10s\n", "payload", "dir", "frames",
+      "out/in", "ns/datagram", "ns/KiB", "B/cycle");
+  for (int p = 0; p < PAYLOAD_COUNT; p++) {
+    int frame_count = build_datagram(mtu, payloads[p], version == 6);
+    for (int d = DIR_TX; d <= DIR_RX; d++) {
+      for (int i = 0; i < WARMUP_DATAGRAMS; i++) {
+        send_datagram(frame_count, d, large_send);
+      }
+      uint64_t out = (d == DIR_TX) ? bench_tx_frames : bench_rx_frames;
+      uint64_t start_ns = bench_now_ns();
+      uint64_t start_cycles = bench_cycles();
+      for (int i = 0; i < count; i++) {
+        send_datagram(frame_count, d, large_send);
+      }
+      uint64_t cycles = bench_cycles() - start_cycles;
+      uint64_t ns = bench_now_ns() - start_ns;
+      out = ((d == DIR_TX) ? bench_tx_frames : bench_rx_frames) - out;
+      int frames_in = (large_send && (d == DIR_TX)) ? 1 : frame_count;
+
+      double bytes = (double) payloads[p] * count;
+      printf("%8d %3s %7d %8.2f %14.1f %10.1f %10.3f\n", payloads[p],
+          (d == DIR_TX) ? "tx" : "rx", frames_in,
+          (double) out / ((uint64_t) count * frames_in),
+          (double) ns / count, ns / (bytes / 1024),
+          cycles ? bytes / cycles : 0);
+    }
+  }
+  return 0;
+}
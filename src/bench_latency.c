@@ -0,0 +1,171 @@
+/**
+ * Open-loop latency benchmark
+ *
+ * Frames are injected on a fixed schedule, independent of how fast the
+ * firewall processes them, and each unit of traffic (a single frame or a
+ * whole fragment train) is timed from its *intended* injection time until
+ * its last frame leaves through `ethdriver_tx` (TX) or is copied to the
+ * client buffer by `client_rx` (RX). Measuring from the intended time
+ * corrects for coordinated omission: when the firewall falls behind, the
+ * queueing delay shows up in the latency instead of silently lowering
+ * the offered load.
+ *
+ * For every traffic mix the saturation throughput is measured first, then
+ * the offered load is swept up to and past it, giving the
+ * latency-vs-throughput curve.
+ *
+ * Usage: bench_latency [units per load point]
+ */
+#include "bench_glue.h"
+#include "test_data.h"
+
+#define MAX_UNIT_FRAMES 4
+#define DEFAULT_UNITS 2000
+
+enum direction {
+  DIR_TX, DIR_RX
+};
+
+struct traffic_unit {
+  uint8_t *frames[MAX_UNIT_FRAMES];
+  int lens[MAX_UNIT_FRAMES];
+  int count;
+};
+
+struct traffic_mix {
+  const char *name;
+  struct traffic_unit units[8];
+  int count;
+};
+
+static struct traffic_mix mixes[] = {
+  { "ping", { { { packet_bytes_ping }, { sizeof(packet_bytes_ping) }, 1 } }, 1 },
+  { "arp", { { { packet_bytes_arp }, { sizeof(packet_bytes_arp) }, 1 } }, 1 },
+  { "udp", { { { packet_bytes_udp_1 }, { sizeof(packet_bytes_udp_1) }, 1 } }, 1 },
+  { "udp-frag", { { { packet_bytes_udp_frag1, packet_bytes_udp_frag2,
+      packet_bytes_udp_frag3 }, { sizeof(packet_bytes_udp_frag1),
+      sizeof(packet_bytes_udp_frag2), sizeof(packet_bytes_udp_frag3) }, 3 } },
+      1 },
+  { "mixed", {
+      { { packet_bytes_udp_1 }, { sizeof(packet_bytes_udp_1) }, 1 },
+      { { packet_bytes_ping }, { sizeof(packet_bytes_ping) }, 1 },
+      { { packet_bytes_udp_1 }, { sizeof(packet_bytes_udp_1) }, 1 },
+      { { packet_bytes_arp }, { sizeof(packet_bytes_arp) }, 1 },
+      { { packet_bytes_udp_frag1, packet_bytes_udp_frag2,
+          packet_bytes_udp_frag3 }, { sizeof(packet_bytes_udp_frag1),
+          sizeof(packet_bytes_udp_frag2), sizeof(packet_bytes_udp_frag3) }, 3 } },
+      5 },
+};
+
+/* offered load as a fraction of the measured saturation throughput */
+static const double load_points[] = { 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 1.0,
+    1.1, 1.25 };
+
+struct load_result {
+  double offered;
+  double achieved;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+  uint64_t raw_p99;
+};
+
+/**
+ * Inject one unit of traffic, return the time its last frame came out,
+ * or the current time if nothing came out (the unit was dropped)
+ */
+static uint64_t send_unit(const struct traffic_unit *unit, enum direction dir)
+{
+  uint64_t out_frames = (dir == DIR_TX) ? bench_tx_frames : bench_rx_frames;
+  for (int i = 0; i < unit->count; i++) {
+    if (dir == DIR_TX) {
+      bench_client_tx(unit->frames[i], unit->lens[i]);
+    } else {
+      bench_inject_rx(unit->frames[i], unit->lens[i]);
+      bench_client_rx_drain();
+    }
+  }
+  if (dir == DIR_TX) {
+    return (bench_tx_frames != out_frames) ? bench_last_tx_ns : bench_now_ns();
+  }
+  return (bench_rx_frames != out_frames) ? bench_last_rx_ns : bench_now_ns();
+}
+
+/**
+ * Offer `rate` units/s for `count` units, `rate` <= 0 means as fast as possible
+ */
+static void run_load_point(const struct traffic_mix *mix, enum direction dir,
+    double rate, int count, uint64_t *corrected, uint64_t *raw,
+    struct load_result *result)
+{
+  uint64_t interval = (rate > 0) ? (uint64_t) (1e9 / rate) : 0;
+  uint64_t start = bench_now_ns() + 1000000;
+
+  bench_wait_until(start);
+  for (int i = 0; i < count; i++) {
+    uint64_t intended = start + i * interval;
+    bench_wait_until(intended);
+    uint64_t actual = bench_now_ns();
+    uint64_t done = send_unit(&mix->units[i % mix->count], dir);
+    corrected[i] = done - intended;
+    raw[i] = done - actual;
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+
+  bench_sort(corrected, count);
+  bench_sort(raw, count);
+  result->offered = rate;
+  result->achieved = count * 1e9 / elapsed;
+  result->p50 = bench_percentile(corrected, count, 50);
+  result->p90 = bench_percentile(corrected, count, 90);
+  result->p99 = bench_percentile(corrected, count, 99);
+  result->p999 = bench_percentile(corrected, count, 99.9);
+  result->max = corrected[count - 1];
+  result->raw_p99 = bench_percentile(raw, count, 99);
+}
+
+int main(int argc, char **argv)
+{
+  int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_UNITS;
+  if (count <= 0) {
+    printf("Usage: %s [units per load point]\n", argv[0]);
+    exit(1);
+  }
+
+  uint64_t *corrected = malloc(count * sizeof(uint64_t));
+  uint64_t *raw = malloc(count * sizeof(uint64_t));
+  struct load_result result;
+
+  for (int m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+    for (int d = DIR_TX; d <= DIR_RX; d++) {
+      const char *dir_name = (d == DIR_TX) ? "tx" : "rx";
+
+      // warm up, then find the saturation throughput
+      run_load_point(&mixes[m], d, 0, count, corrected, raw, &result);
+      run_load_point(&mixes[m], d, 0, count, corrected, raw, &result);
+      double saturation = result.achieved;
+
+      printf("\nmix %s, %s: saturation %.0f units/s\n", mixes[m].name,
+          dir_name, saturation);
+      printf("%10s %12s %12s %10s %10s %10s %10s %10s %12s\n", "load",
+          "offered/s", "achieved/s", "p50 us", "p90 us", "p99 us",
+          "p99.9 us", "max us", "raw p99 us");
+      for (int l = 0; l < sizeof(load_points) / sizeof(load_points[0]);
+          l++) {
+        run_load_point(&mixes[m], d, saturation * load_points[l], count,
+            corrected, raw, &result);
+        printf("%9.0f%% %12.0f %12.0f %10.2f %10.2f %10.2f %10.2f %10.2f "
+            "%12.2f\n", load_points[l] * 100, result.offered,
+            result.achieved, result.p50 / 1e3, result.p90 / 1e3,
+            result.p99 / 1e3, result.p999 / 1e3, result.max / 1e3,
+            result.raw_p99 / 1e3);
+      }
+    }
+  }
+
+  free(corrected);
+  free(raw);
+  return 0;
+}
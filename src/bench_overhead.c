@@ -0,0 +1,156 @@
+/**
+ * Filtering overhead benchmark
+ *
+ * Runs the same traffic through rustwall and through the CAmkES Firewall
+ * component it replaces, which only copies frames between `client_buf` and
+ * `ethdriver_buf`. The difference is what the Rust pipeline costs over the
+ * bare copy, reported per traffic class and direction in ns per input frame
+ * and in input bytes per CPU cycle.
+ *
+ * Usage: bench_overhead [units per class]
+ */
+#include "bench_glue.h"
+#include "test_data.h"
+
+#define DEFAULT_UNITS 100000
+#define WARMUP_UNITS 1000
+#define MAX_UNIT_FRAMES 4
+
+/**
+ * `firewall.c` from the CAmkES VM Firewall component, adapted to the Linux
+ * stubs and renamed so that it can be linked next to rustwall.
+ * Frames are copied as they are, nothing is inspected.
+ */
+static int passthrough_client_tx(int len)
+{
+  memcpy(ethdriver_buf, client_buf(1), len);
+  return ethdriver_tx(len);
+}
+
+static int passthrough_client_rx(int *len)
+{
+  int ret = ethdriver_rx(len);
+  if (ret != -1) {
+    memcpy(client_buf(1), ethdriver_buf, *len);
+  }
+  return ret;
+}
+/**
+ * END OF firewall.c
+ */
+
+enum direction {
+  DIR_TX, DIR_RX
+};
+
+struct component {
+  const char *name;
+  int (*tx)(int len);
+  int (*rx)(int *len);
+};
+
+static const struct component components[] = {
+  { "passthrough", passthrough_client_tx, passthrough_client_rx },
+  { "rustwall", client_tx, client_rx },
+};
+
+struct traffic_class {
+  const char *name;
+  uint8_t *frames[MAX_UNIT_FRAMES];
+  int lens[MAX_UNIT_FRAMES];
+  int count;
+};
+
+static const struct traffic_class classes[] = {
+  { "arp", { packet_bytes_arp }, { sizeof(packet_bytes_arp) }, 1 },
+  { "ping", { packet_bytes_ping }, { sizeof(packet_bytes_ping) }, 1 },
+  { "udp", { packet_bytes_udp_1 }, { sizeof(packet_bytes_udp_1) }, 1 },
+  { "udp-frag", { packet_bytes_udp_frag1, packet_bytes_udp_frag2,
+      packet_bytes_udp_frag3 }, { sizeof(packet_bytes_udp_frag1),
+      sizeof(packet_bytes_udp_frag2), sizeof(packet_bytes_udp_frag3) }, 3 },
+  { "udp-frag-5k", { packet_bytes_udp_frag_5k_1, packet_bytes_udp_frag_5k_2,
+      packet_bytes_udp_frag_5k_3, packet_bytes_udp_frag_5k_4 }, {
+      sizeof(packet_bytes_udp_frag_5k_1), sizeof(packet_bytes_udp_frag_5k_2),
+      sizeof(packet_bytes_udp_frag_5k_3), sizeof(packet_bytes_udp_frag_5k_4) },
+      4 },
+};
+
+struct result {
+  double ns_per_frame;
+  double bytes_per_cycle;
+  double out_per_frame;
+};
+
+static void send_unit(const struct component *c,
+    const struct traffic_class *cls, enum direction dir)
+{
+  int len, ret;
+  for (int i = 0; i < cls->count; i++) {
+    if (dir == DIR_TX) {
+      memcpy(client_buf(1), cls->frames[i], cls->lens[i]);
+      c->tx(cls->lens[i]);
+    } else {
+      bench_inject_rx(cls->frames[i], cls->lens[i]);
+      // 1 means more frames are waiting, -1 that nothing was returned
+      do {
+        ret = c->rx(&len);
+        if (ret != -1) {
+          bench_rx_frames++;
+        }
+      } while (ret == 1);
+    }
+  }
+}
+
+static void measure(const struct component *c, const struct traffic_class *cls,
+    enum direction dir, int count, struct result *result)
+{
+  for (int i = 0; i < WARMUP_UNITS; i++) {
+    send_unit(c, cls, dir);
+  }
+
+  uint64_t bytes = 0;
+  for (int i = 0; i < cls->count; i++) {
+    bytes += cls->lens[i];
+  }
+  uint64_t out = (dir == DIR_TX) ? bench_tx_frames : bench_rx_frames;
+  uint64_t start_ns = bench_now_ns();
+  uint64_t start_cycles = bench_cycles();
+  for (int i = 0; i < count; i++) {
+    send_unit(c, cls, dir);
+  }
+  uint64_t cycles = bench_cycles() - start_cycles;
+  uint64_t ns = bench_now_ns() - start_ns;
+  out = ((dir == DIR_TX) ? bench_tx_frames : bench_rx_frames) - out;
+
+  uint64_t frames = (uint64_t) count * cls->count;
+  result->ns_per_frame = (double) ns / frames;
+  result->bytes_per_cycle = cycles ? (double) bytes * count / cycles : 0;
+  result->out_per_frame = (double) out / frames;
+}
+
+int main(int argc, char **argv)
+{
+  int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_UNITS;
+  if (count <= 0) {
+    printf("Usage: %s [units per class]\n", argv[0]);
+    exit(1);
+  }
+
+  printf("%-12s %3s %14s %14s %10s %14s %14s %10s %9s\n", "class", "dir",
+      "passthru ns", "rustwall ns", "tax ns", "passthru B/c", "rustwall B/c",
+      "slowdown", "out/in");
+  for (int c = 0; c < sizeof(classes) / sizeof(classes[0]); c++) {
+    for (int d = DIR_TX; d <= DIR_RX; d++) {
+      struct result base, rust;
+      measure(&components[0], &classes[c], d, count, &base);
+      measure(&components[1], &classes[c], d, count, &rust);
+      printf("%-12s %3s %14.1f %14.1f %10.1f %14.3f %14.3f %9.1fx %9.2f\n",
+          classes[c].name, (d == DIR_TX) ? "tx" : "rx", base.ns_per_frame,
+          rust.ns_per_frame, rust.ns_per_frame - base.ns_per_frame,
+          base.bytes_per_cycle, rust.bytes_per_cycle,
+          rust.ns_per_frame / base.ns_per_frame, rust.out_per_frame);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,184 @@
+/**
+ * Multi-threaded scaling benchmark
+ *
+ * Runs 1..N threads that call `client_tx()` and/or `client_rx()` as fast as
+ * they can, each acting as an independent caller with its own client buffer
+ * (see `bench_glue.c`) and its own stream of synthetic traffic (see
+ * `pktgen.h`): a UDP, ICMP and ARP mix from many addresses and ports.
+ * For every thread count it
+ * reports the aggregate throughput, the per-thread spread, Jain's fairness
+ * index and the scaling efficiency relative to a single thread, and flags
+ * the thread count where adding threads stops paying off.
+ *
+ * Usage: bench_threads [max threads] [seconds per step] [tx|rx|mixed]
+ *     [max payload]
+ *   mixed: even threads transmit, odd threads receive
+ *   max payload: largest ICMP / UDP payload, above 1472 bytes
+ *     packets are sent as fragment trains
+ */
+#include "bench_glue.h"
+#include "pktgen.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+#define DEFAULT_SECONDS 1.0
+#define DEFAULT_MAX_PAYLOAD 64
+#define MAX_FRAME_LEN 1514
+
+/* below this gain over the previous step, scaling counts as flat */
+#define FLAT_MARGINAL_GAIN 0.10
+
+enum mode {
+  MODE_TX, MODE_RX, MODE_MIXED
+};
+
+struct worker {
+  pthread_t thread;
+  int id;
+  bool transmit;
+  uint64_t frames;
+  struct pktgen gen;
+  uint8_t frame[MAX_FRAME_LEN];
+};
+
+static pthread_barrier_t start_barrier;
+static atomic_bool stop = false;
+
+static struct pktgen_config traffic;
+
+static void *worker_main(void *arg)
+{
+  struct worker *w = (struct worker *) arg;
+
+  pthread_barrier_wait(&start_barrier);
+  while (!atomic_load(&stop)) {
+    int len = pktgen_next(&w->gen, w->frame, sizeof(w->frame));
+    if (len < 0) {
+      continue;
+    }
+    if (w->transmit) {
+      bench_client_tx(w->frame, len);
+    } else {
+      bench_inject_rx(w->frame, len);
+      bench_client_rx_drain();
+    }
+  }
+  w->frames = w->transmit ? bench_tx_frames : bench_rx_frames;
+  return NULL;
+}
+
+/**
+ * Run `count` workers for `seconds`, return the aggregate frames/s
+ */
+static double run_step(struct worker *workers, int count, enum mode mode,
+    double seconds, double *fairness, double *min_share, double *max_share)
+{
+  atomic_store(&stop, false);
+  pthread_barrier_init(&start_barrier, NULL, count + 1);
+  for (int i = 0; i < count; i++) {
+    workers[i].id = i;
+    workers[i].frames = 0;
+    workers[i].transmit = (mode == MODE_TX)
+        || ((mode == MODE_MIXED) && (i % 2 == 0));
+    struct pktgen_config config = traffic;
+    config.seed += i;
+    pktgen_init(&workers[i].gen, &config);
+    pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+  }
+
+  pthread_barrier_wait(&start_barrier);
+  uint64_t start = bench_now_ns();
+  usleep((useconds_t) (seconds * 1e6));
+  atomic_store(&stop, true);
+  for (int i = 0; i < count; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  pthread_barrier_destroy(&start_barrier);
+
+  double sum = 0, sum_sq = 0;
+  double min = -1, max = 0;
+  for (int i = 0; i < count; i++) {
+    double f = (double) workers[i].frames;
+    sum += f;
+    sum_sq += f * f;
+    if ((min < 0) || (f < min)) {
+      min = f;
+    }
+    if (f > max) {
+      max = f;
+    }
+  }
+  // Jain's index: 1.0 when every thread got the same share, 1/n when one got all
+  *fairness = (sum_sq > 0) ? (sum * sum) / (count * sum_sq) : 0;
+  *min_share = (sum > 0) ? min / sum : 0;
+  *max_share = (sum > 0) ? max / sum : 0;
+  return sum * 1e9 / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+  int max_threads = (argc > 1) ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+  double seconds = (argc > 2) ? atof(argv[2]) : DEFAULT_SECONDS;
+  static struct worker workers[MAX_THREADS];
+  int max_payload = (argc > 4) ? atoi(argv[4]) : DEFAULT_MAX_PAYLOAD;
+  enum mode mode = MODE_MIXED;
+  if (argc > 3) {
+    if (strcmp(argv[3], "tx") == 0) {
+      mode = MODE_TX;
+    } else if (strcmp(argv[3], "rx") == 0) {
+      mode = MODE_RX;
+    } else if (strcmp(argv[3], "mixed") != 0) {
+      max_threads = 0;
+    }
+  }
+
+  pktgen_default_config(&traffic);
+  traffic.weights[PKTGEN_UDP] = 2;
+  traffic.weights[PKTGEN_ICMP] = 1;
+  traffic.weights[PKTGEN_ARP] = 1;
+  traffic.src_ip.count = 256;
+  traffic.src_port.count = 1024;
+  traffic.max_payload = max_payload;
+  if ((max_threads <= 0) || (seconds <= 0) || (max_payload < 0)
+      || (pktgen_init(&workers[0].gen, &traffic) != 0)) {
+    printf("Usage: %s [max threads] [seconds per step] [tx|rx|mixed] "
+        "[max payload]\n", argv[0]);
+    exit(1);
+  }
+  if (max_threads > MAX_THREADS) {
+    max_threads = MAX_THREADS;
+  }
+
+  double fairness, min_share, max_share;
+  double single = 0, previous = 0;
+  int flat_at = 0;
+
+  printf("%8s %14s %10s %10s %10s %10s %10s\n", "threads", "frames/s",
+      "speedup", "efficiency", "fairness", "min share", "max share");
+  for (int n = 1; n <= max_threads; n++) {
+    double rate = run_step(workers, n, mode, seconds, &fairness, &min_share,
+        &max_share);
+    if (n == 1) {
+      single = rate;
+    }
+    double speedup = rate / single;
+    printf("%8d %14.0f %10.2f %10.2f %10.3f %9.1f%% %9.1f%%\n", n, rate,
+        speedup, speedup / n, fairness, min_share * 100, max_share * 100);
+    if ((n > 1) && (flat_at == 0)
+        && (rate < previous * (1.0 + FLAT_MARGINAL_GAIN))) {
+      flat_at = n;
+    }
+    previous = rate;
+  }
+
+  if (flat_at) {
+    printf("\nscaling flattens at %d threads (less than %.0f%% gain over %d)\n",
+        flat_at, FLAT_MARGINAL_GAIN * 100, flat_at - 1);
+  } else {
+    printf("\nscaling did not flatten up to %d threads\n", max_threads);
+  }
+  return 0;
+}
@@ -0,0 +1,228 @@
+use std::cell::UnsafeCell;
+use std::sync::atomic::{fence, AtomicUsize, Ordering};
+
+use constants;
+use smoltcp::Error;
+
+/// Capture nothing (default)
+pub const CAPTURE_OFF: u32 = 0;
+/// Capture the head of every frame that `process_ethernet` rejects.
+/// The head of every frame is copied before it is processed, since the
+/// verdict isn't known yet, so this costs a little on forwarded frames too.
+pub const CAPTURE_DROPS: u32 = 1;
+/// Capture the head of every N-th frame, regardless of the verdict
+pub const CAPTURE_SAMPLED: u32 = 2;
+
+/// pcap global header constants, see https://wiki.wireshark.org/Development/LibpcapFileFormat
+const PCAP_MAGIC: u32 = 0xa1b2c3d4;
+const PCAP_VERSION_MAJOR: u16 = 2;
+const PCAP_VERSION_MINOR: u16 = 4;
+const PCAP_LINKTYPE_ETHERNET: u32 = 1;
+const PCAP_GLOBAL_HEADER_LEN: usize = 24;
+const PCAP_RECORD_HEADER_LEN: usize = 16;
+
+static MODE: AtomicUsize = AtomicUsize::new(CAPTURE_OFF as usize);
+static SAMPLE_RATE: AtomicUsize = AtomicUsize::new(1);
+static SAMPLE_COUNTER: AtomicUsize = AtomicUsize::new(0);
+/// Sequence number of the next record, the slot index is `seq % CAPTURE_SLOTS`
+static NEXT_SEQ: AtomicUsize = AtomicUsize::new(0);
+
+/// `CaptureSlot::seq` while a writer is filling the slot in
+const SLOT_WRITING: usize = std::usize::MAX;
+
+/// A single captured frame head
+/// `seq` holds the record sequence number + 1 once the slot is complete,
+/// 0 while it was never written and `SLOT_WRITING` while a writer is filling
+/// it in. Writers claim the slot by swapping a complete, older `seq` for
+/// `SLOT_WRITING`, so a writer that was lapped by one a whole ring ahead
+/// gives up instead of writing the same slot. The dump checks `seq` before
+/// and after copying the slot and skips it if it changed, so writers never
+/// have to take a lock.
+struct CaptureSlot {
+    seq: AtomicUsize,
+    orig_len: AtomicUsize,
+    data: UnsafeCell<[u8; constants::CAPTURE_SNAPLEN]>,
+}
+
+struct CaptureRing {
+    slots: Vec<CaptureSlot>,
+}
+
+/// Slots are only written after being claimed through their `seq`, and readers
+/// validate them with `seq`, see `CaptureSlot`
+unsafe impl Sync for CaptureRing {}
+
+impl CaptureRing {
+    fn new() -> CaptureRing {
+        let mut slots = Vec::with_capacity(constants::CAPTURE_SLOTS);
+        for _idx in 0..constants::CAPTURE_SLOTS {
+            slots.push(CaptureSlot {
+                seq: AtomicUsize::new(0),
+                orig_len: AtomicUsize::new(0),
+                data: UnsafeCell::new([0; constants::CAPTURE_SNAPLEN]),
+            });
+        }
+        CaptureRing { slots: slots }
+    }
+}
+
+lazy_static! {
+    /// Preallocated on first use, never grows
+    static ref CAPTURE_RING: CaptureRing = CaptureRing::new();
+}
+
+/// Copy of the head of a frame, taken before the frame is consumed by `process_ethernet`
+/// so that it can still be recorded if the frame gets dropped
+pub struct FrameHead {
+    orig_len: usize,
+    data: [u8; constants::CAPTURE_SNAPLEN],
+}
+
+/// Called for every frame entering the firewall
+/// In sampled mode every N-th frame is recorded right away and `None` is returned.
+/// In drops mode the head of the frame is returned, pass it to `record_drop()`
+/// if the frame is rejected.
+pub fn observe(frame: &[u8]) -> Option<FrameHead> {
+    match MODE.load(Ordering::Relaxed) as u32 {
+        CAPTURE_DROPS => {
+            let len = frame.len().min(constants::CAPTURE_SNAPLEN);
+            let mut head = FrameHead {
+                orig_len: frame.len(),
+                data: [0; constants::CAPTURE_SNAPLEN],
+            };
+            head.data[..len].copy_from_slice(&frame[..len]);
+            Some(head)
+        }
+        CAPTURE_SAMPLED => {
+            let rate = SAMPLE_RATE.load(Ordering::Relaxed);
+            if SAMPLE_COUNTER.fetch_add(1, Ordering::Relaxed) % rate == 0 {
+                record(frame, frame.len());
+            }
+            None
+        }
+        _ => None,
+    }
+}
+
+/// Record a frame that was rejected by the firewall with `err`
+/// A fragment that is merely waiting for the rest of its packet is not a drop.
+pub fn record_drop(head: Option<FrameHead>, err: Error) {
+    if err == Error::Fragmented {
+        return;
+    }
+    if let Some(head) = head {
+        let len = head.orig_len.min(constants::CAPTURE_SNAPLEN);
+        record(&head.data[..len], head.orig_len);
+    }
+}
+
+/// Record a frame dropped where no error is returned, e.g. because a queue
+/// is full, as it was when it got dropped
+pub fn record_dropped(frame: &[u8]) {
+    if MODE.load(Ordering::Relaxed) as u32 == CAPTURE_DROPS {
+        record(frame, frame.len());
+    }
+}
+
+/// Store `data` (at most CAPTURE_SNAPLEN bytes) in the next slot of the ring,
+/// overwriting the oldest record. The record is skipped if the slot is still
+/// being written, or was already taken by a newer record.
+fn record(data: &[u8], orig_len: usize) {
+    let len = data.len().min(constants::CAPTURE_SNAPLEN);
+    let seq = NEXT_SEQ.fetch_add(1, Ordering::Relaxed);
+    let slot = &CAPTURE_RING.slots[seq % constants::CAPTURE_SLOTS];
+
+    let prev = slot.seq.load(Ordering::Relaxed);
+    if prev == SLOT_WRITING || prev > seq
+        || slot.seq.compare_exchange(prev, SLOT_WRITING, Ordering::Relaxed, Ordering::Relaxed).is_err()
+    {
+        return;
+    }
+    fence(Ordering::Release);
+    slot.orig_len.store(orig_len, Ordering::Relaxed);
+    let slot_data = unsafe { &mut *slot.data.get() };
+    slot_data[..len].copy_from_slice(&data[..len]);
+    slot.seq.store(seq + 1, Ordering::Release);
+}
+
+fn put_u16(buf: &mut [u8], val: u16) {
+    buf[0] = val as u8;
+    buf[1] = (val >> 8) as u8;
+}
+
+fn put_u32(buf: &mut [u8], val: u32) {
+    put_u16(&mut buf[0..2], val as u16);
+    put_u16(&mut buf[2..4], (val >> 16) as u16);
+}
+
+/// Select what is captured
+/// `mode` is one of CAPTURE_OFF, CAPTURE_DROPS or CAPTURE_SAMPLED,
+/// `sample_rate` is N for 1-in-N sampling and is ignored in the other modes
+/// returns 0 on success, -1 on invalid arguments
+#[no_mangle]
+pub extern "C" fn firewall_capture_config(mode: u32, sample_rate: u32) -> i32 {
+    match mode {
+        CAPTURE_OFF | CAPTURE_DROPS => {}
+        CAPTURE_SAMPLED => {
+            if sample_rate == 0 {
+                return -1;
+            }
+            SAMPLE_RATE.store(sample_rate as usize, Ordering::Relaxed);
+        }
+        _ => return -1,
+    }
+    MODE.store(mode as usize, Ordering::Relaxed);
+    0
+}
+
+/// Write the content of the capture ring as a pcap file image into `buf`,
+/// oldest record first. Only complete records are written.
+/// There is no wall clock available, so each record is timestamped
+/// with its sequence number in microseconds.
+/// returns the number of bytes written, or -1 if `buf` can't even hold the pcap header
+#[no_mangle]
+pub extern "C" fn firewall_capture_dump(buf: *mut u8, max_len: i32) -> i32 {
+    if buf.is_null() || max_len < PCAP_GLOBAL_HEADER_LEN as i32 {
+        return -1;
+    }
+    let out = unsafe { std::slice::from_raw_parts_mut(buf, max_len as usize) };
+
+    put_u32(&mut out[0..4], PCAP_MAGIC);
+    put_u16(&mut out[4..6], PCAP_VERSION_MAJOR);
+    put_u16(&mut out[6..8], PCAP_VERSION_MINOR);
+    put_u32(&mut out[8..12], 0); // thiszone
+    put_u32(&mut out[12..16], 0); // sigfigs
+    put_u32(&mut out[16..20], constants::CAPTURE_SNAPLEN as u32);
+    put_u32(&mut out[20..24], PCAP_LINKTYPE_ETHERNET);
+    let mut pos = PCAP_GLOBAL_HEADER_LEN;
+
+    let end = NEXT_SEQ.load(Ordering::Acquire);
+    let start = end.saturating_sub(constants::CAPTURE_SLOTS);
+    let mut data = [0; constants::CAPTURE_SNAPLEN];
+    for seq in start..end {
+        let slot = &CAPTURE_RING.slots[seq % constants::CAPTURE_SLOTS];
+        if slot.seq.load(Ordering::Acquire) != seq + 1 {
+            continue; // being written, or already overwritten
+        }
+        let orig_len = slot.orig_len.load(Ordering::Relaxed);
+        let len = orig_len.min(constants::CAPTURE_SNAPLEN);
+        let slot_data = unsafe { &*slot.data.get() };
+        data[..len].copy_from_slice(&slot_data[..len]);
+        fence(Ordering::Acquire);
+        if slot.seq.load(Ordering::Relaxed) != seq + 1 {
+            continue; // overwritten while we were copying it
+        }
+
+        if pos + PCAP_RECORD_HEADER_LEN + len > out.len() {
+            break;
+        }
+        put_u32(&mut out[pos..pos + 4], (seq / 1_000_000) as u32);
+        put_u32(&mut out[pos + 4..pos + 8], (seq % 1_000_000) as u32);
+        put_u32(&mut out[pos + 8..pos + 12], len as u32);
+        put_u32(&mut out[pos + 12..pos + 16], orig_len as u32);
+        pos += PCAP_RECORD_HEADER_LEN;
+        out[pos..pos + len].copy_from_slice(&data[..len]);
+        pos += len;
+    }
+    pos as i32
+}
@@ -0,0 +1,76 @@
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+
+use smoltcp::time::Instant;
+
+/// Calls to `client_tx()` and `client_rx()` so far, see `tick()`.
+/// 64 bits, so that it doesn't wrap on 32 bit targets either.
+static TICKS: AtomicU64 = AtomicU64::new(0);
+/// Set once a harness took over time with `firewall_clock_set_virtual()`
+static VIRTUAL: AtomicBool = AtomicBool::new(false);
+static VIRTUAL_MS: AtomicU64 = AtomicU64::new(0);
+
+/// Advance the default clock by one tick, once per call of `client_tx()`
+/// and `client_rx()`, however many frames or fragments the call handles
+pub fn tick() {
+    TICKS.fetch_add(1, Ordering::Relaxed);
+}
+
+/// Current time of the firewall, used for everything that ages out.
+/// There is no wall clock on seL4, so by default this counts ticks, one per
+/// call into the firewall, and the `*_timeout_ms` settings are really
+/// numbers of calls: with the client calling `client_rx()` every ms they
+/// come out as ms, but an idle client stops time. Reading it doesn't
+/// advance it. With the `virtual-clock` feature a harness can replace it
+/// with a clock in real ms that only moves when told to, see
+/// `firewall_clock_advance()`.
+pub fn now() -> Instant {
+    if VIRTUAL.load(Ordering::Acquire) {
+        Instant::from_millis(VIRTUAL_MS.load(Ordering::Acquire) as i64)
+    } else {
+        Instant::from_millis(TICKS.load(Ordering::Relaxed) as i64)
+    }
+}
+
+/// Milliseconds from `earlier` to `later`, 0 if `later` is not later
+pub fn elapsed_ms(earlier: Instant, later: Instant) -> u64 {
+    let diff = later.total_millis() - earlier.total_millis();
+    if diff > 0 {
+        diff as u64
+    } else {
+        0
+    }
+}
+
+/// Switch to the virtual clock, starting at `start_ms`.
+/// From now on time stands still between calls to `firewall_clock_advance()`.
+#[cfg(feature = "virtual-clock")]
+#[no_mangle]
+pub extern "C" fn firewall_clock_set_virtual(start_ms: u64) {
+    VIRTUAL_MS.store(start_ms, Ordering::Release);
+    VIRTUAL.store(true, Ordering::Release);
+}
+
+/// Move the virtual clock `ms` milliseconds forward and expire whatever
+/// timed out in the meantime, like a timer tick would
+/// returns the new time in ms, or -1 if the virtual clock is not in use
+#[cfg(feature = "virtual-clock")]
+#[no_mangle]
+pub extern "C" fn firewall_clock_advance(ms: u64) -> i64 {
+    if !VIRTUAL.load(Ordering::Acquire) {
+        return -1;
+    }
+    let now = VIRTUAL_MS.fetch_add(ms, Ordering::AcqRel) + ms;
+    ::utils::expire_all_fragments(Instant::from_millis(now as i64));
+    now as i64
+}
+
+/// Current time, in ms of the virtual clock or in ticks
+#[cfg(feature = "virtual-clock")]
+#[no_mangle]
+pub extern "C" fn firewall_clock_now_ms() -> u64 {
+    if VIRTUAL.load(Ordering::Acquire) {
+        VIRTUAL_MS.load(Ordering::Acquire)
+    } else {
+        TICKS.load(Ordering::Relaxed)
+    }
+}
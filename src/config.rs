@@ -0,0 +1,296 @@
+use std::slice;
+use std::str;
+
+use smoltcp::wire::Ipv4Address;
+
+use constants;
+
+/// Flows with a port in `first_port..=last_port` are trusted after `streak`
+/// datagrams in a row passed the external filter, from then on only every
+/// `sample`th datagram is inspected, see `flows::lane_skips()`
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct FastLane {
+    pub first_port: u16,
+    pub last_port: u16,
+    pub streak: u32,
+    pub sample: u32,
+}
+
+/// Sizes and limits of a deployment. The defaults are the values in
+/// `constants.rs`, a deployment can override them once at init with
+/// `firewall_configure()`, before the first frame is processed.
+#[derive(Clone, Debug, PartialEq)]
+pub struct FirewallConfig {
+    /// size of the client and ethdriver dataports
+    pub buffer_size: usize,
+    /// largest IPv4 packet sent to the client without fragmenting it
+    pub client_mtu: usize,
+    /// largest IPv4 packet sent to the ethdriver without fragmenting it
+    pub ethdriver_mtu: usize,
+    /// reassembly slots per direction
+    pub supported_fragments: usize,
+    /// size of each reassembly slot
+    pub max_reassembled_fragment_size: usize,
+    /// frames waiting for the client or the ethdriver, per direction
+    pub max_enqueued_packets: usize,
+    /// see `constants::FRAGMENT_TIMEOUT_MS`
+    pub fragment_timeout_ms: u64,
+    /// the client may hand over UDP datagrams larger than the MTU of the
+    /// ethdriver in a single frame, up to the size of its dataport. They
+    /// are filtered once and fragmented on their way to the ethdriver.
+    pub large_send: bool,
+    /// answer ARP requests for the client's addresses, see `arp.rs`.
+    /// Off by default, the client answers its own.
+    pub arp_responder: bool,
+    /// an address of the client, known before it sends anything
+    pub client_ip: Option<Ipv4Address>,
+    /// drop multicast from the wire for groups the client isn't in,
+    /// see `mcast.rs`
+    pub multicast_filter: bool,
+    /// groups the client is in without reporting them over IGMP
+    pub multicast_groups: Vec<Ipv4Address>,
+    /// replies to UDP flows the client opened skip `packet_in()`,
+    /// see `flows.rs`
+    pub conntrack: bool,
+    /// see `constants::FLOW_TIMEOUT_MS`, also how long a trusted flow
+    /// stays trusted without traffic
+    pub flow_timeout_ms: u64,
+    /// port ranges with sampled inspection, the first match counts
+    pub fast_lanes: Vec<FastLane>,
+}
+
+impl FirewallConfig {
+    pub fn new() -> FirewallConfig {
+        FirewallConfig {
+            buffer_size: constants::BUFFER_SIZE,
+            client_mtu: constants::MTU,
+            ethdriver_mtu: constants::MTU,
+            supported_fragments: constants::SUPPORTED_FRAGMENTS,
+            max_reassembled_fragment_size: constants::MAX_REASSEMBLED_FRAGMENT_SIZE,
+            max_enqueued_packets: constants::MAX_ENQUEUED_PACKETS,
+            fragment_timeout_ms: constants::FRAGMENT_TIMEOUT_MS,
+            large_send: false,
+            arp_responder: false,
+            client_ip: None,
+            multicast_filter: true,
+            multicast_groups: vec![],
+            conntrack: false,
+            flow_timeout_ms: constants::FLOW_TIMEOUT_MS,
+            fast_lanes: vec![],
+        }
+    }
+
+    /// The larger MTU of the two ports, the largest frame in a dataport
+    pub fn max_mtu(&self) -> usize {
+        self.client_mtu.max(self.ethdriver_mtu)
+    }
+
+    /// Max size of a reassembled UDP packet, includes the header
+    pub fn max_udp_packet_size(&self) -> usize {
+        self.max_reassembled_fragment_size - constants::IPV4_HEADER_SIZE
+            - constants::ETHERNET_FRAME_PAYLOAD
+    }
+
+    /// Max size of a reassembled UDP payload, no header
+    pub fn max_udp_payload_size(&self) -> usize {
+        self.max_udp_packet_size() - constants::UDP_HEADER_SIZE
+    }
+
+    /// Largest frame accepted from the client
+    pub fn max_client_frame_len(&self) -> usize {
+        if self.large_send {
+            self.buffer_size - 1
+        } else {
+            constants::ETHERNET_FRAME_PAYLOAD + self.ethdriver_mtu + constants::ETH_CRC_LEN
+        }
+    }
+
+    /// Parse `key=value` lines on top of the current values.
+    /// Empty lines and lines starting with `#` are skipped,
+    /// `mtu` sets the MTU of both ports, `large_send`, `arp_responder`,
+    /// `multicast_filter` and `conntrack` are 0 or 1, `client_ip` and
+    /// `multicast_group` are dotted quads, every `multicast_group` line adds
+    /// a group. `fast_lane` is `first-last:streak:sample`, every line adds a
+    /// port range.
+    pub fn parse(&mut self, text: &str) -> Result<(), String> {
+        for line in text.lines() {
+            let line = line.trim();
+            if line.is_empty() || line.starts_with('#') {
+                continue;
+            }
+            let mut kv = line.splitn(2, '=');
+            let key = kv.next().unwrap_or("").trim();
+            if key == "client_ip" || key == "multicast_group" {
+                match kv.next().and_then(|v| parse_ipv4(v.trim())) {
+                    Some(address) if key == "client_ip" => self.client_ip = Some(address),
+                    Some(address) => self.multicast_groups.push(address),
+                    None => return Err(format!("bad line \"{}\"", line)),
+                }
+                continue;
+            }
+            if key == "fast_lane" {
+                match kv.next().and_then(|v| parse_fast_lane(v.trim())) {
+                    Some(lane) => self.fast_lanes.push(lane),
+                    None => return Err(format!("bad line \"{}\"", line)),
+                }
+                continue;
+            }
+            let value = match kv.next().map(|v| v.trim().parse::<u64>()) {
+                Some(Ok(value)) => value,
+                _ => return Err(format!("bad line \"{}\"", line)),
+            };
+            match key {
+                "buffer_size" => self.buffer_size = value as usize,
+                "mtu" => {
+                    self.client_mtu = value as usize;
+                    self.ethdriver_mtu = value as usize;
+                }
+                "client_mtu" => self.client_mtu = value as usize,
+                "ethdriver_mtu" => self.ethdriver_mtu = value as usize,
+                "supported_fragments" => self.supported_fragments = value as usize,
+                "max_reassembled_fragment_size" => self.max_reassembled_fragment_size = value as usize,
+                "max_enqueued_packets" => self.max_enqueued_packets = value as usize,
+                "fragment_timeout_ms" => self.fragment_timeout_ms = value,
+                "flow_timeout_ms" => self.flow_timeout_ms = value,
+                "large_send" if value <= 1 => self.large_send = value == 1,
+                "arp_responder" if value <= 1 => self.arp_responder = value == 1,
+                "multicast_filter" if value <= 1 => self.multicast_filter = value == 1,
+                "conntrack" if value <= 1 => self.conntrack = value == 1,
+                "large_send" | "arp_responder" | "multicast_filter" | "conntrack" => {
+                    return Err(format!("bad line \"{}\"", line))
+                }
+                _ => return Err(format!("unknown key \"{}\"", key)),
+            }
+        }
+        Ok(())
+    }
+
+    /// Check that the values fit together
+    pub fn validate(&self) -> Result<(), &'static str> {
+        for mtu in &[self.client_mtu, self.ethdriver_mtu] {
+            if *mtu < constants::MIN_MTU || *mtu > constants::MAX_JUMBO_MTU {
+                return Err("mtu out of range");
+            }
+        }
+        // `sel4_buffer_insert()` needs room for a whole frame
+        if self.buffer_size <= constants::ETHERNET_FRAME_PAYLOAD + self.max_mtu() + constants::ETH_CRC_LEN {
+            return Err("buffer_size can't hold a frame of mtu bytes");
+        }
+        if self.supported_fragments == 0 || self.supported_fragments > constants::MAX_SUPPORTED_FRAGMENTS {
+            return Err("supported_fragments out of range");
+        }
+        if self.max_reassembled_fragment_size < constants::ETHERNET_FRAME_PAYLOAD + self.max_mtu()
+            || self.max_reassembled_fragment_size > constants::MAX_REASSEMBLED_FRAGMENT_SIZE
+        {
+            return Err("max_reassembled_fragment_size out of range");
+        }
+        if self.max_enqueued_packets == 0 || self.max_enqueued_packets > constants::MAX_QUEUE_DEPTH {
+            return Err("max_enqueued_packets out of range");
+        }
+        if self.fragment_timeout_ms == 0 {
+            return Err("fragment_timeout_ms must not be 0");
+        }
+        if self.flow_timeout_ms == 0 {
+            return Err("flow_timeout_ms must not be 0");
+        }
+        if self.fast_lanes.len() > constants::MAX_FAST_LANES {
+            return Err("too many fast_lane lines");
+        }
+        if self.fast_lanes
+            .iter()
+            .any(|lane| lane.first_port > lane.last_port || lane.streak == 0 || lane.sample == 0)
+        {
+            return Err("fast_lane needs first <= last and a streak and sample of at least 1");
+        }
+        if self.client_ip.map_or(false, |address| !address.is_unicast()) {
+            return Err("client_ip must be a unicast address");
+        }
+        // `mcast.rs` adds 224.0.0.1
+        if self.multicast_groups.len() >= constants::MAX_MULTICAST_GROUPS {
+            return Err("too many multicast_group lines");
+        }
+        if self.multicast_groups.iter().any(|group| !group.is_multicast()) {
+            return Err("multicast_group must be a multicast address");
+        }
+        #[cfg(feature = "static-memory")]
+        {
+            if !::slab::fits(self) {
+                return Err("doesn't fit constants::SLAB_CLASSES");
+            }
+        }
+        Ok(())
+    }
+}
+
+/// `a.b.c.d`, None if `text` is anything else
+fn parse_ipv4(text: &str) -> Option<Ipv4Address> {
+    let mut bytes = [0; 4];
+    let mut parts = text.split('.');
+    for byte in bytes.iter_mut() {
+        *byte = parts.next()?.parse::<u8>().ok()?;
+    }
+    match parts.next() {
+        Some(_) => None,
+        None => Some(Ipv4Address::from_bytes(&bytes)),
+    }
+}
+
+/// `first-last:streak:sample`, None if `text` is anything else
+fn parse_fast_lane(text: &str) -> Option<FastLane> {
+    let mut parts = text.split(':');
+    let mut ports = parts.next()?.split('-');
+    let lane = FastLane {
+        first_port: ports.next()?.trim().parse().ok()?,
+        last_port: ports.next()?.trim().parse().ok()?,
+        streak: parts.next()?.trim().parse().ok()?,
+        sample: parts.next()?.trim().parse().ok()?,
+    };
+    match (ports.next(), parts.next()) {
+        (None, None) => Some(lane),
+        _ => None,
+    }
+}
+
+/// Set by `firewall_configure()`, or to the defaults by the first `get()`
+static CONFIG: ::spin::Once<FirewallConfig> = ::spin::Once::new();
+
+/// The configuration in effect. The first call fixes it, pools and
+/// tables are sized from it when they are first used.
+pub fn get() -> &'static FirewallConfig {
+    CONFIG.call_once(FirewallConfig::new)
+}
+
+/// Configure the firewall from `len` bytes of `key=value` lines at `blob`,
+/// keys are the fields of `FirewallConfig`, missing keys keep their default.
+/// On seL4 the blob is a CAmkES string attribute, on Linux the contents of
+/// a file. Has to be called before the first frame, e.g. in `pre_init()`.
+/// returns 0 on success, -1 if the blob is invalid or the configuration is
+/// already in use
+#[no_mangle]
+pub extern "C" fn firewall_configure(blob: *const u8, len: i32) -> i32 {
+    if blob.is_null() || len < 0 {
+        return -1;
+    }
+    let bytes = unsafe { slice::from_raw_parts(blob, len as usize) };
+    let mut config = FirewallConfig::new();
+    let parsed = match str::from_utf8(bytes) {
+        Ok(text) => config.parse(text),
+        Err(_) => Err("not UTF-8".to_string()),
+    };
+    if let Err(_e) = parsed.and_then(|_| config.validate().map_err(|e| e.to_string())) {
+        debug_print!("Firewall firewall_configure: {}", _e);
+        return -1;
+    }
+
+    let mut stored = false;
+    CONFIG.call_once(|| {
+        stored = true;
+        config
+    });
+    if stored {
+        0
+    } else {
+        debug_print!("Firewall firewall_configure: configuration already in use");
+        -1
+    }
+}
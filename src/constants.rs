@@ -1,3 +1,7 @@
+// BUFFER_SIZE, MAX_REASSEMBLED_FRAGMENT_SIZE, SUPPORTED_FRAGMENTS,
+// FRAGMENT_TIMEOUT_MS, MTU and MAX_ENQUEUED_PACKETS are defaults,
+// a deployment can override them at init, see `config.rs`
+
 /// Size of the seL4 buffer for data exchange
 /// can be defined in CAMKES
 /// MTU cannot be large than (BUFFER_SIZE + Eth_header)
@@ -6,33 +10,122 @@ pub const BUFFER_SIZE: usize = 4096;
 
 /// The max size of the reassembled Ipv4 packet
 /// Should fit the largest expected packet
-/// Default is 65535
+/// Default is 65535, also the largest size `config.rs` accepts
 pub const MAX_REASSEMBLED_FRAGMENT_SIZE: usize = 65535;
 
-/// Max size of a reassembled UDP packet, includes the header
-/// Technically also the max Ipv4 payload size
-pub const MAX_UDP_PACKET_SIZE: usize = MAX_REASSEMBLED_FRAGMENT_SIZE - IPV4_HEADER_SIZE - ETHERNET_FRAME_PAYLOAD;
-
-/// Max size of a reassmbled UDP payload, no header
-pub const MAX_UDP_PAYLOAD_SIZE: usize = MAX_REASSEMBLED_FRAGMENT_SIZE - UDP_HEADER_SIZE - IPV4_HEADER_SIZE - ETHERNET_FRAME_PAYLOAD;
-
 /// The index of ethernet frame payload. Also the size of
 /// the ethernet frame header
 pub const ETHERNET_FRAME_PAYLOAD: usize = 14;
 pub const UDP_HEADER_SIZE: usize = 8;
 pub const IPV4_HEADER_SIZE: usize = 20;
+pub const IPV6_HEADER_SIZE: usize = 40;
+pub const IPV6_FRAGMENT_HEADER_SIZE: usize = 8;
+
+/// Extension headers followed in an IPv6 packet before it is dropped
+pub const MAX_IPV6_EXTENSION_HEADERS: usize = 8;
 
 /// Number of supported fragments. Make sure you allocate enough heap space!!
 pub const SUPPORTED_FRAGMENTS: usize = 10;
 
+/// Largest number of reassembly slots `config.rs` accepts
+pub const MAX_SUPPORTED_FRAGMENTS: usize = 1024;
+
+/// A packet that doesn't get a new fragment for this long is given up
+/// and its reassembly slot freed, in units of `clock::now()`: ms of the
+/// virtual clock, else calls to `client_tx()` and `client_rx()`. Only with a
+/// client calling every ms is this the 30 s of Linux's `ipfrag_time`.
+pub const FRAGMENT_TIMEOUT_MS: u64 = 30_000;
+
 /// Max ethernet MTU (max size of a single IPv4 packet)
 pub const MTU: usize = 1500;
 
-/// Max size of an individual UDP packet
-pub const MTU_UDP: usize = MTU - IPV4_HEADER_SIZE;
+/// Largest MTU `config.rs` accepts, for ports with jumbo frames
+pub const MAX_JUMBO_MTU: usize = 9000;
+
+/// Smallest MTU `config.rs` accepts, every IPv4 host has to reassemble
+/// packets of this size (RFC 791)
+pub const MIN_MTU: usize = 576;
 
 /// For managing the extra CRC fields
 pub const ETH_CRC_LEN: usize = 4;
 
 /// Maximum number of packets (up to MTU size) in the packet queue
 pub const MAX_ENQUEUED_PACKETS: usize = 1024;
+
+/// Largest queue `config.rs` accepts
+pub const MAX_QUEUE_DEPTH: usize = 65536;
+
+/// IPv4 addresses of the client the ARP responder answers for (see `arp.rs`)
+pub const MAX_CLIENT_ADDRESSES: usize = 4;
+
+/// Multicast groups the client can be in (see `mcast.rs`)
+pub const MAX_MULTICAST_GROUPS: usize = 32;
+
+/// Chunks of `max_reassembled_fragment_size` bytes in the scratch arena of
+/// each direction (see `scratch.rs`). The largest packet needs about three,
+/// its payload, the UDP packet built from it and its fragments, and one more
+/// for the copy of its payload when a shadow filter samples it.
+pub const SCRATCH_CHUNKS: usize = 5;
+
+/// Slots of the UDP flow table (see `flows.rs`)
+pub const MAX_FLOWS: usize = 1024;
+
+/// Slots a flow table lookup looks at, from the one a flow hashes to
+pub const FLOW_PROBES: usize = 8;
+
+/// A flow without a datagram in either direction for this long is closed,
+/// in units of `clock::now()` like `FRAGMENT_TIMEOUT_MS`. Only with a client
+/// calling every ms is this the 30 s of Linux's `nf_conntrack_udp_timeout`.
+pub const FLOW_TIMEOUT_MS: u64 = 30_000;
+
+/// `fast_lane` port ranges `config.rs` accepts (see `flows.rs`)
+pub const MAX_FAST_LANES: usize = 8;
+
+/// Number of frames kept in the capture ring (see `capture.rs`)
+pub const CAPTURE_SLOTS: usize = 256;
+
+/// Number of bytes copied from the head of each captured frame
+/// Enough for Ethernet + IPv4 + UDP headers and the start of the payload
+pub const CAPTURE_SNAPLEN: usize = 128;
+
+/// Stage changes kept in the trace ring of the stall watchdog, all of them
+/// go into a snapshot (see `watchdog.rs`)
+pub const WATCHDOG_TRACE_EVENTS: usize = 32;
+
+/// Snapshots of the most recent stalls kept for `firewall_stall_get()`
+pub const WATCHDOG_STALLS: usize = 8;
+
+/// Number of log2 buckets of the queue depth histograms (see `stats.rs`),
+/// the last one covers depths of 1024 (MAX_ENQUEUED_PACKETS) and more
+pub const STATS_HISTOGRAM_BUCKETS: usize = 12;
+
+/// Block size and number of blocks of each class of the `static-memory`
+/// allocator (see `slab.rs`), smallest first. The defaults of `config.rs`
+/// fit, a deployment with more slots, a deeper queue or jumbo frames has to
+/// raise the counts of the classes they fall in.
+#[cfg(feature = "static-memory")]
+pub const SLAB_CLASS_COUNT: usize = 5;
+#[cfg(feature = "static-memory")]
+pub const SLAB_CLASSES: [(usize, usize); SLAB_CLASS_COUNT] = [
+    (64, 4096),     // bookkeeping, tables and addresses
+    (512, 1024),    // small frames and packets
+    (2048, 2304),   // frames of up to MTU bytes, mostly queued
+    (16384, 64),    // jumbo frames
+    (65536, 48),    // reassembly slots, scratch chunks and large sends
+];
+
+/// Static memory taken by the blocks of `SLAB_CLASSES`, about 9.25 MiB
+#[cfg(feature = "static-memory")]
+pub const SLAB_BYTES: usize = SLAB_CLASSES[0].0 * SLAB_CLASSES[0].1
+    + SLAB_CLASSES[1].0 * SLAB_CLASSES[1].1
+    + SLAB_CLASSES[2].0 * SLAB_CLASSES[2].1
+    + SLAB_CLASSES[3].0 * SLAB_CLASSES[3].1
+    + SLAB_CLASSES[4].0 * SLAB_CLASSES[4].1;
+
+/// Alignment of every block, the largest one `slab.rs` can serve
+#[cfg(feature = "static-memory")]
+pub const SLAB_ALIGN: usize = 64;
+
+/// Blocks of every class kept free for the packets being processed
+#[cfg(feature = "static-memory")]
+pub const SLAB_SPARE_BLOCKS: usize = 8;
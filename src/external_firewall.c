@@ -12,6 +12,14 @@ int32_t packet_out(uint32_t src_addr, uint16_t src_port, uint32_t dst_addr,
     uint16_t dst_port, uint16_t payload_len, uint8_t *payload,
     uint16_t max_payload_len);
 
+int32_t packet_in6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len);
+
+int32_t packet_out6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len);
+
 // For now always let the packet pass
 int32_t packet_in(uint32_t src_addr, uint16_t src_port, uint32_t dst_addr,
     uint16_t dst_port, uint16_t payload_len, uint8_t *payload,
@@ -41,3 +49,20 @@ int32_t packet_out(uint32_t src_addr, uint16_t src_port, uint32_t dst_addr,
     return (int32_t)payload_len;
   }
 }
+
+// IPv6 gets the same rules as IPv4
+int32_t packet_in6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len)
+{
+  return packet_in(0, src_port, 0, dst_port, payload_len, payload,
+      max_payload_len);
+}
+
+int32_t packet_out6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len)
+{
+  return packet_out(0, src_port, 0, dst_port, payload_len, payload,
+      max_payload_len);
+}
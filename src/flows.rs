@@ -0,0 +1,279 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use smoltcp::time::Instant;
+use smoltcp::wire::IpAddress;
+
+use clock;
+use config;
+use constants;
+
+/// Replies from the wire forwarded to the client without `packet_in()`
+pub static REPLIES: AtomicUsize = AtomicUsize::new(0);
+/// Datagrams of trusted flows forwarded without the external filter
+pub static LANE_SKIPPED: AtomicUsize = AtomicUsize::new(0);
+/// Datagrams of trusted flows picked for inspection
+pub static LANE_SAMPLED: AtomicUsize = AtomicUsize::new(0);
+/// Trusted flows back to full inspection after a drop
+pub static LANE_DEMOTED: AtomicUsize = AtomicUsize::new(0);
+
+/// What a direction does with the flow table, also the index of its lane
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Role {
+    /// from the client, datagrams approved by `packet_out()` open a flow or
+    /// keep it open
+    Outbound,
+    /// from the wire, replies to an open flow skip `packet_in()`
+    Inbound,
+}
+
+/// A UDP flow the client started, as seen from the client
+#[derive(Clone, Copy, Debug, PartialEq)]
+struct FlowKey {
+    client_addr: IpAddress,
+    client_port: u16,
+    remote_addr: IpAddress,
+    remote_port: u16,
+}
+
+/// Inspection history of a flow in one direction, see `lane_skips()`
+#[derive(Clone, Copy, Debug, Default)]
+struct Lane {
+    /// inspections passed in a row
+    streak: u32,
+    /// datagrams since the flow became trusted
+    trusted: u32,
+}
+
+#[derive(Clone, Copy, Debug)]
+struct Flow {
+    key: FlowKey,
+    last_seen: Instant,
+    lanes: [Lane; 2],
+}
+
+/// Open addressing with linear probing over `MAX_FLOWS` slots, a lookup or
+/// an insert looks at `FLOW_PROBES` of them at most. A flow idle for
+/// `flow_timeout_ms` of the configuration is as good as a free slot, so
+/// nothing has to sweep the table, and a slot is never emptied again once
+/// used, so a lookup can stop at the first empty one.
+struct FlowTable {
+    slots: Vec<Option<Flow>>,
+}
+
+impl FlowTable {
+    fn new() -> FlowTable {
+        FlowTable {
+            slots: vec![None; constants::MAX_FLOWS],
+        }
+    }
+}
+
+lazy_static! {
+    /// flows the client opened, for `conntrack`
+    static ref FLOWS: ::spin::Mutex<FlowTable> = ::spin::Mutex::new(FlowTable::new());
+    /// flows of the `fast_lane` port ranges, in both directions
+    static ref LANES: ::spin::Mutex<FlowTable> = ::spin::Mutex::new(FlowTable::new());
+}
+
+fn address_bytes(address: &IpAddress) -> &[u8] {
+    match *address {
+        IpAddress::Ipv4(ref a) => a.as_bytes(),
+        IpAddress::Ipv6(ref a) => a.as_bytes(),
+        _ => &[],
+    }
+}
+
+/// First slot of `key`, FNV-1a over its addresses and ports
+fn hash(key: &FlowKey) -> usize {
+    let mut h: u32 = 0x811c_9dc5;
+    let ports = [
+        (key.client_port >> 8) as u8,
+        key.client_port as u8,
+        (key.remote_port >> 8) as u8,
+        key.remote_port as u8,
+    ];
+    let bytes = address_bytes(&key.client_addr)
+        .iter()
+        .chain(address_bytes(&key.remote_addr).iter())
+        .chain(ports.iter());
+    for byte in bytes {
+        h = (h ^ *byte as u32).wrapping_mul(0x0100_0193);
+    }
+    h as usize % constants::MAX_FLOWS
+}
+
+fn is_live(flow: &Flow, now: Instant) -> bool {
+    clock::elapsed_ms(flow.last_seen, now) < config::get().flow_timeout_ms
+}
+
+impl FlowTable {
+    /// Slot of the open flow `key`
+    fn find(&self, key: &FlowKey, now: Instant) -> Option<usize> {
+        let start = hash(key);
+        for probe in 0..constants::FLOW_PROBES {
+            let idx = (start + probe) % constants::MAX_FLOWS;
+            match self.slots[idx] {
+                Some(ref flow) if flow.key == *key && is_live(flow, now) => return Some(idx),
+                Some(_) => {}
+                None => break,
+            }
+        }
+        None
+    }
+
+    /// Open `key` or keep it open, None if its probe window is full
+    fn insert(&mut self, key: FlowKey, now: Instant) -> Option<&mut Flow> {
+        let idx = match self.find(&key, now) {
+            Some(idx) => idx,
+            None => {
+                let start = hash(&key);
+                let idx = (0..constants::FLOW_PROBES)
+                    .map(|probe| (start + probe) % constants::MAX_FLOWS)
+                    .find(|idx| self.slots[*idx].map_or(true, |flow| !is_live(&flow, now)))?;
+                self.slots[idx] = Some(Flow {
+                    key: key,
+                    last_seen: now,
+                    lanes: [Lane::default(); 2],
+                });
+                idx
+            }
+        };
+        let flow = self.slots[idx].as_mut().unwrap();
+        flow.last_seen = now;
+        Some(flow)
+    }
+}
+
+/// Allocate the tables that are in use
+#[cfg(feature = "static-memory")]
+pub fn reserve() {
+    if config::get().conntrack {
+        ::lazy_static::initialize(&FLOWS);
+    }
+    if !config::get().fast_lanes.is_empty() {
+        ::lazy_static::initialize(&LANES);
+    }
+}
+
+/// Bytes of one table, for `slab.rs`
+#[cfg(feature = "static-memory")]
+pub fn table_bytes() -> usize {
+    constants::MAX_FLOWS * ::std::mem::size_of::<Option<Flow>>()
+}
+
+/// Remember a datagram from the client at `src_addr`:`src_port` to
+/// `dst_addr`:`dst_port` that `packet_out()` approved
+pub fn record(src_addr: IpAddress, src_port: u16, dst_addr: IpAddress, dst_port: u16) {
+    if !config::get().conntrack {
+        return;
+    }
+    let key = FlowKey {
+        client_addr: src_addr,
+        client_port: src_port,
+        remote_addr: dst_addr,
+        remote_port: dst_port,
+    };
+    if FLOWS.lock().insert(key, clock::now()).is_none() {
+        debug_print!("Firewall flows: no free slot for {}:{}", dst_addr, dst_port);
+    }
+}
+
+/// Is a datagram from the wire at `src_addr`:`src_port` to
+/// `dst_addr`:`dst_port` a reply to an open flow? Keeps the flow open if so.
+pub fn is_reply(src_addr: IpAddress, src_port: u16, dst_addr: IpAddress, dst_port: u16) -> bool {
+    if !config::get().conntrack {
+        return false;
+    }
+    let key = FlowKey {
+        client_addr: dst_addr,
+        client_port: dst_port,
+        remote_addr: src_addr,
+        remote_port: src_port,
+    };
+    let now = clock::now();
+    let mut table = FLOWS.lock();
+    match table.find(&key, now) {
+        Some(idx) => {
+            table.slots[idx].as_mut().unwrap().last_seen = now;
+            true
+        }
+        None => false,
+    }
+}
+
+/// The flow of a datagram in direction `role` and the `fast_lane` rule of
+/// the first range that has one of its ports in it
+fn lane_of(role: Role, src_addr: IpAddress, src_port: u16, dst_addr: IpAddress, dst_port: u16)
+    -> Option<(FlowKey, &'static config::FastLane)>
+{
+    let rule = config::get().fast_lanes.iter().find(|rule| {
+        (src_port >= rule.first_port && src_port <= rule.last_port)
+            || (dst_port >= rule.first_port && dst_port <= rule.last_port)
+    })?;
+    let (client_addr, client_port, remote_addr, remote_port) = match role {
+        Role::Outbound => (src_addr, src_port, dst_addr, dst_port),
+        Role::Inbound => (dst_addr, dst_port, src_addr, src_port),
+    };
+    let key = FlowKey {
+        client_addr: client_addr,
+        client_port: client_port,
+        remote_addr: remote_addr,
+        remote_port: remote_port,
+    };
+    Some((key, rule))
+}
+
+/// May a datagram skip the external filter? Only once its flow passed
+/// `streak` inspections in a row in this direction, and then all but every
+/// `sample`th datagram do. Keeps the flow open either way.
+pub fn lane_skips(role: Role, src_addr: IpAddress, src_port: u16, dst_addr: IpAddress, dst_port: u16) -> bool {
+    let (key, rule) = match lane_of(role, src_addr, src_port, dst_addr, dst_port) {
+        Some(lane) => lane,
+        None => return false,
+    };
+    let now = clock::now();
+    let mut table = LANES.lock();
+    let idx = match table.find(&key, now) {
+        Some(idx) => idx,
+        None => return false,
+    };
+    let flow = table.slots[idx].as_mut().unwrap();
+    // a skipped datagram is traffic too, the flow mustn't age out under it
+    flow.last_seen = now;
+    let lane = &mut flow.lanes[role as usize];
+    if lane.streak < rule.streak {
+        return false;
+    }
+    lane.trusted = lane.trusted.wrapping_add(1);
+    if lane.trusted % rule.sample == 0 {
+        LANE_SAMPLED.fetch_add(1, Ordering::Relaxed);
+        false
+    } else {
+        LANE_SKIPPED.fetch_add(1, Ordering::Relaxed);
+        true
+    }
+}
+
+/// Record what the external filter said about a datagram, `passed` or not.
+/// A drop puts its flow back to full inspection.
+pub fn lane_inspected(role: Role, src_addr: IpAddress, src_port: u16, dst_addr: IpAddress, dst_port: u16, passed: bool) {
+    let (key, rule) = match lane_of(role, src_addr, src_port, dst_addr, dst_port) {
+        Some(lane) => lane,
+        None => return,
+    };
+    let mut table = LANES.lock();
+    let flow = match table.insert(key, clock::now()) {
+        Some(flow) => flow,
+        None => return,
+    };
+    let lane = &mut flow.lanes[role as usize];
+    if passed {
+        lane.streak = lane.streak.saturating_add(1);
+    } else {
+        if lane.streak >= rule.streak {
+            debug_print!("Firewall flows: {}:{} back to full inspection", key.remote_addr, key.remote_port);
+            LANE_DEMOTED.fetch_add(1, Ordering::Relaxed);
+        }
+        *lane = Lane::default();
+    }
+}
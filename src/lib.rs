@@ -17,12 +17,28 @@ extern crate camkesrust;
 mod constants;
 #[macro_use]
 mod externs;
+mod config;
 mod utils;
+mod clock;
+mod capture;
+mod arp;
+mod mcast;
+mod flows;
+mod shadow;
+mod watchdog;
+mod stats;
+mod scratch;
+mod reassembly;
+#[cfg(feature = "static-memory")]
+mod slab;
 
 #[no_mangle]
 pub extern "C" fn post_init()  {
     unsafe {externs::set_putchar(externs::putchar_putchar)};
-
+    // the configuration is settled by now, take what it sizes from the slabs
+    // before the first frame
+    #[cfg(feature = "static-memory")]
+    utils::reserve_pools();
 }
 
 /// This should probably always be where init_allocator is called as pre_init is guaranteed by
@@ -40,30 +56,51 @@ pub extern "C" fn pre_init() {
 /// returns -1 if the ethernet driver fails, 0 otherwise
 #[no_mangle]
 pub extern "C" fn client_tx(len: i32) -> i32 {
+    clock::tick();
+    let start = watchdog::stage(flows::Role::Outbound, watchdog::Stage::Fetch);
     let mut ret = utils::RET_CLIENT_TX.lock();
     let eth_packet = utils::fetch_client_data(len as usize);
+    let head = capture::observe(&eth_packet);
+    arp::learn(&eth_packet);
+    mcast::learn(&eth_packet);
 
     // process frame
-    match utils::process_ethernet(
-        eth_packet,
-        utils::PACKETS_TX.clone(),
-        utils::FRAGMENTS_TX.clone(),
-        utils::FN_PACKET_OUT.clone(),
-        false, // no need to check MAC
-    ) {
+    watchdog::stage(flows::Role::Outbound, watchdog::Stage::Ethernet);
+    let mut scratch = utils::SCRATCH_TX.lock();
+    let result = if eth_packet.len() > config::get().max_client_frame_len() {
+        // without large send the client has to keep to the MTU itself
+        Err(smoltcp::Error::Exhausted)
+    } else {
+        utils::process_ethernet(
+            eth_packet,
+            utils::PACKETS_TX.clone(),
+            utils::FRAGMENTS_TX.clone(),
+            utils::FN_PACKET_OUT.clone(),
+            false, // no need to check MAC
+            config::get().ethdriver_mtu,
+            &stats::TX,
+            flows::Role::Outbound,
+            &scratch,
+        )
+    };
+    scratch.reset();
+    match result {
         Ok(_) => {
         }
-        Err(_e) => {
-            debug_print!("Firewall client_tx: error processing eth_packet: {}", _e);
+        Err(e) => {
+            debug_print!("Firewall client_tx: error processing eth_packet: {}", e);
+            capture::record_drop(head, e);
         }
     }
 
     // send 0 to N packets
+    watchdog::stage(flows::Role::Outbound, watchdog::Stage::Dispatch);
     {
         *ret = 0;
         let mut packets = utils::PACKETS_TX.lock();
         while !packets.is_empty() {
             let eth_packet = packets.remove(0);
+            stats::TX.queue.popped(packets.len(), eth_packet.len());
             #[cfg(feature = "debug-print")]
             externs::println_sel4(format!(
                 "Firewall client_tx: dispatching ethernet packet to ethdriver and calling ethdriver_tx"
@@ -75,6 +112,7 @@ pub extern "C" fn client_tx(len: i32) -> i32 {
             }
         }
     }
+    watchdog::finished(flows::Role::Outbound, start);
     *ret // will do  a bitwise copy
 }
 
@@ -84,23 +122,37 @@ pub extern "C" fn client_tx(len: i32) -> i32 {
 /// or `clien_rx` was called without any data being available)
 #[no_mangle]
 pub extern "C" fn client_rx(len: *mut i32) -> i32 {
+    clock::tick();
+    let start = watchdog::stage(flows::Role::Inbound, watchdog::Stage::Fetch);
     let mut ret = utils::RET_CLIENT_RX.lock();
+    let mut scratch = utils::SCRATCH_RX.lock();
     for eth_packet in utils::EthdriverRxStatus::new() {
+        watchdog::stage(flows::Role::Inbound, watchdog::Stage::Ethernet);
+        let head = capture::observe(&eth_packet);
         match utils::process_ethernet(
             eth_packet,
             utils::PACKETS_RX.clone(),
             utils::FRAGMENTS_RX.clone(),
             utils::FN_PACKET_IN.clone(),
             true, // check the MAC address
+            config::get().client_mtu,
+            &stats::RX,
+            flows::Role::Inbound,
+            &scratch,
         ) {
             Ok(_) => {}
-            Err(_e) => {
-                debug_print!("Firewall client_rx: error processing Data(eth_packet): {}", _e);
+            Err(e) => {
+                debug_print!("Firewall client_rx: error processing Data(eth_packet): {}", e);
+                capture::record_drop(head, e);
             }
         }
+        // the next frame starts with an empty arena
+        scratch.reset();
+        watchdog::stage(flows::Role::Inbound, watchdog::Stage::Fetch);
     }
  
 
+    watchdog::stage(flows::Role::Inbound, watchdog::Stage::Dispatch);
     {
         let mut packets = utils::PACKETS_RX.lock();
         debug_print!(
@@ -115,6 +167,7 @@ pub extern "C" fn client_rx(len: *mut i32) -> i32 {
             false => {
                 // enqueue a single packet
                 let eth_packet = packets.remove(0);
+                stats::RX.queue.popped(packets.len(), eth_packet.len());
                 let data_len = utils::copy_data_to_client_buf(eth_packet);
                 unsafe {
                     *len = data_len;
@@ -128,6 +181,7 @@ pub extern "C" fn client_rx(len: *mut i32) -> i32 {
                 }
             }
         };
+        watchdog::finished(flows::Role::Inbound, start);
         *ret // will do  a bitwise copy
     }
 }
@@ -0,0 +1,254 @@
+/**
+ * End-to-end forwarder for the Linux build
+ *
+ * Runs rustwall between two TAP devices: frames read from the "ethdriver"
+ * TAP go through `client_rx()` and are written to the "client" TAP, frames
+ * read from the client TAP go through `client_tx()` and are written to the
+ * ethdriver TAP. `loopback.sh` puts the two devices in separate network
+ * namespaces, so that the kernel can't route around the firewall, and
+ * measures the forwarding with `loopback_traffic`.
+ *
+ * The client TAP stands for the VM behind the firewall, its MAC address
+ * has to be the one `client_mac()` returns (02:00:00:00:00:01).
+ *
+ * Usage: loopback <ethdriver tap> <client tap>
+ * Forwards until SIGINT or SIGTERM, then prints frame counters.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+
+/**
+ * A helper define to make this look more like an actual seL4 file
+ */
+typedef uint32_t seL4_Word;
+
+// Rust
+extern int client_tx(int len);
+extern int client_rx(int *len);
+
+static int eth_fd = -1;
+static int client_fd = -1;
+static volatile sig_atomic_t stop = 0;
+
+static uint64_t eth_frames_in = 0;
+static uint64_t eth_frames_out = 0;
+static uint64_t client_frames_in = 0;
+static uint64_t client_frames_out = 0;
+
+/**
+ * Note: this code is normally autogenerated during seL4 build
+ */
+struct
+{
+  char content[65535];
+} from_ethdriver_data;
+
+void * ethdriver_buf = (void *) &from_ethdriver_data;
+
+struct
+{
+  char content[65535];
+} to_client_1_data;
+
+void *client_buf(seL4_Word client_id)
+{
+  switch (client_id) {
+    case 1:
+      return (void *) &to_client_1_data;
+    default:
+      return NULL;
+  }
+}
+
+void client_emit(unsigned int badge)
+{
+}
+
+pthread_mutex_t mutex_ethdriver_buf = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t mutex_client_buf = PTHREAD_MUTEX_INITIALIZER;
+void ethdriver_buf_lock(void)
+{
+  pthread_mutex_lock(&mutex_ethdriver_buf);
+}
+
+void ethdriver_buf_unlock(void)
+{
+  pthread_mutex_unlock(&mutex_ethdriver_buf);
+}
+
+void client_buf_lock(void)
+{
+  pthread_mutex_lock(&mutex_client_buf);
+}
+
+void client_buf_unlock(void)
+{
+  pthread_mutex_unlock(&mutex_client_buf);
+}
+
+/**
+ * Normally provided by the seL4 runtime, referenced by `post_init()`
+ */
+void putchar_putchar(uint8_t c)
+{
+  putchar(c);
+}
+
+void set_putchar(void (*f)(uint8_t))
+{
+}
+/**
+ * END OF AUTOGENERATED CODE
+ */
+
+/**
+ * Normally returns the MAC address of the ethernet driver
+ */
+void ethdriver_mac(uint8_t *b1, uint8_t *b2, uint8_t *b3, uint8_t *b4,
+    uint8_t *b5, uint8_t *b6)
+{
+  static uint8_t mac[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+  *b1 = mac[0];
+  *b2 = mac[1];
+  *b3 = mac[2];
+  *b4 = mac[3];
+  *b5 = mac[4];
+  *b6 = mac[5];
+}
+
+/**
+ * Write the frame in `ethdriver_buf` to the ethdriver TAP
+ */
+int ethdriver_tx(int len)
+{
+  if (write(eth_fd, ethdriver_buf, len) != len) {
+    return -1;
+  }
+  eth_frames_out++;
+  return 0;
+}
+
+/**
+ * Read the next frame from the ethdriver TAP, -1 if there is none
+ */
+int ethdriver_rx(int* len)
+{
+  int n = read(eth_fd, ethdriver_buf, sizeof(from_ethdriver_data));
+  if (n <= 0) {
+    return -1;
+  }
+  *len = n;
+  eth_frames_in++;
+  return 0;
+}
+
+/**
+ * Attach to the TAP device `name`, creating it if it doesn't exist
+ */
+static int tap_open(const char *name)
+{
+  struct ifreq ifr;
+  int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+  if (fd < 0) {
+    return -1;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  if (ioctl(fd, TUNSETIFF, (void *) &ifr) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void on_signal(int sig)
+{
+  stop = 1;
+}
+
+/**
+ * Everything the firewall has for the client goes to the client TAP
+ */
+static void forward_rx(void)
+{
+  int len, ret;
+  do {
+    ret = client_rx(&len);
+    if (ret != -1) {
+      if (write(client_fd, client_buf(1), len) == len) {
+        client_frames_out++;
+      }
+    }
+  } while (ret == 1);
+}
+
+/**
+ * Frames from the client TAP go out through the firewall
+ */
+static void forward_tx(void)
+{
+  int len;
+  while ((len = read(client_fd, client_buf(1), sizeof(to_client_1_data)))
+      > 0) {
+    client_frames_in++;
+    client_tx(len);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    printf("Usage: %s <ethdriver tap> <client tap>\n", argv[0]);
+    exit(1);
+  }
+  eth_fd = tap_open(argv[1]);
+  client_fd = tap_open(argv[2]);
+  if ((eth_fd < 0) || (client_fd < 0)) {
+    perror("Attaching to TAP device");
+    exit(1);
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  printf("loopback: forwarding %s <-> %s\n", argv[1], argv[2]);
+  fflush(stdout);
+
+  struct pollfd fds[2] = {
+    { .fd = eth_fd, .events = POLLIN },
+    { .fd = client_fd, .events = POLLIN },
+  };
+  while (!stop) {
+    if (poll(fds, 2, 100) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      forward_rx();
+    }
+    if (fds[1].revents & POLLIN) {
+      forward_tx();
+    }
+  }
+
+  printf("loopback: rx %" PRIu64 " frames in, %" PRIu64 " to the client; "
+      "tx %" PRIu64 " frames from the client, %" PRIu64 " out\n",
+      eth_frames_in, client_frames_out, client_frames_in, eth_frames_out);
+  return 0;
+}
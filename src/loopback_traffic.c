@@ -0,0 +1,291 @@
+/**
+ * UDP traffic source and sink for `loopback.sh`
+ *
+ * blast: sends `count` UDP datagrams from a raw packet socket on `ifname`,
+ *   built with `pktgen.h` and fragmented like a Linux sender would above
+ *   the MTU. Each datagram starts with a sequence number and the
+ *   CLOCK_MONOTONIC time it was sent at.
+ * sink: receives them on a UDP socket and reports the delivered rate, the
+ *   loss, duplicates, reordering and the one-way latency. Both ends run on
+ *   the same host, so their clocks agree.
+ *
+ * Usage: loopback_traffic blast <ifname> <count> [pps] [min payload]
+ *            [max payload]
+ *        loopback_traffic sink <count> [idle ms]
+ *   pps 0 sends as fast as possible, payloads above 1472 bytes are
+ *   fragmented
+ */
+#include "pktgen.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+/* keep in sync with `loopback.sh` */
+#define SRC_IP 0xc0a84502  // 192.168.69.2, wan side
+#define DST_IP 0xc0a84501  // 192.168.69.1, client side
+#define SRC_PORT 40000
+#define DST_PORT 7000
+
+#define MTU 1500
+#define MAX_FRAME_LEN (PKTGEN_ETH_HEADER_LEN + MTU)
+#define MAX_PAYLOAD (PKTGEN_MAX_L4_LEN - PKTGEN_L4_HEADER_LEN)
+#define DEFAULT_MIN_PAYLOAD 64
+#define DEFAULT_IDLE_MS 1000
+
+#define STAMP_MAGIC 0x72776c62  // "rwlb"
+#define UDP_OFFSET (PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV4_HEADER_LEN)
+#define UDP_CHECKSUM_OFFSET (UDP_OFFSET + 6)
+
+/* start of every datagram, in host byte order */
+struct stamp {
+  uint32_t magic;
+  uint32_t seq;
+  uint64_t sent_ns;
+};
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* xorshift64, only picks payload lengths */
+static uint64_t rng_state = 0x2545f4914f6cdd1dull;
+
+static uint32_t rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (uint32_t) (rng_state >> 32);
+}
+
+/**
+ * Put the stamp at the start of the UDP payload of `frame`, which carries
+ * the UDP header. The UDP checksum is dropped rather than recomputed.
+ */
+static void stamp_frame(uint8_t *frame, uint32_t seq)
+{
+  struct stamp s = { STAMP_MAGIC, seq, now_ns() };
+  memcpy(frame + UDP_OFFSET + PKTGEN_L4_HEADER_LEN, &s, sizeof(s));
+  frame[UDP_CHECKSUM_OFFSET] = 0;
+  frame[UDP_CHECKSUM_OFFSET + 1] = 0;
+}
+
+static int blast(int argc, char **argv)
+{
+  if (argc < 4) {
+    return -1;
+  }
+  const char *ifname = argv[2];
+  long count = atol(argv[3]);
+  long pps = (argc > 4) ? atol(argv[4]) : 0;
+  int min_payload = (argc > 5) ? atoi(argv[5]) : DEFAULT_MIN_PAYLOAD;
+  int max_payload = (argc > 6) ? atoi(argv[6]) : min_payload;
+  if ((count <= 0) || (pps < 0) || (min_payload < (int) sizeof(struct stamp))
+      || (max_payload < min_payload) || (max_payload > MAX_PAYLOAD)) {
+    return -1;
+  }
+
+  int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+  if (fd < 0) {
+    perror("Opening packet socket");
+    exit(1);
+  }
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror(ifname);
+    exit(1);
+  }
+  struct sockaddr_ll addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETH_P_ALL);
+  addr.sll_ifindex = if_nametoindex(ifname);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    perror("Binding packet socket");
+    exit(1);
+  }
+
+  // the client MAC of rustwall, see `loopback.c`
+  struct pktgen_flow flow = {
+    .dst_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .src_ip = SRC_IP,
+    .dst_ip = DST_IP,
+    .src_port = SRC_PORT,
+    .dst_port = DST_PORT,
+  };
+  memcpy(flow.src_mac, ifr.ifr_hwaddr.sa_data, 6);
+
+  static uint8_t frame[MAX_FRAME_LEN];
+  uint64_t frames = 0, send_errors = 0;
+  uint64_t start = now_ns();
+  for (long seq = 0; seq < count; seq++) {
+    if (pps > 0) {
+      uint64_t due = start + (uint64_t) seq * 1000000000ull / pps;
+      while (now_ns() < due) {
+      }
+    }
+    int payload = min_payload + rng() % (max_payload - min_payload + 1);
+    int l4_len = PKTGEN_L4_HEADER_LEN + payload;
+    int frag_len = (MTU - PKTGEN_IPV4_HEADER_LEN) & ~7;
+    for (int offset = 0; offset < l4_len; offset += frag_len) {
+      int len = (l4_len - offset < frag_len) ? l4_len - offset : frag_len;
+      int n;
+      if (l4_len <= MTU - PKTGEN_IPV4_HEADER_LEN) {
+        n = pktgen_udp(frame, sizeof(frame), &flow, (uint16_t) seq, payload,
+            0);
+      } else {
+        n = pktgen_ipv4_fragment(frame, sizeof(frame), &flow,
+            PKTGEN_PROTO_UDP, (uint16_t) seq, l4_len, offset, len,
+            offset + len < l4_len, 0);
+      }
+      if (offset == 0) {
+        stamp_frame(frame, (uint32_t) seq);
+      }
+      if (send(fd, frame, n, 0) != n) {
+        send_errors++;
+      }
+      frames++;
+    }
+  }
+  double seconds = (now_ns() - start) / 1e9;
+  printf("blast: %ld datagrams in %" PRIu64 " frames, %.0f datagrams/s, "
+      "%" PRIu64 " send errors\n", count, frames, count / seconds,
+      send_errors);
+  close(fd);
+  return 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, long count, double p)
+{
+  return count ? sorted[(long) (p / 100.0 * (count - 1) + 0.5)] : 0;
+}
+
+static int sink(int argc, char **argv)
+{
+  if (argc < 3) {
+    return -1;
+  }
+  long count = atol(argv[2]);
+  int idle_ms = (argc > 3) ? atoi(argv[3]) : DEFAULT_IDLE_MS;
+  if ((count <= 0) || (idle_ms <= 0)) {
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int rcvbuf = 16 * 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  struct timeval timeout = { idle_ms / 1000, (idle_ms % 1000) * 1000 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(DST_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    perror("Binding UDP socket");
+    exit(1);
+  }
+
+  uint8_t *seen = calloc(count, 1);
+  uint64_t *latencies = malloc(count * sizeof(uint64_t));
+  if ((seen == NULL) || (latencies == NULL)) {
+    printf("Out of memory\n");
+    exit(1);
+  }
+  static uint8_t buf[65536];
+  long received = 0, duplicates = 0, reordered = 0, foreign = 0;
+  long max_seq = -1;
+  uint64_t bytes = 0, first = 0, last = 0;
+
+  // the sender is started after us, so wait longer for the first datagram
+  int timeouts = 0;
+  while (received < count) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+      if ((received > 0) || (++timeouts * idle_ms >= 10000)) {
+        break;
+      }
+      continue;
+    }
+    uint64_t t = now_ns();
+    struct stamp s;
+    memcpy(&s, buf, sizeof(s));
+    if ((n < (ssize_t) sizeof(s)) || (s.magic != STAMP_MAGIC)
+        || (s.seq >= count)) {
+      foreign++;
+      continue;
+    }
+    if (seen[s.seq]) {
+      duplicates++;
+      continue;
+    }
+    seen[s.seq] = 1;
+    if ((long) s.seq < max_seq) {
+      reordered++;
+    } else {
+      max_seq = s.seq;
+    }
+    latencies[received++] = t - s.sent_ns;
+    bytes += n;
+    first = first ? first : t;
+    last = t;
+  }
+
+  qsort(latencies, received, sizeof(uint64_t), compare_u64);
+  double seconds = (last - first) / 1e9;
+  printf("sink: %ld of %ld datagrams (%.2f%% loss), %ld duplicates, "
+      "%ld reordered, %ld foreign\n", received, count,
+      (count - received) * 100.0 / count, duplicates, reordered, foreign);
+  printf("sink: %.0f datagrams/s, %.1f Mbit/s of payload\n",
+      (seconds > 0) ? received / seconds : 0,
+      (seconds > 0) ? bytes * 8 / seconds / 1e6 : 0);
+  printf("sink: latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+      percentile(latencies, received, 50) / 1e3,
+      percentile(latencies, received, 99) / 1e3,
+      received ? latencies[received - 1] / 1e3 : 0);
+  free(seen);
+  free(latencies);
+  close(fd);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int ret = -1;
+  if ((argc > 1) && (strcmp(argv[1], "blast") == 0)) {
+    ret = blast(argc, argv);
+  } else if ((argc > 1) && (strcmp(argv[1], "sink") == 0)) {
+    ret = sink(argc, argv);
+  }
+  if (ret != 0) {
+    printf("Usage: %s blast <ifname> <count> [pps] [min payload] "
+        "[max payload]\n", argv[0]);
+    printf("       %s sink <count> [idle ms]\n", argv[0]);
+    exit(1);
+  }
+  return 0;
+}
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 
 #include "server_glue.h"
+#include "rustwall.h"
 
 
 extern void client_mac(uint8_t *b1, uint8_t *b2, uint8_t *b3, uint8_t *b4,
@@ -29,11 +30,48 @@ char packet_bytes[] = { 2, 0, 0, 0, 1, 1, 82, 84, 0, 0, 0, 0, 8, 0, 69, 0, 0,
     31, 0, 0, 64, 0, 64, 17, 47, 120, 192, 168, 69, 3, 192, 168, 69, 2, 175,
     211, 27, 57, 0, 11, 190, 19, 97, 97, 10 };
 
+/**
+ * Pass the contents of the file at `path` to `firewall_configure()`,
+ * exits if it can't be read in full
+ */
+static void configure_from_file(const char *path)
+{
+  static char blob[4096];
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  // read one byte more than fits, to tell a full blob from a truncated one
+  size_t len = fread(blob, 1, sizeof(blob), f);
+  bool truncated = (len == sizeof(blob)) && (fgetc(f) != EOF);
+  bool failed = ferror(f);
+  fclose(f);
+  if (failed) {
+    printf("Cannot read %s\n", path);
+    exit(1);
+  }
+  if (truncated) {
+    printf("%s is larger than %zu bytes\n", path, sizeof(blob));
+    exit(1);
+  }
+  if (firewall_configure(blob, len) != 0) {
+    printf("Invalid configuration in %s\n", path);
+    exit(1);
+  }
+}
+
 /**
  * Main program
+ * Usage: main [config file]
  */
-int main()
+int main(int argc, char **argv)
 {
+  /* Size the firewall before any traffic */
+  if (argc > 1) {
+    configure_from_file(argv[1]);
+  }
+
   /* Connect to the device */
   strcpy(tun_name, "tap1");
   tun_fd = tun_alloc(tun_name, IFF_TAP | IFF_NO_PI | O_NONBLOCK); /* tun interface */
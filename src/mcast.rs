@@ -0,0 +1,173 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use smoltcp::wire::{EthernetAddress, EthernetFrame, EthernetProtocol, IpProtocol, Ipv4Address, Ipv4Packet};
+
+use config;
+use constants;
+
+/// Multicast frames from the wire dropped by the hash filter
+pub static DROPS: AtomicUsize = AtomicUsize::new(0);
+
+/// IGMP message types, see RFC 2236 and RFC 3376
+const IGMP_V1_REPORT: u8 = 0x12;
+const IGMP_V2_REPORT: u8 = 0x16;
+const IGMP_V2_LEAVE: u8 = 0x17;
+const IGMP_V3_REPORT: u8 = 0x22;
+/// IGMPv3 group record types that carry an include list
+const IGMP_MODE_IS_INCLUDE: u8 = 1;
+const IGMP_CHANGE_TO_INCLUDE: u8 = 3;
+const IGMP_BLOCK_OLD_SOURCES: u8 = 6;
+
+/// 224.0.0.1, joined by every host without ever being reported
+const ALL_HOSTS: Ipv4Address = Ipv4Address([224, 0, 0, 1]);
+
+/// The groups the client is a member of and the hash filter built from
+/// them. The filter is a 64-bit set of the low 6 bits of the Ethernet CRC of
+/// each group's MAC address, split into two words so that it can be read
+/// without a lock on 32-bit targets.
+struct GroupTable {
+    groups: ::spin::Mutex<Vec<Ipv4Address>>,
+    filter: [AtomicUsize; 2],
+}
+
+impl GroupTable {
+    fn new() -> GroupTable {
+        let mut groups = vec![ALL_HOSTS];
+        for group in config::get().multicast_groups.iter() {
+            if !groups.contains(group) {
+                groups.push(*group);
+            }
+        }
+        let table = GroupTable {
+            groups: ::spin::Mutex::new(vec![]),
+            filter: [AtomicUsize::new(0), AtomicUsize::new(0)],
+        };
+        table.update(&groups);
+        *table.groups.lock() = groups;
+        table
+    }
+
+    /// Rebuild the filter from `groups`
+    fn update(&self, groups: &[Ipv4Address]) {
+        let mut filter = [0usize; 2];
+        for group in groups {
+            let bit = hash(&group_mac(*group));
+            filter[bit / 32] |= 1 << (bit % 32);
+        }
+        self.filter[0].store(filter[0], Ordering::Release);
+        self.filter[1].store(filter[1], Ordering::Release);
+    }
+}
+
+lazy_static! {
+    static ref GROUPS: GroupTable = GroupTable::new();
+}
+
+/// The MAC address IPv4 multicast `group` is sent to (RFC 1112)
+fn group_mac(group: Ipv4Address) -> EthernetAddress {
+    let b = group.as_bytes();
+    EthernetAddress([0x01, 0x00, 0x5e, b[1] & 0x7f, b[2], b[3]])
+}
+
+/// Bit of the hash filter for `mac`, the low 6 bits of its Ethernet CRC
+fn hash(mac: &EthernetAddress) -> usize {
+    let mut crc: u32 = 0xffff_ffff;
+    for byte in mac.as_bytes() {
+        crc ^= *byte as u32;
+        for _ in 0..8 {
+            crc = if crc & 1 != 0 { (crc >> 1) ^ 0xedb8_8320 } else { crc >> 1 };
+        }
+    }
+    (!crc & 0x3f) as usize
+}
+
+/// Should a frame from the wire sent to `dst` reach the client?
+/// IPv4 multicast only passes if its hash is in the filter, everything else
+/// always does. Like a NIC filter this lets through some groups the client
+/// didn't join, they are dropped further up.
+pub fn accept(dst: &EthernetAddress) -> bool {
+    let b = dst.as_bytes();
+    if b[0..3] != [0x01, 0x00, 0x5e] || !config::get().multicast_filter {
+        return true;
+    }
+    let bit = hash(dst);
+    if GROUPS.filter[bit / 32].load(Ordering::Acquire) & (1 << (bit % 32)) != 0 {
+        true
+    } else {
+        DROPS.fetch_add(1, Ordering::Relaxed);
+        false
+    }
+}
+
+fn join(group: Ipv4Address) {
+    if !group.is_multicast() {
+        return;
+    }
+    let mut groups = GROUPS.groups.lock();
+    if groups.contains(&group) || groups.len() >= constants::MAX_MULTICAST_GROUPS {
+        return;
+    }
+    debug_print!("Firewall mcast: client joined {}", group);
+    groups.push(group);
+    GROUPS.update(&groups);
+}
+
+fn leave(group: Ipv4Address) {
+    // a configured group stays
+    if group == ALL_HOSTS || config::get().multicast_groups.contains(&group) {
+        return;
+    }
+    let mut groups = GROUPS.groups.lock();
+    groups.retain(|g| *g != group);
+    debug_print!("Firewall mcast: client left {}", group);
+    GROUPS.update(&groups);
+}
+
+/// Follow the group memberships in the IGMP reports of a `frame` from the client
+pub fn learn(frame: &[u8]) {
+    if !config::get().multicast_filter {
+        return;
+    }
+    let eth_frame = match EthernetFrame::new_checked(frame) {
+        Ok(f) => f,
+        Err(_) => return,
+    };
+    if eth_frame.ethertype() != EthernetProtocol::Ipv4 {
+        return;
+    }
+    let packet = match Ipv4Packet::new_checked(eth_frame.payload()) {
+        Ok(p) => p,
+        Err(_) => return,
+    };
+    if packet.protocol() != IpProtocol::Igmp || packet.frag_offset() != 0 {
+        return;
+    }
+    let igmp = packet.payload();
+    if igmp.len() < 8 {
+        return;
+    }
+    match igmp[0] {
+        IGMP_V1_REPORT | IGMP_V2_REPORT => join(Ipv4Address::from_bytes(&igmp[4..8])),
+        IGMP_V2_LEAVE => leave(Ipv4Address::from_bytes(&igmp[4..8])),
+        IGMP_V3_REPORT => {
+            let records = ((igmp[6] as usize) << 8) | igmp[7] as usize;
+            let mut offset = 8;
+            for _ in 0..records {
+                if offset + 8 > igmp.len() {
+                    break;
+                }
+                let record_type = igmp[offset];
+                let sources = ((igmp[offset + 2] as usize) << 8) | igmp[offset + 3] as usize;
+                let group = Ipv4Address::from_bytes(&igmp[offset + 4..offset + 8]);
+                match record_type {
+                    // an empty include list is how IGMPv3 leaves a group
+                    IGMP_MODE_IS_INCLUDE | IGMP_CHANGE_TO_INCLUDE if sources == 0 => leave(group),
+                    IGMP_BLOCK_OLD_SOURCES => {}
+                    _ => join(group),
+                }
+                offset += 8 + 4 * sources + 4 * igmp[offset + 1] as usize;
+            }
+        }
+        _ => {}
+    }
+}
@@ -0,0 +1,331 @@
+/**
+ * Performance regression gate
+ *
+ * Measures throughput, per-unit latency and heap allocations per unit for the
+ * fixture traffic in both directions, repeating every measurement several
+ * times. The median and the spread (median absolute deviation) of each metric
+ * are written as JSON, and compared against a baseline written by an earlier
+ * run on the same machine. A metric regresses when its median is worse than
+ * the baseline median by more than the larger of a fixed threshold and three
+ * times the combined spread of both runs, so noisy metrics need a bigger
+ * change to trip the gate than stable ones.
+ *
+ * Usage: perf_check [-r runs] [-n units] [-o results.json] [-b baseline.json]
+ * Exits with 1 if any metric regressed against the baseline.
+ */
+#include "bench_glue.h"
+#include "rustwall.h"
+#include "test_data.h"
+#include <unistd.h>
+
+#define DEFAULT_RUNS 5
+#define DEFAULT_UNITS 20000
+#define WARMUP_UNITS 1000
+#define MAX_RUNS 64
+#define MAX_METRICS 64
+#define MAX_UNIT_FRAMES 4
+#define METRIC_NAME_LEN 64
+
+/* how many combined spreads a change has to exceed to count */
+#define SPREAD_FACTOR 3.0
+
+enum direction {
+  DIR_TX, DIR_RX
+};
+
+struct traffic_unit {
+  const char *name;
+  uint8_t *frames[MAX_UNIT_FRAMES];
+  int lens[MAX_UNIT_FRAMES];
+  int count;
+};
+
+static const struct traffic_unit units[] = {
+  { "udp", { packet_bytes_udp_1 }, { sizeof(packet_bytes_udp_1) }, 1 },
+  { "ping", { packet_bytes_ping }, { sizeof(packet_bytes_ping) }, 1 },
+  { "arp", { packet_bytes_arp }, { sizeof(packet_bytes_arp) }, 1 },
+  { "udp-frag", { packet_bytes_udp_frag1, packet_bytes_udp_frag2,
+      packet_bytes_udp_frag3 }, { sizeof(packet_bytes_udp_frag1),
+      sizeof(packet_bytes_udp_frag2), sizeof(packet_bytes_udp_frag3) }, 3 },
+};
+#define UNIT_COUNT (sizeof(units) / sizeof(units[0]))
+
+enum metric_kind {
+  FRAMES_PER_S, LATENCY_P50, LATENCY_P99, ALLOCS_PER_UNIT, KIND_COUNT
+};
+
+struct metric_kind_info {
+  const char *suffix;
+  bool higher_is_better;
+  /* smallest relative change that counts as a regression */
+  double threshold;
+};
+
+static const struct metric_kind_info kinds[KIND_COUNT] = {
+  [FRAMES_PER_S] = { "frames_per_s", true, 0.10 },
+  [LATENCY_P50] = { "latency_p50_ns", false, 0.15 },
+  [LATENCY_P99] = { "latency_p99_ns", false, 0.25 },
+  // deterministic, any increase is a regression
+  [ALLOCS_PER_UNIT] = { "allocs_per_unit", false, 0.0 },
+};
+
+struct metric {
+  char name[METRIC_NAME_LEN];
+  enum metric_kind kind;
+  double samples[MAX_RUNS];
+  double median;
+  double spread;
+};
+
+static struct metric results[MAX_METRICS];
+static int result_count = 0;
+
+static struct metric baseline[MAX_METRICS];
+static int baseline_count = 0;
+
+static void send_unit(const struct traffic_unit *unit, enum direction dir)
+{
+  for (int i = 0; i < unit->count; i++) {
+    if (dir == DIR_TX) {
+      bench_client_tx(unit->frames[i], unit->lens[i]);
+    } else {
+      bench_inject_rx(unit->frames[i], unit->lens[i]);
+      bench_client_rx_drain();
+    }
+  }
+}
+
+static uint64_t heap_allocations(void)
+{
+  struct firewall_stats stats;
+  firewall_stats_get(&stats);
+  return stats.heap_allocations;
+}
+
+/**
+ * One run of `count` units back to back, fills one sample of each kind
+ */
+static void measure(const struct traffic_unit *unit, enum direction dir,
+    int count, uint64_t *latencies, double *sample)
+{
+  for (int i = 0; i < WARMUP_UNITS; i++) {
+    send_unit(unit, dir);
+  }
+
+  uint64_t allocs = heap_allocations();
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < count; i++) {
+    uint64_t t = bench_now_ns();
+    send_unit(unit, dir);
+    latencies[i] = bench_now_ns() - t;
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  allocs = heap_allocations() - allocs;
+
+  bench_sort(latencies, count);
+  sample[FRAMES_PER_S] = (double) count * unit->count * 1e9 / elapsed;
+  sample[LATENCY_P50] = bench_percentile(latencies, count, 50);
+  sample[LATENCY_P99] = bench_percentile(latencies, count, 99);
+  sample[ALLOCS_PER_UNIT] = (double) allocs / count;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static double median(double *values, int count)
+{
+  qsort(values, count, sizeof(double), compare_double);
+  if (count % 2) {
+    return values[count / 2];
+  }
+  return (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+static void summarize(struct metric *m, int runs)
+{
+  double deviations[MAX_RUNS];
+  m->median = median(m->samples, runs);
+  for (int i = 0; i < runs; i++) {
+    double d = m->samples[i] - m->median;
+    deviations[i] = (d < 0) ? -d : d;
+  }
+  m->spread = median(deviations, runs);
+}
+
+/**
+ * One metric per line, so that the baseline can be read back with sscanf
+ */
+static int write_json(const char *path, int runs, int count)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    printf("Cannot write %s\n", path);
+    return -1;
+  }
+  fprintf(f, "{\n  \"runs\": %d,\n  \"units\": %d,\n  \"metrics\": {\n", runs,
+      count);
+  for (int i = 0; i < result_count; i++) {
+    fprintf(f, "    \"%s\": {\"median\": %.3f, \"spread\": %.3f, "
+        "\"better\": \"%s\"}%s\n", results[i].name, results[i].median,
+        results[i].spread, kinds[results[i].kind].higher_is_better ? "higher"
+            : "lower", (i + 1 < result_count) ? "," : "");
+  }
+  fprintf(f, "  }\n}\n");
+  fclose(f);
+  return 0;
+}
+
+/**
+ * Leaves `baseline_count` at 0 if the file is missing or empty
+ */
+static void read_baseline(const char *path)
+{
+  char line[256];
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return;
+  }
+  while (fgets(line, sizeof(line), f) && (baseline_count < MAX_METRICS)) {
+    struct metric *m = &baseline[baseline_count];
+    if (sscanf(line, " \"%63[^\"]\": {\"median\": %lf, \"spread\": %lf",
+        m->name, &m->median, &m->spread) == 3) {
+      baseline_count++;
+    }
+  }
+  fclose(f);
+}
+
+static const struct metric *find_baseline(const char *name)
+{
+  for (int i = 0; i < baseline_count; i++) {
+    if (strcmp(baseline[i].name, name) == 0) {
+      return &baseline[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Print the comparison of `m` to its baseline, returns true on regression
+ * and when the baseline was recorded without `m`, which would pass unchecked
+ */
+static bool check_regression(const struct metric *m)
+{
+  const struct metric_kind_info *kind = &kinds[m->kind];
+  const struct metric *base = find_baseline(m->name);
+  if (base == NULL) {
+    printf("%-32s %14.1f %14s %9s  MISSING\n", m->name, m->median, "-", "-");
+    return true;
+  }
+
+  // positive when worse than the baseline
+  double worse = kind->higher_is_better ? base->median - m->median
+      : m->median - base->median;
+  double allowed = base->median * kind->threshold;
+  double noise = SPREAD_FACTOR * (base->spread + m->spread);
+  allowed = (noise > allowed) ? noise : allowed;
+  double change = (base->median != 0) ? (m->median - base->median)
+      / base->median * 100 : 0;
+
+  bool regressed = worse > allowed;
+  printf("%-32s %14.1f %14.1f %8.1f%%  %s\n", m->name, m->median,
+      base->median, change, regressed ? "REGRESSED" : "ok");
+  return regressed;
+}
+
+int main(int argc, char **argv)
+{
+  int runs = DEFAULT_RUNS;
+  int count = DEFAULT_UNITS;
+  const char *out_path = "perf_results.json";
+  const char *baseline_path = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:n:o:b:")) != -1) {
+    switch (opt) {
+      case 'r':
+        runs = atoi(optarg);
+        break;
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      case 'b':
+        baseline_path = optarg;
+        break;
+      default:
+        runs = 0;
+    }
+  }
+  if ((runs <= 0) || (runs > MAX_RUNS) || (count <= 0)) {
+    printf("Usage: %s [-r runs] [-n units] [-o results.json] "
+        "[-b baseline.json]\n", argv[0]);
+    exit(1);
+  }
+
+  uint64_t *latencies = malloc(count * sizeof(uint64_t));
+  if (latencies == NULL) {
+    printf("Out of memory\n");
+    exit(1);
+  }
+  // without the counting allocator there is nothing to compare
+  bool track_allocs = heap_allocations() > 0;
+
+  for (int d = DIR_TX; d <= DIR_RX; d++) {
+    for (int u = 0; u < UNIT_COUNT; u++) {
+      struct metric *m = &results[result_count];
+      for (int k = 0; k < KIND_COUNT; k++) {
+        snprintf(m[k].name, METRIC_NAME_LEN, "%s.%s.%s",
+            (d == DIR_TX) ? "tx" : "rx", units[u].name, kinds[k].suffix);
+        m[k].kind = k;
+      }
+      for (int r = 0; r < runs; r++) {
+        double sample[KIND_COUNT];
+        measure(&units[u], d, count, latencies, sample);
+        for (int k = 0; k < KIND_COUNT; k++) {
+          m[k].samples[r] = sample[k];
+        }
+      }
+      for (int k = 0; k < KIND_COUNT; k++) {
+        summarize(&m[k], runs);
+      }
+      result_count += track_allocs ? KIND_COUNT : KIND_COUNT - 1;
+    }
+  }
+  free(latencies);
+
+  if (write_json(out_path, runs, count) != 0) {
+    exit(1);
+  }
+  printf("Results written to %s\n", out_path);
+  if (baseline_path == NULL) {
+    return 0;
+  }
+
+  // without one every metric would pass unchecked
+  read_baseline(baseline_path);
+  if (baseline_count == 0) {
+    printf("No baseline in %s, record one on this machine with "
+        "`make perf-baseline`\n", baseline_path);
+    return 1;
+  }
+  printf("\n%-32s %14s %14s %9s\n", "metric", "median", "baseline",
+      "change");
+  int regressions = 0;
+  for (int i = 0; i < result_count; i++) {
+    regressions += check_regression(&results[i]);
+  }
+  if (regressions) {
+    printf("\n%d metric(s) regressed or missing in %s\n", regressions,
+        baseline_path);
+    return 1;
+  }
+  printf("\nNo regressions against %s\n", baseline_path);
+  return 0;
+}
@@ -0,0 +1,550 @@
+/**
+ * Synthetic traffic generator, see `pktgen.h`
+ */
+#include "pktgen.h"
+#include <string.h>
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_ARP 0x0806
+#define ETHERTYPE_IPV6 0x86dd
+#define IPV6_NEXT_HEADER_FRAGMENT 44
+#define IPV4_FLAG_DONT_FRAGMENT 0x4000
+#define IPV4_FLAG_MORE_FRAGMENTS 0x2000
+#define DEFAULT_SEED 0x2545f4914f6cdd1dull
+
+/* offset of the checksum in the ICMP and UDP headers */
+#define ICMP_CHECKSUM_OFFSET 2
+#define UDP_CHECKSUM_OFFSET 6
+
+enum value_index {
+  VALUE_SRC_IP, VALUE_DST_IP, VALUE_SRC_PORT, VALUE_DST_PORT
+};
+
+static const uint8_t broadcast_mac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+/* 2001:db8::/96, the last 32 bits come from the IPv4 address ranges */
+static const uint8_t ipv6_prefix[12] = { 0x20, 0x01, 0x0d, 0xb8 };
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v & 0xffff);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+/**
+ * Make a valid checksum invalid, without producing the "no checksum"
+ * value 0 of UDP
+ */
+static void corrupt_checksum(uint8_t *p)
+{
+  uint16_t v = get16(p);
+  put16(p, (v == 0xffff) ? 1 : v + 1);
+}
+
+static uint32_t sum_bytes(uint32_t sum, const uint8_t *data, int len)
+{
+  for (int i = 0; i + 1 < len; i += 2) {
+    sum += get16(data + i);
+  }
+  if (len & 1) {
+    sum += data[len - 1] << 8;
+  }
+  return sum;
+}
+
+/**
+ * Payload byte `i` is `fill + i`, this sums `len` of them starting at 0
+ */
+static uint32_t sum_pattern(uint32_t sum, int len, uint8_t fill)
+{
+  for (int i = 0; i + 1 < len; i += 2) {
+    sum += (((fill + i) & 0xff) << 8) | ((fill + i + 1) & 0xff);
+  }
+  if (len & 1) {
+    sum += ((fill + len - 1) & 0xff) << 8;
+  }
+  return sum;
+}
+
+static uint16_t fold(uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+static void write_pattern(uint8_t *p, int start, int len, uint8_t fill)
+{
+  for (int i = 0; i < len; i++) {
+    p[i] = fill + start + i;
+  }
+}
+
+static void write_eth_header(uint8_t *frame, const uint8_t *dst,
+    const uint8_t *src, uint16_t ethertype)
+{
+  memcpy(frame, dst, 6);
+  memcpy(frame + 6, src, 6);
+  put16(frame + 12, ethertype);
+}
+
+uint16_t pktgen_ipv4_checksum(const uint8_t *header)
+{
+  return fold(sum_bytes(0, header, PKTGEN_IPV4_HEADER_LEN));
+}
+
+/**
+ * The ICMP echo request or UDP header of an IPv4 payload of `l4_len` bytes
+ */
+static void write_l4_header(uint8_t *header, const struct pktgen_flow *flow,
+    uint8_t proto, uint16_t ident, int l4_len, uint8_t fill)
+{
+  uint32_t sum;
+  if (proto == PKTGEN_PROTO_ICMP) {
+    header[0] = 8;
+    header[1] = 0;
+    put16(header + 2, 0);
+    put16(header + 4, flow->src_port);
+    put16(header + 6, ident);
+    sum = sum_bytes(0, header, PKTGEN_L4_HEADER_LEN);
+  } else {
+    put16(header, flow->src_port);
+    put16(header + 2, flow->dst_port);
+    put16(header + 4, l4_len);
+    put16(header + 6, 0);
+    // pseudo header
+    sum = (flow->src_ip >> 16) + (flow->src_ip & 0xffff)
+        + (flow->dst_ip >> 16) + (flow->dst_ip & 0xffff) + proto + l4_len;
+    sum = sum_bytes(sum, header, PKTGEN_L4_HEADER_LEN);
+  }
+  uint16_t checksum = fold(sum_pattern(sum, l4_len - PKTGEN_L4_HEADER_LEN,
+      fill));
+  if ((proto == PKTGEN_PROTO_UDP) && (checksum == 0)) {
+    checksum = 0xffff;
+  }
+  put16(header + ((proto == PKTGEN_PROTO_ICMP) ? ICMP_CHECKSUM_OFFSET
+      : UDP_CHECKSUM_OFFSET), checksum);
+}
+
+int pktgen_ipv4_fragment(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow, uint8_t proto, uint16_t ident, int l4_len,
+    int offset, int len, bool more, uint8_t fill)
+{
+  int frame_len = PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV4_HEADER_LEN + len;
+  if ((frame_len > max_len) || (l4_len < PKTGEN_L4_HEADER_LEN)
+      || (offset % 8) || (offset + len > l4_len)) {
+    return -1;
+  }
+  write_eth_header(frame, flow->dst_mac, flow->src_mac, ETHERTYPE_IPV4);
+
+  uint8_t *ip = frame + PKTGEN_ETH_HEADER_LEN;
+  ip[0] = 0x45;
+  ip[1] = 0;
+  put16(ip + 2, PKTGEN_IPV4_HEADER_LEN + len);
+  put16(ip + 4, ident);
+  // whole packets carry DF like the ones a Linux sender emits
+  if ((offset == 0) && (len == l4_len)) {
+    put16(ip + 6, IPV4_FLAG_DONT_FRAGMENT);
+  } else {
+    put16(ip + 6, (more ? IPV4_FLAG_MORE_FRAGMENTS : 0) | (offset / 8));
+  }
+  ip[8] = 64;
+  ip[9] = proto;
+  put16(ip + 10, 0);
+  put32(ip + 12, flow->src_ip);
+  put32(ip + 16, flow->dst_ip);
+  put16(ip + 10, pktgen_ipv4_checksum(ip));
+
+  uint8_t *data = ip + PKTGEN_IPV4_HEADER_LEN;
+  int copied = 0;
+  if (offset < PKTGEN_L4_HEADER_LEN) {
+    uint8_t header[PKTGEN_L4_HEADER_LEN];
+    write_l4_header(header, flow, proto, ident, l4_len, fill);
+    copied = PKTGEN_L4_HEADER_LEN - offset;
+    copied = (copied > len) ? len : copied;
+    memcpy(data, header + offset, copied);
+  }
+  write_pattern(data + copied, offset + copied - PKTGEN_L4_HEADER_LEN,
+      len - copied, fill);
+  return frame_len;
+}
+
+int pktgen_icmp_echo(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow, uint16_t ident, int payload_len,
+    uint8_t fill)
+{
+  int l4_len = PKTGEN_L4_HEADER_LEN + payload_len;
+  return pktgen_ipv4_fragment(frame, max_len, flow, PKTGEN_PROTO_ICMP, ident,
+      l4_len, 0, l4_len, false, fill);
+}
+
+int pktgen_udp(uint8_t *frame, int max_len, const struct pktgen_flow *flow,
+    uint16_t ident, int payload_len, uint8_t fill)
+{
+  int l4_len = PKTGEN_L4_HEADER_LEN + payload_len;
+  return pktgen_ipv4_fragment(frame, max_len, flow, PKTGEN_PROTO_UDP, ident,
+      l4_len, 0, l4_len, false, fill);
+}
+
+static void write_ipv6_header(uint8_t *ip, const struct pktgen_flow *flow,
+    uint8_t next_header, int payload_len)
+{
+  put32(ip, 0x60000000);
+  put16(ip + 4, payload_len);
+  ip[6] = next_header;
+  ip[7] = 64;
+  memcpy(ip + 8, ipv6_prefix, sizeof(ipv6_prefix));
+  put32(ip + 20, flow->src_ip);
+  memcpy(ip + 24, ipv6_prefix, sizeof(ipv6_prefix));
+  put32(ip + 36, flow->dst_ip);
+}
+
+int pktgen_ipv6_fragment(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow, uint32_t ident, int l4_len, int offset,
+    int len, bool more, uint8_t fill)
+{
+  int frame_len = PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV6_HEADER_LEN
+      + PKTGEN_IPV6_FRAG_HEADER_LEN + len;
+  if ((frame_len > max_len) || (l4_len < PKTGEN_L4_HEADER_LEN)
+      || (l4_len > 0xffff) || (offset % 8) || (offset + len > l4_len)) {
+    return -1;
+  }
+  write_eth_header(frame, flow->dst_mac, flow->src_mac, ETHERTYPE_IPV6);
+
+  uint8_t *ip = frame + PKTGEN_ETH_HEADER_LEN;
+  write_ipv6_header(ip, flow, IPV6_NEXT_HEADER_FRAGMENT,
+      PKTGEN_IPV6_FRAG_HEADER_LEN + len);
+  uint8_t *frag = ip + PKTGEN_IPV6_HEADER_LEN;
+  frag[0] = PKTGEN_PROTO_UDP;
+  frag[1] = 0;
+  put16(frag + 2, offset | (more ? 1 : 0));
+  put32(frag + 4, ident);
+
+  uint8_t *data = frag + PKTGEN_IPV6_FRAG_HEADER_LEN;
+  int copied = 0;
+  if (offset < PKTGEN_L4_HEADER_LEN) {
+    uint8_t header[PKTGEN_L4_HEADER_LEN];
+    put16(header, flow->src_port);
+    put16(header + 2, flow->dst_port);
+    put16(header + 4, l4_len);
+    put16(header + 6, 0);
+    // pseudo header: both addresses, length and next header
+    uint32_t sum = sum_bytes(0, ip + 8, 32) + l4_len + PKTGEN_PROTO_UDP;
+    sum = sum_bytes(sum, header, PKTGEN_L4_HEADER_LEN);
+    uint16_t checksum = fold(sum_pattern(sum, l4_len - PKTGEN_L4_HEADER_LEN,
+        fill));
+    put16(header + UDP_CHECKSUM_OFFSET, checksum ? checksum : 0xffff);
+    copied = PKTGEN_L4_HEADER_LEN - offset;
+    copied = (copied > len) ? len : copied;
+    memcpy(data, header + offset, copied);
+  }
+  write_pattern(data + copied, offset + copied - PKTGEN_L4_HEADER_LEN,
+      len - copied, fill);
+  return frame_len;
+}
+
+int pktgen_udp6(uint8_t *frame, int max_len, const struct pktgen_flow *flow,
+    int payload_len, uint8_t fill)
+{
+  int l4_len = PKTGEN_L4_HEADER_LEN + payload_len;
+  int frame_len = PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV6_HEADER_LEN + l4_len;
+  if ((frame_len > max_len) || (l4_len > 0xffff)) {
+    return -1;
+  }
+  write_eth_header(frame, flow->dst_mac, flow->src_mac, ETHERTYPE_IPV6);
+
+  uint8_t *ip = frame + PKTGEN_ETH_HEADER_LEN;
+  write_ipv6_header(ip, flow, PKTGEN_PROTO_UDP, l4_len);
+
+  uint8_t *udp = ip + PKTGEN_IPV6_HEADER_LEN;
+  put16(udp, flow->src_port);
+  put16(udp + 2, flow->dst_port);
+  put16(udp + 4, l4_len);
+  put16(udp + 6, 0);
+  write_pattern(udp + PKTGEN_L4_HEADER_LEN, 0, payload_len, fill);
+  // pseudo header: both addresses, length and next header
+  uint32_t sum = sum_bytes(0, ip + 8, 32) + l4_len + PKTGEN_PROTO_UDP;
+  uint16_t checksum = fold(sum_bytes(sum, udp, l4_len));
+  put16(udp + UDP_CHECKSUM_OFFSET, checksum ? checksum : 0xffff);
+  return frame_len;
+}
+
+int pktgen_arp_request(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow)
+{
+  int frame_len = PKTGEN_ETH_HEADER_LEN + PKTGEN_ARP_LEN;
+  if (frame_len > max_len) {
+    return -1;
+  }
+  write_eth_header(frame, broadcast_mac, flow->src_mac, ETHERTYPE_ARP);
+
+  uint8_t *arp = frame + PKTGEN_ETH_HEADER_LEN;
+  put16(arp, 1);
+  put16(arp + 2, ETHERTYPE_IPV4);
+  arp[4] = 6;
+  arp[5] = 4;
+  put16(arp + 6, 1);
+  memcpy(arp + 8, flow->src_mac, 6);
+  put32(arp + 14, flow->src_ip);
+  memset(arp + 18, 0, 6);
+  put32(arp + 24, flow->dst_ip);
+  return frame_len;
+}
+
+uint32_t pktgen_crc32(const uint8_t *data, int len)
+{
+  // filled on first use, racing threads compute the same values
+  static uint32_t table[256];
+  static volatile bool table_ready = false;
+  if (!table_ready) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    table_ready = true;
+  }
+
+  uint32_t crc = 0xffffffff;
+  for (int i = 0; i < len; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void pktgen_default_config(struct pktgen_config *config)
+{
+  static const uint8_t src_mac[6] = { 0x5e, 0x13, 0x5d, 0xa6, 0xc5, 0xf2 };
+  static const uint8_t dst_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+  memset(config, 0, sizeof(*config));
+  config->weights[PKTGEN_UDP] = 1;
+  memcpy(config->src_mac, src_mac, 6);
+  memcpy(config->dst_mac, dst_mac, 6);
+  config->src_ip.base = 0xc0a84502;
+  config->src_ip.count = 1;
+  config->dst_ip.base = 0xc0a84501;
+  config->dst_ip.count = 1;
+  config->src_port.base = 41034;
+  config->src_port.count = 1;
+  config->dst_port.base = 6969;
+  config->dst_port.count = 1;
+  config->dist = PKTGEN_UNIFORM;
+  config->min_payload = 8;
+  config->max_payload = 64;
+  config->mtu = 1500;
+  config->frag_order = PKTGEN_IN_ORDER;
+  config->seed = DEFAULT_SEED;
+}
+
+int pktgen_init(struct pktgen *gen, const struct pktgen_config *config)
+{
+  uint32_t weights = 0;
+  for (int i = 0; i < PKTGEN_KIND_COUNT; i++) {
+    weights += config->weights[i];
+  }
+  if ((weights == 0) || (config->min_payload > config->max_payload)
+      || (config->max_payload > PKTGEN_MAX_L4_LEN - PKTGEN_L4_HEADER_LEN)
+      || (config->mtu < PKTGEN_MIN_MTU) || (config->mtu > PKTGEN_MAX_MTU)
+      || (config->frag_dup_pct > 100) || (config->frag_missing_pct > 100)
+      || (config->bad_checksum_pct > 100)) {
+    return -1;
+  }
+
+  memset(gen, 0, sizeof(*gen));
+  gen->config = *config;
+  gen->rng = config->seed ? config->seed : DEFAULT_SEED;
+  return 0;
+}
+
+bool pktgen_in_train(const struct pktgen *gen)
+{
+  return gen->train_next < gen->train_count;
+}
+
+/* xorshift64 */
+static uint32_t next_random(struct pktgen *gen)
+{
+  gen->rng ^= gen->rng << 13;
+  gen->rng ^= gen->rng >> 7;
+  gen->rng ^= gen->rng << 17;
+  return (uint32_t) (gen->rng >> 32);
+}
+
+static bool chance(struct pktgen *gen, uint32_t pct)
+{
+  return (next_random(gen) % 100) < pct;
+}
+
+static uint32_t sample(struct pktgen *gen, enum value_index idx,
+    const struct pktgen_range *range)
+{
+  uint32_t count = range->count ? range->count : 1;
+  if (gen->config.dist == PKTGEN_SEQUENTIAL) {
+    return range->base + (gen->next_value[idx]++ % count);
+  }
+  return range->base + (next_random(gen) % count);
+}
+
+static void sample_flow(struct pktgen *gen, struct pktgen_flow *flow)
+{
+  memcpy(flow->src_mac, gen->config.src_mac, 6);
+  memcpy(flow->dst_mac, gen->config.dst_mac, 6);
+  flow->src_ip = sample(gen, VALUE_SRC_IP, &gen->config.src_ip);
+  flow->dst_ip = sample(gen, VALUE_DST_IP, &gen->config.dst_ip);
+  flow->src_port = sample(gen, VALUE_SRC_PORT, &gen->config.src_port);
+  flow->dst_port = sample(gen, VALUE_DST_PORT, &gen->config.dst_port);
+}
+
+static enum pktgen_kind sample_kind(struct pktgen *gen)
+{
+  uint32_t weights = 0;
+  for (int i = 0; i < PKTGEN_KIND_COUNT; i++) {
+    weights += gen->config.weights[i];
+  }
+  uint32_t pick = next_random(gen) % weights;
+  for (int i = 0; i < PKTGEN_KIND_COUNT; i++) {
+    if (pick < gen->config.weights[i]) {
+      return i;
+    }
+    pick -= gen->config.weights[i];
+  }
+  return PKTGEN_UDP;
+}
+
+static int sample_payload(struct pktgen *gen)
+{
+  uint32_t span = gen->config.max_payload - gen->config.min_payload + 1;
+  return gen->config.min_payload + (next_random(gen) % span);
+}
+
+/**
+ * Plan the fragments of an IPv4 payload too large for the MTU
+ */
+static void start_train(struct pktgen *gen, const struct pktgen_flow *flow,
+    uint8_t proto, int l4_len, uint8_t fill, bool bad_checksum)
+{
+  gen->train_flow = *flow;
+  gen->train_proto = proto;
+  gen->train_fill = fill;
+  gen->train_ident = gen->next_ident++;
+  gen->train_l4_len = l4_len;
+  gen->train_frag_len = (gen->config.mtu - PKTGEN_IPV4_HEADER_LEN) & ~7u;
+  gen->train_bad_checksum = bad_checksum;
+  gen->train_count = 0;
+  gen->train_next = 0;
+
+  int fragments = (l4_len + gen->train_frag_len - 1) / gen->train_frag_len;
+  int lost = -1;
+  if ((fragments > 1) && chance(gen, gen->config.frag_missing_pct)) {
+    lost = next_random(gen) % fragments;
+  }
+  for (int i = 0; i < fragments; i++) {
+    if (i == lost) {
+      continue;
+    }
+    gen->train[gen->train_count++] = i;
+    if ((gen->train_count < PKTGEN_MAX_TRAIN)
+        && chance(gen, gen->config.frag_dup_pct)) {
+      gen->train[gen->train_count++] = i;
+    }
+  }
+
+  if (gen->config.frag_order == PKTGEN_REVERSE) {
+    for (int i = 0; i < gen->train_count / 2; i++) {
+      uint16_t tmp = gen->train[i];
+      gen->train[i] = gen->train[gen->train_count - 1 - i];
+      gen->train[gen->train_count - 1 - i] = tmp;
+    }
+  } else if (gen->config.frag_order == PKTGEN_SHUFFLED) {
+    for (int i = gen->train_count - 1; i > 0; i--) {
+      int j = next_random(gen) % (i + 1);
+      uint16_t tmp = gen->train[i];
+      gen->train[i] = gen->train[j];
+      gen->train[j] = tmp;
+    }
+  }
+}
+
+static int next_fragment(struct pktgen *gen, uint8_t *frame, int max_len)
+{
+  int offset = gen->train[gen->train_next++] * gen->train_frag_len;
+  int len = gen->train_l4_len - offset;
+  len = (len > (int) gen->train_frag_len) ? (int) gen->train_frag_len : len;
+  bool more = offset + len < (int) gen->train_l4_len;
+
+  int frame_len = pktgen_ipv4_fragment(frame, max_len, &gen->train_flow,
+      gen->train_proto, gen->train_ident, gen->train_l4_len, offset, len, more,
+      gen->train_fill);
+  if ((frame_len > 0) && gen->train_bad_checksum && (offset == 0)) {
+    corrupt_checksum(frame + PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV4_HEADER_LEN
+        + ((gen->train_proto == PKTGEN_PROTO_ICMP) ? ICMP_CHECKSUM_OFFSET
+            : UDP_CHECKSUM_OFFSET));
+  }
+  return frame_len;
+}
+
+int pktgen_next(struct pktgen *gen, uint8_t *frame, int max_len)
+{
+  int room = gen->config.crc_trailer ? max_len - PKTGEN_CRC_LEN : max_len;
+  int len;
+
+  if (pktgen_in_train(gen)) {
+    len = next_fragment(gen, frame, room);
+  } else {
+    struct pktgen_flow flow;
+    enum pktgen_kind kind = sample_kind(gen);
+    sample_flow(gen, &flow);
+    uint8_t fill = next_random(gen);
+
+    if (kind == PKTGEN_ARP) {
+      len = pktgen_arp_request(frame, room, &flow);
+    } else if (kind == PKTGEN_IPV6) {
+      len = pktgen_udp6(frame, room, &flow, sample_payload(gen), fill);
+    } else {
+      uint8_t proto = (kind == PKTGEN_ICMP) ? PKTGEN_PROTO_ICMP
+          : PKTGEN_PROTO_UDP;
+      int l4_len = PKTGEN_L4_HEADER_LEN + sample_payload(gen);
+      bool bad_checksum = chance(gen, gen->config.bad_checksum_pct);
+
+      if ((uint32_t) (PKTGEN_IPV4_HEADER_LEN + l4_len) > gen->config.mtu) {
+        start_train(gen, &flow, proto, l4_len, fill, bad_checksum);
+        len = next_fragment(gen, frame, room);
+      } else {
+        len = pktgen_ipv4_fragment(frame, room, &flow, proto,
+            gen->next_ident++, l4_len, 0, l4_len, false, fill);
+        if ((len > 0) && bad_checksum) {
+          // either the IPv4 header or the ICMP / UDP checksum
+          uint8_t *ip = frame + PKTGEN_ETH_HEADER_LEN;
+          corrupt_checksum((next_random(gen) & 1) ? ip + 10
+              : ip + PKTGEN_IPV4_HEADER_LEN + ((proto == PKTGEN_PROTO_ICMP)
+                  ? ICMP_CHECKSUM_OFFSET : UDP_CHECKSUM_OFFSET));
+        }
+      }
+    }
+  }
+
+  if ((len > 0) && gen->config.crc_trailer) {
+    uint32_t crc = pktgen_crc32(frame, len);
+    // transmitted least significant byte first
+    frame[len] = crc & 0xff;
+    frame[len + 1] = (crc >> 8) & 0xff;
+    frame[len + 2] = (crc >> 16) & 0xff;
+    frame[len + 3] = crc >> 24;
+    len += PKTGEN_CRC_LEN;
+  }
+  return len;
+}
@@ -0,0 +1,177 @@
+/**
+ * Synthetic traffic generator for the rustwall test harnesses and benchmarks
+ *
+ * Builds valid Ethernet frames carrying ARP, ICMP echo, UDP over IPv4 and
+ * UDP over IPv6 from a `struct pktgen_config`. IPv4 packets larger than the
+ * configured MTU come out as fragment trains, one fragment per call, in the
+ * configured order and with optional duplicated and missing fragments.
+ * Checksums can be corrupted on purpose and an Ethernet CRC trailer appended.
+ *
+ * The generator never allocates: all state lives in `struct pktgen` and
+ * every frame is written into a buffer owned by the caller.
+ * Payload bytes follow a fixed pattern, so a receiver can verify them.
+ */
+#ifndef PKTGEN_H
+#define PKTGEN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PKTGEN_ETH_HEADER_LEN 14
+#define PKTGEN_IPV4_HEADER_LEN 20
+#define PKTGEN_IPV6_HEADER_LEN 40
+#define PKTGEN_IPV6_FRAG_HEADER_LEN 8
+#define PKTGEN_L4_HEADER_LEN 8
+#define PKTGEN_ARP_LEN 28
+#define PKTGEN_CRC_LEN 4
+
+/* largest UDP datagram or ICMP message that fits an IPv4 packet */
+#define PKTGEN_MAX_L4_LEN (65535 - PKTGEN_IPV4_HEADER_LEN)
+#define PKTGEN_MIN_MTU 68
+#define PKTGEN_MAX_MTU 9000
+
+/* fragments of the largest packet at the smallest MTU, plus duplicates */
+#define PKTGEN_MAX_TRAIN 4096
+
+#define PKTGEN_PROTO_ICMP 1
+#define PKTGEN_PROTO_UDP 17
+
+enum pktgen_kind {
+  PKTGEN_ARP,
+  PKTGEN_ICMP,
+  PKTGEN_UDP,
+  PKTGEN_IPV6,
+  PKTGEN_KIND_COUNT
+};
+
+enum pktgen_dist {
+  PKTGEN_UNIFORM,     // every value of the range equally likely
+  PKTGEN_SEQUENTIAL   // walk through the range in order
+};
+
+enum pktgen_order {
+  PKTGEN_IN_ORDER,
+  PKTGEN_REVERSE,
+  PKTGEN_SHUFFLED
+};
+
+/* `count` consecutive values starting with `base` */
+struct pktgen_range {
+  uint32_t base;
+  uint32_t count;
+};
+
+struct pktgen_config {
+  /* relative share of each `enum pktgen_kind` */
+  uint32_t weights[PKTGEN_KIND_COUNT];
+  uint8_t src_mac[6];
+  uint8_t dst_mac[6];
+  /* IPv4 addresses in host byte order, IPv6 uses 2001:db8::<address> */
+  struct pktgen_range src_ip;
+  struct pktgen_range dst_ip;
+  struct pktgen_range src_port;
+  struct pktgen_range dst_port;
+  enum pktgen_dist dist;
+  /* bytes after the ICMP or UDP header */
+  uint32_t min_payload;
+  uint32_t max_payload;
+  /* largest IPv4 packet sent in one piece, larger ones are fragmented */
+  uint32_t mtu;
+  enum pktgen_order frag_order;
+  /* chance in percent of sending a fragment twice */
+  uint32_t frag_dup_pct;
+  /* chance in percent of a train losing one of its fragments */
+  uint32_t frag_missing_pct;
+  /* chance in percent of a packet with a corrupted IPv4 or L4 checksum */
+  uint32_t bad_checksum_pct;
+  /* append the Ethernet frame check sequence */
+  bool crc_trailer;
+  uint64_t seed;
+};
+
+/* the addresses and ports of a single packet */
+struct pktgen_flow {
+  uint8_t src_mac[6];
+  uint8_t dst_mac[6];
+  uint32_t src_ip;
+  uint32_t dst_ip;
+  uint16_t src_port;
+  uint16_t dst_port;
+};
+
+struct pktgen {
+  struct pktgen_config config;
+  uint64_t rng;
+  uint32_t next_value[4];
+  uint16_t next_ident;
+  /* fragment train in progress, `train_next == train_count` when idle */
+  struct pktgen_flow train_flow;
+  uint8_t train_proto;
+  uint8_t train_fill;
+  uint16_t train_ident;
+  uint32_t train_l4_len;
+  uint32_t train_frag_len;
+  bool train_bad_checksum;
+  int train_count;
+  int train_next;
+  uint16_t train[PKTGEN_MAX_TRAIN];
+};
+
+/**
+ * Plain UDP from 192.168.69.2 to 192.168.69.1 port 6969, like the
+ * fixtures in `test_data.h`, with 8 to 64 bytes of payload
+ */
+void pktgen_default_config(struct pktgen_config *config);
+
+/**
+ * returns 0 on success, -1 if `config` is inconsistent
+ */
+int pktgen_init(struct pktgen *gen, const struct pktgen_config *config);
+
+/**
+ * Write the next frame into `frame`, returns its length,
+ * or -1 if it doesn't fit in `max_len` bytes (the frame is skipped)
+ */
+int pktgen_next(struct pktgen *gen, uint8_t *frame, int max_len);
+
+/**
+ * true if the next call returns another fragment of the current train
+ */
+bool pktgen_in_train(const struct pktgen *gen);
+
+/**
+ * Single frame builders, all return the frame length or -1 if it doesn't
+ * fit in `max_len` bytes. `fill` is the first byte of the payload pattern.
+ */
+int pktgen_arp_request(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow);
+int pktgen_icmp_echo(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow, uint16_t ident, int payload_len,
+    uint8_t fill);
+int pktgen_udp(uint8_t *frame, int max_len, const struct pktgen_flow *flow,
+    uint16_t ident, int payload_len, uint8_t fill);
+int pktgen_udp6(uint8_t *frame, int max_len, const struct pktgen_flow *flow,
+    int payload_len, uint8_t fill);
+
+/**
+ * Bytes [offset, offset + len) of an IPv4 payload of `l4_len` bytes, i.e. a
+ * `proto` (ICMP or UDP) header and `l4_len` - 8 bytes of payload pattern.
+ * `offset` must be a multiple of 8, `more` sets the more fragments flag.
+ */
+int pktgen_ipv4_fragment(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow, uint8_t proto, uint16_t ident, int l4_len,
+    int offset, int len, bool more, uint8_t fill);
+
+/**
+ * Bytes [offset, offset + len) of a UDP datagram of `l4_len` bytes over
+ * IPv6, behind a fragment header with `ident`. Same rules as for
+ * `pktgen_ipv4_fragment()`.
+ */
+int pktgen_ipv6_fragment(uint8_t *frame, int max_len,
+    const struct pktgen_flow *flow, uint32_t ident, int l4_len, int offset,
+    int len, bool more, uint8_t fill);
+
+uint16_t pktgen_ipv4_checksum(const uint8_t *header);
+uint32_t pktgen_crc32(const uint8_t *data, int len);
+
+#endif /* PKTGEN_H */
@@ -0,0 +1,117 @@
+use std::sync::atomic::Ordering;
+
+use smoltcp::iface::FragmentedPacket;
+use smoltcp::time::Instant;
+use smoltcp::wire::{Ipv4Address, Ipv6Address};
+
+use clock;
+use stats::ReassemblyStats;
+
+/// Identification, source and destination of a fragmented packet, in full,
+/// so that two packets only share a slot if they are the same
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum FragmentKey {
+    Ipv4(u16, Ipv4Address, Ipv4Address),
+    Ipv6(u32, Ipv6Address, Ipv6Address),
+}
+
+/// What a slot in use holds
+struct Slot {
+    key: FragmentKey,
+    bytes: usize,
+    last_update: Instant,
+}
+
+/// The reassembly slots of a direction. `slots[i]` tells what `packets[i]`
+/// holds, so lookups, occupancy and expiry don't have to guess what a
+/// `FragmentSet` did. A packet is only given a slot that is free, when all
+/// are in use its fragments are dropped until one completes or expires.
+pub struct FragmentSlots {
+    packets: Vec<FragmentedPacket<'static>>,
+    slots: Vec<Option<Slot>>,
+    /// no slot was updated before this, None when all are free. Only
+    /// `expire()` makes it exact again, until then it may be older.
+    oldest: Option<Instant>,
+}
+
+impl FragmentSlots {
+    /// `count` slots of `size` bytes
+    pub fn new(count: usize, size: usize) -> FragmentSlots {
+        FragmentSlots {
+            packets: (0..count).map(|_| FragmentedPacket::new(vec![0; size])).collect(),
+            slots: (0..count).map(|_| None).collect(),
+            oldest: None,
+        }
+    }
+
+    /// Slot of the packet `key`, started in a free slot if it is new,
+    /// None if there is none
+    pub fn get(&mut self, key: FragmentKey, now: Instant, stats: &ReassemblyStats) -> Option<usize> {
+        if let Some(idx) = self.slots.iter().position(|slot| slot.as_ref().map_or(false, |s| s.key == key)) {
+            return Some(idx);
+        }
+        let idx = self.slots.iter().position(|slot| slot.is_none())?;
+        match key {
+            FragmentKey::Ipv4(ident, src_addr, dst_addr) => self.packets[idx].start(ident, src_addr, dst_addr),
+            // the packet only takes an IPv4 key, the slot keeps the full one
+            FragmentKey::Ipv6(ident, _, _) => {
+                self.packets[idx].start(ident as u16, Ipv4Address::UNSPECIFIED, Ipv4Address::UNSPECIFIED)
+            }
+        }
+        self.slots[idx] = Some(Slot {
+            key: key,
+            bytes: 0,
+            last_update: now,
+        });
+        if self.oldest.is_none() {
+            self.oldest = Some(now);
+        }
+        stats.slots.add(1);
+        Some(idx)
+    }
+
+    pub fn packet(&mut self, idx: usize) -> &mut FragmentedPacket<'static> {
+        &mut self.packets[idx]
+    }
+
+    /// `len` bytes of a fragment were added to slot `idx`
+    pub fn added(&mut self, idx: usize, len: usize, now: Instant, stats: &ReassemblyStats) {
+        if let Some(ref mut slot) = self.slots[idx] {
+            slot.bytes += len;
+            slot.last_update = now;
+            stats.bytes.add(len);
+        }
+    }
+
+    /// Free slot `idx`, after reassembly or after an error
+    pub fn release(&mut self, idx: usize, stats: &ReassemblyStats) {
+        if let Some(slot) = self.slots[idx].take() {
+            self.packets[idx].reset();
+            stats.bytes.sub(slot.bytes);
+            stats.slots.sub(1);
+        }
+    }
+
+    /// Free the slots that haven't seen a fragment for `timeout_ms`.
+    /// Only looks at the slots once the oldest of them may have timed out.
+    pub fn expire(&mut self, now: Instant, timeout_ms: u64, stats: &ReassemblyStats) {
+        match self.oldest {
+            Some(oldest) if clock::elapsed_ms(oldest, now) >= timeout_ms => (),
+            _ => return,
+        }
+        let mut oldest = None;
+        for idx in 0..self.slots.len() {
+            let last_update = match self.slots[idx] {
+                Some(ref slot) => slot.last_update,
+                None => continue,
+            };
+            if clock::elapsed_ms(last_update, now) >= timeout_ms {
+                self.release(idx, stats);
+                stats.expired.fetch_add(1, Ordering::Relaxed);
+            } else if oldest.map_or(true, |oldest| last_update < oldest) {
+                oldest = Some(last_update);
+            }
+        }
+        self.oldest = oldest;
+    }
+}
@@ -0,0 +1,196 @@
+/**
+ * Diagnostic interface of rustwall (`libfirewall.a`),
+ * in addition to the Camkes firewall interface
+ */
+#ifndef RUSTWALL_H
+#define RUSTWALL_H
+
+#include <stdint.h>
+
+// Runtime configuration, see `config.rs`
+// `key=value` lines, e.g. "mtu=1500\nmax_enqueued_packets=256\n",
+// `client_mtu` and `ethdriver_mtu` set the MTU of one port, up to 9000,
+// `large_send=1` lets `client_tx()` take whole UDP datagrams of up to
+// `buffer_size` bytes, fragmented to the ethdriver MTU by the firewall,
+// `arp_responder=1` answers ARP requests from the wire for the addresses the
+// client announced in its own ARP, `client_ip=a.b.c.d` adds one up front,
+// `multicast_group=a.b.c.d` adds to the groups learned from the client's
+// IGMP reports, `multicast_filter=0` passes all multicast to the client,
+// `conntrack=1` forwards UDP replies to flows the client opened without
+// `packet_in()` while they are younger than `flow_timeout_ms`,
+// `fast_lane=first-last:streak:sample` lets flows with a port in the range
+// skip the external filter once `streak` datagrams in a row passed it, but
+// for every `sample`th one, until a drop.
+// Built with the `static-memory` feature a configuration also has to fit the
+// static blocks of `SLAB_CLASSES` in `constants.rs`.
+// Call once before the first frame, returns 0 or -1 if invalid or too late.
+extern int32_t firewall_configure(const char *blob, int32_t len);
+
+// Capture ring, see `capture.rs`, off until configured
+#define CAPTURE_OFF 0
+#define CAPTURE_DROPS 1
+#define CAPTURE_SAMPLED 2
+
+#define CAPTURE_PCAP_HEADER_LEN 24
+#define CAPTURE_RECORD_HEADER_LEN 16
+
+extern int32_t firewall_capture_config(uint32_t mode, uint32_t sample_rate);
+extern int32_t firewall_capture_dump(uint8_t *buf, int32_t max_len);
+
+// Shadow filters, see `shadow.rs`
+// Same signatures as `packet_in()` and `packet_in6()`, NULL to leave one out.
+typedef int32_t (*firewall_filter_fn)(uint32_t src_addr, uint16_t src_port,
+    uint32_t dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len);
+typedef int32_t (*firewall_filter6_fn)(const uint8_t *src_addr,
+    uint16_t src_port, const uint8_t *dst_addr, uint16_t dst_port,
+    uint16_t payload_len, uint8_t *payload, uint16_t max_payload_len);
+
+// IPv6 filters of the external firewall, see `utils.rs`
+// `packet_in6()` and `packet_out6()` are registered rather than linked, so
+// that external firewalls without them still link. UDP over IPv6 is dropped
+// until both are registered. Returns 0, or -1 if either is NULL.
+extern int32_t firewall_ipv6_filters(firewall_filter6_fn filter_in6,
+    firewall_filter6_fn filter_out6);
+
+extern int32_t firewall_shadow_config(firewall_filter_fn filter_in,
+    firewall_filter_fn filter_out, firewall_filter6_fn filter_in6,
+    firewall_filter6_fn filter_out6, uint32_t sample_rate);
+
+// Queue, reassembly and heap gauges, see `stats.rs`
+// Keep in sync with `FirewallStats`
+#define STATS_HISTOGRAM_BUCKETS 12
+
+struct firewall_stats {
+  uint64_t packets_rx_depth;
+  uint64_t packets_rx_depth_max;
+  uint64_t packets_rx_bytes;
+  uint64_t packets_rx_bytes_max;
+  uint64_t packets_rx_full_drops;
+  uint64_t packets_tx_depth;
+  uint64_t packets_tx_depth_max;
+  uint64_t packets_tx_bytes;
+  uint64_t packets_tx_bytes_max;
+  uint64_t packets_tx_full_drops;
+  uint64_t fragments_rx_slots;
+  uint64_t fragments_rx_slots_max;
+  uint64_t fragments_rx_bytes;
+  uint64_t fragments_rx_bytes_max;
+  uint64_t fragments_rx_completed;
+  uint64_t fragments_rx_set_full_drops;
+  uint64_t fragments_rx_too_many_drops;
+  uint64_t fragments_rx_expired;
+  uint64_t fragments_tx_slots;
+  uint64_t fragments_tx_slots_max;
+  uint64_t fragments_tx_bytes;
+  uint64_t fragments_tx_bytes_max;
+  uint64_t fragments_tx_completed;
+  uint64_t fragments_tx_set_full_drops;
+  uint64_t fragments_tx_too_many_drops;
+  uint64_t fragments_tx_expired;
+  // ARP requests answered for the client, see `arp.rs`
+  uint64_t arp_replies;
+  // replies the ethdriver didn't take
+  uint64_t arp_reply_failures;
+  // multicast frames for groups the client isn't in, see `mcast.rs`
+  uint64_t multicast_drops;
+  // UDP replies forwarded without `packet_in()`, see `flows.rs`
+  uint64_t flow_replies;
+  // datagrams of trusted flows forwarded without the external filter, the
+  // ones still inspected, and trusted flows distrusted after a drop
+  uint64_t fast_lane_skipped;
+  uint64_t fast_lane_sampled;
+  uint64_t fast_lane_demoted;
+  // datagrams sampled for the shadow filter, the ones only it dropped, the
+  // ones only it passed, and the cycles spent in the live and shadow filters
+  // on them, see `shadow.rs`
+  uint64_t shadow_samples;
+  uint64_t shadow_drops;
+  uint64_t shadow_passes;
+  uint64_t shadow_live_cycles;
+  uint64_t shadow_cycles;
+  // calls and filter calls slower than the watchdog allows, see `watchdog.rs`
+  uint64_t stalls;
+  // only tracked when built with the `alloc-stats` or `static-memory` feature
+  uint64_t heap_bytes;
+  uint64_t heap_bytes_max;
+  uint64_t heap_allocations;
+  // bucket 0 counts an empty queue, bucket i a depth in [2^(i-1), 2^i)
+  uint64_t packets_rx_enqueue_depth[STATS_HISTOGRAM_BUCKETS];
+  uint64_t packets_tx_enqueue_depth[STATS_HISTOGRAM_BUCKETS];
+};
+
+extern int32_t firewall_stats_get(struct firewall_stats *stats);
+extern void firewall_stats_reset_high_water(void);
+
+// Lock statistics, see `LockStats` in `stats.rs`
+// Counters stay at zero unless built with the `lock-stats` feature.
+// Times are in CPU timestamp counter cycles.
+#define FIREWALL_LOCKS 10
+
+struct firewall_lock_stats {
+  const char *name;
+  uint64_t acquisitions;
+  uint64_t contended;
+  uint64_t wait_cycles;
+  uint64_t max_wait_cycles;
+  uint64_t hold_cycles;
+  uint64_t max_hold_cycles;
+};
+
+extern int32_t firewall_lock_stats_get(uint32_t idx,
+    struct firewall_lock_stats *stats);
+
+// Stall watchdog, see `watchdog.rs`
+// Thresholds and times are in CPU timestamp counter cycles, or ticks of the
+// virtual counter on aarch64, 0 turns a threshold off. Configuring returns -1
+// on architectures without either. Directions are 0 for `client_tx()` and 1
+// for `client_rx()`.
+#define STAGE_IDLE 0
+#define STAGE_FETCH 1
+#define STAGE_ETHERNET 2
+#define STAGE_REASSEMBLY 3
+#define STAGE_FILTER 4
+#define STAGE_DISPATCH 5
+
+#define STALL_CALL 0
+#define STALL_FILTER 1
+
+#define WATCHDOG_TRACE_EVENTS 32
+
+struct firewall_trace_event {
+  uint64_t cycles;
+  uint32_t direction;
+  uint32_t stage;
+};
+
+struct firewall_stall {
+  // 1 for the first stall since start
+  uint64_t sequence;
+  uint64_t cycles;
+  uint32_t kind;
+  uint32_t direction;
+  // stage of each direction once the stalled call returned
+  uint32_t stages[2];
+  uint64_t packets_rx_depth;
+  uint64_t packets_tx_depth;
+  uint64_t fragments_rx_slots;
+  uint64_t fragments_tx_slots;
+  // threads holding or waiting for each lock, in the order of
+  // `firewall_lock_stats_get()`, only counted with the `lock-stats` feature
+  uint64_t locks_in_use[FIREWALL_LOCKS];
+  // the last stage changes of both directions, oldest first
+  struct firewall_trace_event trace[WATCHDOG_TRACE_EVENTS];
+};
+
+extern int32_t firewall_watchdog_config(uint64_t call_cycles,
+    uint64_t filter_cycles);
+extern int32_t firewall_stall_get(uint32_t idx, struct firewall_stall *stall);
+
+// Virtual clock, see `clock.rs`
+// Only available when built with the `virtual-clock` feature
+extern void firewall_clock_set_virtual(uint64_t start_ms);
+extern int64_t firewall_clock_advance(uint64_t ms);
+extern uint64_t firewall_clock_now_ms(void);
+
+#endif /* RUSTWALL_H */
@@ -0,0 +1,64 @@
+use std::cell::Cell;
+use std::slice;
+
+/// Bump allocator for the temporaries of one frame, the UDP payload handed
+/// to the external firewall and the packets built from it before they are
+/// copied into frames. Memory comes from a few chunks allocated once and is
+/// all given back at once by `reset()`, after each frame, see `client_rx()`
+/// and `client_tx()`.
+pub struct Arena {
+    chunks: Vec<*mut u8>,
+    chunk_size: usize,
+    /// chunk and offset the next allocation starts at
+    next: Cell<(usize, usize)>,
+}
+
+/// The chunks are owned by the arena, the slices handed out borrow it
+unsafe impl Send for Arena {}
+
+impl Arena {
+    /// `chunks` chunks of `chunk_size` bytes, no allocation can be larger
+    pub fn new(chunks: usize, chunk_size: usize) -> Arena {
+        Arena {
+            chunks: (0..chunks)
+                .map(|_| Box::into_raw(vec![0u8; chunk_size].into_boxed_slice()) as *mut u8)
+                .collect(),
+            chunk_size: chunk_size,
+            next: Cell::new((0, 0)),
+        }
+    }
+
+    /// `len` bytes, left over from earlier frames, None if the arena is full
+    pub fn alloc(&self, len: usize) -> Option<&mut [u8]> {
+        let (mut chunk, mut offset) = self.next.get();
+        if offset + len > self.chunk_size {
+            chunk += 1;
+            offset = 0;
+        }
+        if chunk >= self.chunks.len() || len > self.chunk_size {
+            return None;
+        }
+        self.next.set((chunk, offset + len));
+        Some(unsafe { slice::from_raw_parts_mut(self.chunks[chunk].offset(offset as isize), len) })
+    }
+
+    /// `len` bytes that start with a copy of `data`
+    pub fn copy(&self, data: &[u8], len: usize) -> Option<&mut [u8]> {
+        let buf = self.alloc(len.max(data.len()))?;
+        buf[..data.len()].copy_from_slice(data);
+        Some(buf)
+    }
+
+    /// Give back everything, in O(1)
+    pub fn reset(&mut self) {
+        self.next.set((0, 0));
+    }
+}
+
+impl Drop for Arena {
+    fn drop(&mut self) {
+        for chunk in self.chunks.iter() {
+            drop(unsafe { Box::from_raw(slice::from_raw_parts_mut(*chunk, self.chunk_size)) });
+        }
+    }
+}
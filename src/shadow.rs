@@ -0,0 +1,139 @@
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+
+use smoltcp::wire::IpAddress;
+
+use flows::Role;
+use scratch::Arena;
+use stats;
+use utils;
+
+/// Datagrams given to the shadow filter as well
+pub static SAMPLES: AtomicUsize = AtomicUsize::new(0);
+/// Sampled datagrams the live filter passed and the shadow dropped
+pub static DROPS: AtomicUsize = AtomicUsize::new(0);
+/// Sampled datagrams the live filter dropped and the shadow passed
+pub static PASSES: AtomicUsize = AtomicUsize::new(0);
+/// CPU cycles spent in the live filter on sampled datagrams
+pub static LIVE_CYCLES: AtomicU64 = AtomicU64::new(0);
+/// CPU cycles spent in the shadow filter
+pub static CYCLES: AtomicU64 = AtomicU64::new(0);
+
+type Filter = unsafe extern "C" fn(u32, u16, u32, u16, u16, *mut u8, u16) -> i32;
+type Filter6 = unsafe extern "C" fn(*const u8, u16, *const u8, u16, u16, *mut u8, u16) -> i32;
+
+/// Candidate filter of one direction, with the signature of `packet_in()`
+/// and `packet_in6()`. Datagrams of an address family without one aren't
+/// sampled.
+#[derive(Clone, Copy)]
+pub struct ShadowFilter {
+    f: Option<Filter>,
+    f6: Option<Filter6>,
+}
+
+/// Every `SAMPLE_RATE`th datagram through the external filter, 0 is off
+static SAMPLE_RATE: AtomicUsize = AtomicUsize::new(0);
+static SAMPLE_COUNTER: AtomicUsize = AtomicUsize::new(0);
+
+lazy_static! {
+    /// the filters of `Role::Outbound` and `Role::Inbound`
+    static ref FILTERS: ::spin::Mutex<[ShadowFilter; 2]> =
+        ::spin::Mutex::new([ShadowFilter { f: None, f6: None }; 2]);
+}
+
+/// Evaluate candidate filters next to `packet_in()` and `packet_out()` on
+/// every `sample_rate`th datagram they see, see `process_udp()`. The candidate
+/// gets a copy of the payload and its verdict is only counted, forwarding
+/// follows the live filter. NULL leaves a direction or address family out,
+/// a rate of 0 turns shadowing off. Returns 0 or -1 if nothing to shadow.
+#[no_mangle]
+pub extern "C" fn firewall_shadow_config(
+    filter_in: Option<Filter>,
+    filter_out: Option<Filter>,
+    filter_in6: Option<Filter6>,
+    filter_out6: Option<Filter6>,
+    sample_rate: u32,
+) -> i32 {
+    if sample_rate == 0 {
+        SAMPLE_RATE.store(0, Ordering::Relaxed);
+        return 0;
+    }
+    let filters = [
+        ShadowFilter { f: filter_out, f6: filter_out6 },
+        ShadowFilter { f: filter_in, f6: filter_in6 },
+    ];
+    if filters.iter().all(|filter| filter.f.is_none() && filter.f6.is_none()) {
+        return -1;
+    }
+    *FILTERS.lock() = filters;
+    SAMPLE_RATE.store(sample_rate as usize, Ordering::Relaxed);
+    0
+}
+
+/// The shadow filter of `role` if the next datagram is sampled
+pub fn sample(role: Role) -> Option<ShadowFilter> {
+    let rate = SAMPLE_RATE.load(Ordering::Relaxed);
+    if rate == 0 || SAMPLE_COUNTER.fetch_add(1, Ordering::Relaxed) % rate != 0 {
+        return None;
+    }
+    Some(FILTERS.lock()[role as usize])
+}
+
+/// Run `filter` on a copy of `payload`, the original payload of a datagram
+/// the live filter took `live_cycles` for and `live_passed` or not, and
+/// count where they disagree
+pub fn evaluate(
+    filter: ShadowFilter,
+    src_addr: IpAddress,
+    src_port: u16,
+    dst_addr: IpAddress,
+    dst_port: u16,
+    payload: &[u8],
+    max_payload_len: usize,
+    live_passed: bool,
+    live_cycles: u64,
+    scratch: &Arena,
+) {
+    let data = match scratch.copy(payload, max_payload_len) {
+        Some(data) => data,
+        None => return,
+    };
+    let start = stats::cycles();
+    let payload_len = match (src_addr, dst_addr, filter.f, filter.f6) {
+        (IpAddress::Ipv4(src), IpAddress::Ipv4(dst), Some(f), _) => unsafe {
+            f(
+                utils::ipv4_word(&src),
+                src_port,
+                utils::ipv4_word(&dst),
+                dst_port,
+                payload.len() as u16,
+                data.as_mut_ptr(),
+                data.len() as u16,
+            )
+        },
+        (IpAddress::Ipv6(src), IpAddress::Ipv6(dst), _, Some(f6)) => unsafe {
+            f6(
+                src.as_bytes().as_ptr(),
+                src_port,
+                dst.as_bytes().as_ptr(),
+                dst_port,
+                payload.len() as u16,
+                data.as_mut_ptr(),
+                data.len() as u16,
+            )
+        },
+        _ => return,
+    };
+    let cycles = stats::cycles().wrapping_sub(start);
+
+    SAMPLES.fetch_add(1, Ordering::Relaxed);
+    LIVE_CYCLES.fetch_add(live_cycles, Ordering::Relaxed);
+    CYCLES.fetch_add(cycles, Ordering::Relaxed);
+    let passed = payload_len > 0 && payload_len as usize <= data.len();
+    if live_passed && !passed {
+        debug_print!("Firewall shadow: {}:{} dropped by the shadow only", dst_addr, dst_port);
+        DROPS.fetch_add(1, Ordering::Relaxed);
+    } else if passed && !live_passed {
+        debug_print!("Firewall shadow: {}:{} passed by the shadow only", dst_addr, dst_port);
+        PASSES.fetch_add(1, Ordering::Relaxed);
+    }
+}
@@ -0,0 +1,270 @@
+/**
+ * Deterministic simulation against the virtual clock
+ *
+ * Needs a firewall built with the `virtual-clock` feature (see `clock.rs`):
+ * time only moves when the harness calls `firewall_clock_advance()`, so
+ * hours of simulated traffic run in seconds and every run is identical.
+ *
+ * expiry: every second a complete fragment train goes through each
+ *   direction, and every 10 seconds a train that misses a fragment. The
+ *   abandoned packets have to expire after `FRAGMENT_TIMEOUT_MS`, so that
+ *   reassembly slots, reassembly bytes and the heap return to where they
+ *   were after the warm-up once the traffic stops.
+ * queue: `FRAMES_PER_MS` frames arrive every millisecond and the client calls
+ *   `client_rx()` a fixed number of times per millisecond. Reports how long
+ *   frames waited in the RX queue, in simulated time.
+ *
+ * Usage: sim [simulated hours] [client_rx calls per ms]
+ * Exits with 1 if any check failed.
+ */
+#include "bench_glue.h"
+#include "rustwall.h"
+#include "pktgen.h"
+#include <inttypes.h>
+
+#define DEFAULT_HOURS 4
+#define DEFAULT_BUDGET 2
+#define MAX_BUDGET 64
+#define MAX_FRAME_LEN 1514
+
+/* keep in sync with `FRAGMENT_TIMEOUT_MS` in `constants.rs` */
+#define FRAGMENT_TIMEOUT_MS 30000
+#define SUPPORTED_FRAGMENTS 10
+
+#define EXPIRY_TICK_MS 100
+#define TRAIN_INTERVAL_MS 1000
+#define ABANDON_INTERVAL_MS 10000
+#define WARMUP_MS (2 * 60 * 1000)
+/* growth of the heap after the run that is not counted as a leak */
+#define HEAP_TOLERANCE 4096
+
+#define QUEUE_MS (10 * 60 * 1000)
+/* frames `simulate_queue()` hands to the ethdriver per simulated ms */
+#define FRAMES_PER_MS 1
+/* `bench_inject_rx()` holds a single frame until the next `client_rx()` */
+_Static_assert(FRAMES_PER_MS == 1, "the ethdriver mock holds one frame");
+#define QUEUE_P99_LIMIT_MS 2
+/* frames that can wait in `PACKETS_RX`, `MAX_ENQUEUED_PACKETS` */
+#define MAX_QUEUED 1024
+
+static uint8_t frame[MAX_FRAME_LEN];
+static int failed = 0;
+
+static void check(const char *name, bool ok)
+{
+  printf("SIM: %-48s %s\n", name, ok ? "OK" : "FAILED");
+  failed += !ok;
+}
+
+/**
+ * Send the next packet of `gen`, all of its fragments if it has any
+ */
+static void send_packet(struct pktgen *gen, bool tx)
+{
+  do {
+    int len = pktgen_next(gen, frame, sizeof(frame));
+    if (len < 0) {
+      continue;
+    }
+    if (tx) {
+      bench_client_tx(frame, len);
+    } else {
+      bench_inject_rx(frame, len);
+      bench_client_rx_drain();
+    }
+  } while (pktgen_in_train(gen));
+}
+
+struct expiry_traffic {
+  struct pktgen complete;
+  struct pktgen abandoned;
+  uint64_t complete_sent;
+  uint64_t abandoned_sent;
+};
+
+static void run_expiry_traffic(struct expiry_traffic *t, uint64_t ms,
+    bool traffic)
+{
+  uint64_t end = firewall_clock_now_ms() + ms;
+  while (firewall_clock_now_ms() < end) {
+    uint64_t now = firewall_clock_now_ms();
+    if (traffic && (now % TRAIN_INTERVAL_MS == 0)) {
+      send_packet(&t->complete, true);
+      send_packet(&t->complete, false);
+      t->complete_sent++;
+    }
+    if (traffic && (now % ABANDON_INTERVAL_MS == 0)) {
+      send_packet(&t->abandoned, true);
+      send_packet(&t->abandoned, false);
+      t->abandoned_sent++;
+    }
+    firewall_clock_advance(EXPIRY_TICK_MS);
+  }
+}
+
+static void simulate_expiry(int hours)
+{
+  static struct expiry_traffic t;
+  struct pktgen_config config;
+  struct firewall_stats start, peak, end;
+
+  // 2 to 3 fragments per packet, the abandoned ones from their own address
+  // so that they never share an ident with a complete one
+  pktgen_default_config(&config);
+  config.min_payload = 1600;
+  config.max_payload = 3000;
+  config.frag_order = PKTGEN_SHUFFLED;
+  pktgen_init(&t.complete, &config);
+  config.src_ip.base++;
+  config.frag_missing_pct = 100;
+  pktgen_init(&t.abandoned, &config);
+
+  printf("expiry: %d simulated hours\n", hours);
+  run_expiry_traffic(&t, WARMUP_MS, true);
+  run_expiry_traffic(&t, FRAGMENT_TIMEOUT_MS + EXPIRY_TICK_MS, false);
+  firewall_stats_get(&start);
+  firewall_stats_reset_high_water();
+
+  run_expiry_traffic(&t, (uint64_t) hours * 3600 * 1000, true);
+  firewall_stats_get(&peak);
+  run_expiry_traffic(&t, FRAGMENT_TIMEOUT_MS + EXPIRY_TICK_MS, false);
+  firewall_stats_get(&end);
+
+  uint64_t slots_limit = FRAGMENT_TIMEOUT_MS / ABANDON_INTERVAL_MS + 2;
+  printf("expiry: %" PRIu64 " complete and %" PRIu64 " abandoned packets "
+      "per direction, at most %" PRIu64 " / %" PRIu64 " slots in use\n",
+      t.complete_sent, t.abandoned_sent, peak.fragments_rx_slots_max,
+      peak.fragments_tx_slots_max);
+  check("expiry: slots in use stay bounded",
+      (peak.fragments_rx_slots_max <= slots_limit)
+          && (peak.fragments_tx_slots_max <= slots_limit));
+  check("expiry: every abandoned packet expired",
+      (end.fragments_rx_expired == t.abandoned_sent)
+          && (end.fragments_tx_expired == t.abandoned_sent));
+  check("expiry: every complete packet reassembled",
+      (end.fragments_rx_completed == t.complete_sent)
+          && (end.fragments_tx_completed == t.complete_sent));
+  check("expiry: no packet turned away for lack of a slot",
+      (end.fragments_rx_set_full_drops == 0)
+          && (end.fragments_tx_set_full_drops == 0));
+  check("expiry: reassembly memory reclaimed",
+      (end.fragments_rx_slots == 0) && (end.fragments_tx_slots == 0)
+          && (end.fragments_rx_bytes == 0) && (end.fragments_tx_bytes == 0));
+  // without the counting allocator both are 0
+  printf("expiry: heap %" PRIu64 " bytes after warm-up, %" PRIu64
+      " bytes after the run\n", start.heap_bytes, end.heap_bytes);
+  check("expiry: heap back to its size after warm-up",
+      end.heap_bytes <= start.heap_bytes + HEAP_TOLERANCE);
+}
+
+/**
+ * `client_rx()` once, returns true if a frame was handed to the client.
+ * The times at which frames entered the queue are kept in `queued_at`,
+ * the frames leave it in the same order.
+ */
+static uint64_t queued_at[MAX_QUEUED];
+static int queue_head = 0;
+static int queue_len = 0;
+
+static bool queue_rx(uint64_t now, uint64_t *latency)
+{
+  struct firewall_stats before, after;
+  int len;
+  firewall_stats_get(&before);
+  int ret = client_rx(&len);
+  firewall_stats_get(&after);
+
+  bool delivered = (ret != -1);
+  int added = (int) (after.packets_rx_depth + delivered
+      - before.packets_rx_depth);
+  for (int i = 0; (i < added) && (queue_len < MAX_QUEUED); i++) {
+    queued_at[(queue_head + queue_len++) % MAX_QUEUED] = now;
+  }
+  if (delivered && (queue_len > 0)) {
+    *latency = now - queued_at[queue_head];
+    queue_head = (queue_head + 1) % MAX_QUEUED;
+    queue_len--;
+  }
+  return delivered;
+}
+
+static void simulate_queue(int budget)
+{
+  static struct pktgen gen;
+  struct pktgen_config config;
+  struct firewall_stats stats;
+
+  // mostly single frames, some trains that come out as bursts
+  pktgen_default_config(&config);
+  config.src_port.count = 1024;
+  config.max_payload = 4000;
+  pktgen_init(&gen, &config);
+
+  // the client can't take more frames than arrive, plus what was queued
+  size_t capacity = (size_t) QUEUE_MS * ((budget < FRAMES_PER_MS) ? budget
+      : FRAMES_PER_MS) + MAX_QUEUED;
+  uint64_t *latencies = malloc(capacity * sizeof(uint64_t));
+  if (latencies == NULL) {
+    printf("Out of memory\n");
+    exit(1);
+  }
+  size_t count = 0;
+  uint64_t full_drops = 0;
+  firewall_stats_get(&stats);
+  full_drops = stats.packets_rx_full_drops;
+
+  printf("\nqueue: %d simulated minutes, %d client_rx calls per ms\n",
+      QUEUE_MS / 60000, budget);
+  uint64_t end = firewall_clock_now_ms() + QUEUE_MS;
+  while (firewall_clock_now_ms() < end) {
+    uint64_t now = firewall_clock_now_ms();
+    for (int i = 0; i < FRAMES_PER_MS; i++) {
+      int len = pktgen_next(&gen, frame, sizeof(frame));
+      if (len >= 0) {
+        bench_inject_rx(frame, len);
+      }
+    }
+    for (int i = 0; (i < budget) && (count < capacity); i++) {
+      if (!queue_rx(now, &latencies[count])) {
+        break;
+      }
+      count++;
+    }
+    firewall_clock_advance(1);
+  }
+  firewall_stats_get(&stats);
+  full_drops = stats.packets_rx_full_drops - full_drops;
+
+  bench_sort(latencies, count);
+  uint64_t p99 = bench_percentile(latencies, count, 99);
+  printf("queue: %zu frames, waited p50 %" PRIu64 " ms, p99 %" PRIu64
+      " ms, max %" PRIu64 " ms, %" PRIu64 " still queued, %" PRIu64
+      " dropped on a full queue\n", count, bench_percentile(latencies,
+      count, 50), p99, count ? latencies[count - 1] : 0,
+      stats.packets_rx_depth, full_drops);
+  check("queue: p99 queue latency within the limit",
+      p99 <= QUEUE_P99_LIMIT_MS);
+  check("queue: no frame dropped on a full queue", full_drops == 0);
+  free(latencies);
+
+  // leave nothing behind
+  bench_client_rx_drain();
+}
+
+int main(int argc, char **argv)
+{
+  int hours = (argc > 1) ? atoi(argv[1]) : DEFAULT_HOURS;
+  int budget = (argc > 2) ? atoi(argv[2]) : DEFAULT_BUDGET;
+  if ((hours <= 0) || (budget <= 0) || (budget > MAX_BUDGET)) {
+    printf("Usage: %s [simulated hours] [client_rx calls per ms]\n",
+        argv[0]);
+    exit(1);
+  }
+
+  firewall_clock_set_virtual(0);
+  uint64_t start = bench_now_ns();
+  simulate_expiry(hours);
+  simulate_queue(budget);
+  printf("\nSIM: %.1f s of wall time\n", (bench_now_ns() - start) / 1e9);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+use std::alloc::{GlobalAlloc, Layout};
+use std::cell::UnsafeCell;
+use std::mem;
+use std::ptr;
+use std::sync::atomic::{AtomicBool, Ordering};
+
+use config::FirewallConfig;
+use constants::{self, SLAB_CLASSES};
+use stats;
+
+/// Every block of every class, one class after the other
+#[repr(C, align(64))]
+struct Arena(UnsafeCell<[u8; constants::SLAB_BYTES]>);
+
+/// Blocks are only handed out by `SlabAllocator`
+unsafe impl Sync for Arena {}
+
+static ARENA: Arena = Arena(UnsafeCell::new([0; constants::SLAB_BYTES]));
+
+/// Free blocks of a class. A freed block holds the address of the next free
+/// one in its first word, blocks past `bump` were never handed out.
+#[derive(Clone, Copy)]
+struct FreeList {
+    head: usize,
+    bump: usize,
+}
+
+/// The allocator of the `static-memory` feature. It hands out the blocks of
+/// `SLAB_CLASSES` from a static arena, each allocation takes the smallest
+/// block it fits, in a fixed number of steps. When that class ran out it
+/// takes a block of the next larger one. Nothing is ever taken from the
+/// system or the CAmkES heap, when no larger class is left the allocation
+/// fails. `fits()` checks that a configuration can't get there.
+pub struct SlabAllocator {
+    lock: AtomicBool,
+    lists: UnsafeCell<[FreeList; constants::SLAB_CLASS_COUNT]>,
+}
+
+/// The lists are only touched with `lock` held
+unsafe impl Sync for SlabAllocator {}
+
+impl SlabAllocator {
+    const fn new() -> SlabAllocator {
+        SlabAllocator {
+            lock: AtomicBool::new(false),
+            lists: UnsafeCell::new([FreeList { head: 0, bump: 0 }; constants::SLAB_CLASS_COUNT]),
+        }
+    }
+
+    /// Run `f` on the free list of `class` with the lock held.
+    /// A spinlock, the allocator can't wait on a lock that may allocate.
+    fn with_list<R, F: FnOnce(&mut FreeList) -> R>(&self, class: usize, f: F) -> R {
+        while self.lock.compare_exchange_weak(false, true, Ordering::Acquire, Ordering::Relaxed).is_err() {
+            while self.lock.load(Ordering::Relaxed) {}
+        }
+        let ret = f(unsafe { &mut (*self.lists.get())[class] });
+        self.lock.store(false, Ordering::Release);
+        ret
+    }
+}
+
+/// Index of the smallest class `layout` fits in
+fn class_of(layout: &Layout) -> Option<usize> {
+    if layout.align() > constants::SLAB_ALIGN {
+        return None;
+    }
+    SLAB_CLASSES.iter().position(|&(block, _)| layout.size() <= block)
+}
+
+/// Address of the first block of `class`
+fn class_base(class: usize) -> usize {
+    let offset: usize = SLAB_CLASSES[..class].iter().map(|&(block, count)| block * count).sum();
+    ARENA.0.get() as usize + offset
+}
+
+/// Class of the block at `ptr`, which need not be the class of its layout
+fn class_at(ptr: *mut u8) -> usize {
+    (1..constants::SLAB_CLASS_COUNT)
+        .take_while(|&class| ptr as usize >= class_base(class))
+        .last()
+        .unwrap_or(0)
+}
+
+unsafe impl GlobalAlloc for SlabAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let first = match class_of(&layout) {
+            Some(class) => class,
+            None => return ptr::null_mut(),
+        };
+        let mut ptr = ptr::null_mut();
+        for class in first..constants::SLAB_CLASS_COUNT {
+            let (block, count) = SLAB_CLASSES[class];
+            ptr = self.with_list(class, |list| {
+                if list.head != 0 {
+                    let ptr = list.head;
+                    list.head = *(ptr as *const usize);
+                    ptr
+                } else if list.bump < count {
+                    list.bump += 1;
+                    class_base(class) + (list.bump - 1) * block
+                } else {
+                    0
+                }
+            }) as *mut u8;
+            if !ptr.is_null() {
+                break;
+            }
+        }
+        if !ptr.is_null() {
+            stats::HEAP_BYTES.add(layout.size());
+            stats::HEAP_ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        }
+        ptr
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        self.with_list(class_at(ptr), |list| {
+            *(ptr as *mut usize) = list.head;
+            list.head = ptr as usize;
+        });
+        stats::HEAP_BYTES.sub(layout.size());
+    }
+
+    /// Stays in the block as long as the new size prefers the same class,
+    /// the block is at least that large
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let new_layout = Layout::from_size_align_unchecked(new_size, layout.align());
+        if class_of(&new_layout) == class_of(&layout) {
+            stats::HEAP_BYTES.sub(layout.size());
+            stats::HEAP_BYTES.add(new_size);
+            return ptr;
+        }
+        let new_ptr = self.alloc(new_layout);
+        if !new_ptr.is_null() {
+            ptr::copy_nonoverlapping(ptr, new_ptr, layout.size().min(new_size));
+            self.dealloc(ptr, layout);
+        }
+        new_ptr
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: SlabAllocator = SlabAllocator::new();
+
+/// Does the worst case of `config` fit the slabs? Every reassembly slot and
+/// scratch chunk keeps a block for its whole life, so do the flow tables,
+/// both queues and every frame they can hold. On top of that each class
+/// keeps `SLAB_SPARE_BLOCKS` for the packets being processed.
+/// Queued frames are budgeted at their largest size, smaller ones that
+/// run their class out continue in the larger classes, see `alloc()`.
+pub fn fits(config: &FirewallConfig) -> bool {
+    let frame_len = constants::ETHERNET_FRAME_PAYLOAD + config.max_mtu() + constants::ETH_CRC_LEN;
+    let flow_table = if config.conntrack { (::flows::table_bytes(), 1) } else { (0, 0) };
+    let lane_table = if config.fast_lanes.is_empty() { (0, 0) } else { (::flows::table_bytes(), 1) };
+    // (size, blocks) of both directions
+    let demands = [
+        (config.max_reassembled_fragment_size, 2 * (config.supported_fragments + constants::SCRATCH_CHUNKS)),
+        (config.max_enqueued_packets * mem::size_of::<Vec<u8>>(), 2),
+        (frame_len, 2 * config.max_enqueued_packets),
+        // a frame from the client with large send, only while it's processed
+        (config.buffer_size, 0),
+        flow_table,
+        lane_table,
+    ];
+    let mut needed = [constants::SLAB_SPARE_BLOCKS; constants::SLAB_CLASS_COUNT];
+    for &(size, blocks) in demands.iter() {
+        match class_of(&Layout::from_size_align(size, 1).unwrap()) {
+            Some(class) => needed[class] += blocks,
+            None => return false,
+        }
+    }
+    needed.iter().zip(SLAB_CLASSES.iter()).all(|(blocks, &(_, count))| *blocks <= count)
+}
@@ -0,0 +1,280 @@
+/**
+ * Soak test
+ *
+ * Forwards a mixed workload through both directions of the firewall for a
+ * long time: plain UDP, ICMP, ARP, complete fragment trains, abandoned
+ * fragments that never complete, and UDP dropped by the external firewall.
+ * Every few seconds it samples the process RSS, the heap gauges (built with
+ * the `alloc-stats` feature), the queue depths and the reassembly
+ * occupancy. At the end it fails if any of them trended upward after the
+ * warm-up, which is how slow leaks show up.
+ *
+ * Usage: soak [seconds] [sample interval seconds]
+ */
+#include "bench_glue.h"
+#include "rustwall.h"
+#include "test_data.h"
+#include "pktgen.h"
+#include <inttypes.h>
+#include <unistd.h>
+
+#define DEFAULT_SECONDS (4 * 3600)
+#define DEFAULT_INTERVAL 10
+/* samples taken before the firewall reached its steady state */
+#define WARMUP_FRACTION 0.1
+#define MIN_TREND_SAMPLES 8
+
+#define UDP_OFFSET (PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV4_HEADER_LEN)
+#define UDP_DST_PORT_OFFSET (UDP_OFFSET + 2)
+#define UDP_CHECKSUM_OFFSET (UDP_OFFSET + 6)
+
+enum metric {
+  RSS,
+  HEAP_BYTES,
+  PACKETS_RX_DEPTH,
+  PACKETS_TX_DEPTH,
+  FRAGMENTS_RX_SLOTS,
+  FRAGMENTS_TX_SLOTS,
+  FRAGMENTS_RX_BYTES,
+  FRAGMENTS_TX_BYTES,
+  METRIC_COUNT
+};
+
+struct metric_info {
+  const char *name;
+  /* growth ignored between the two halves of the run */
+  uint64_t tolerance;
+};
+
+static const struct metric_info metrics[METRIC_COUNT] = {
+  [RSS] = { "rss", 1024 * 1024 },
+  [HEAP_BYTES] = { "heap bytes", 4096 },
+  [PACKETS_RX_DEPTH] = { "packets_rx depth", 0 },
+  [PACKETS_TX_DEPTH] = { "packets_tx depth", 0 },
+  [FRAGMENTS_RX_SLOTS] = { "fragments_rx slots", 0 },
+  [FRAGMENTS_TX_SLOTS] = { "fragments_tx slots", 0 },
+  [FRAGMENTS_RX_BYTES] = { "fragments_rx bytes", 0 },
+  [FRAGMENTS_TX_BYTES] = { "fragments_tx bytes", 0 },
+};
+
+struct sample {
+  uint64_t values[METRIC_COUNT];
+};
+
+static uint8_t udp_drop_rx[sizeof(packet_bytes_udp_1)];
+static uint8_t udp_drop_tx[sizeof(packet_bytes_udp_1)];
+static uint8_t abandoned_frag[sizeof(packet_bytes_udp_frag1)];
+
+/**
+ * Copy of `packet_bytes_udp_1` sent to `port`, without UDP checksum
+ */
+static void make_udp_drop(uint8_t *frame, uint16_t port)
+{
+  memcpy(frame, packet_bytes_udp_1, sizeof(packet_bytes_udp_1));
+  frame[UDP_DST_PORT_OFFSET] = port >> 8;
+  frame[UDP_DST_PORT_OFFSET + 1] = port & 0xff;
+  frame[UDP_CHECKSUM_OFFSET] = 0;
+  frame[UDP_CHECKSUM_OFFSET + 1] = 0;
+}
+
+/**
+ * Turn `abandoned_frag` into the first fragment of a new packet `ident`,
+ * the rest of which will never arrive
+ */
+static void set_abandoned_ident(uint16_t ident)
+{
+  uint8_t *ip = abandoned_frag + PKTGEN_ETH_HEADER_LEN;
+  ip[4] = ident >> 8;
+  ip[5] = ident & 0xff;
+  ip[10] = 0;
+  ip[11] = 0;
+  uint16_t checksum = pktgen_ipv4_checksum(ip);
+  ip[10] = checksum >> 8;
+  ip[11] = checksum & 0xff;
+}
+
+static void rx(const uint8_t *frame, int len)
+{
+  bench_inject_rx(frame, len);
+  bench_client_rx_drain();
+}
+
+/**
+ * One round of the workload in both directions
+ */
+static void run_round(uint64_t round)
+{
+  bench_client_tx(packet_bytes_udp_1, sizeof(packet_bytes_udp_1));
+  bench_client_tx(packet_bytes_ping, sizeof(packet_bytes_ping));
+  bench_client_tx(udp_drop_tx, sizeof(udp_drop_tx));
+  bench_client_tx(packet_bytes_udp_frag1, sizeof(packet_bytes_udp_frag1));
+  bench_client_tx(packet_bytes_udp_frag2, sizeof(packet_bytes_udp_frag2));
+  bench_client_tx(packet_bytes_udp_frag3, sizeof(packet_bytes_udp_frag3));
+
+  rx(packet_bytes_udp_1, sizeof(packet_bytes_udp_1));
+  rx(packet_bytes_ping, sizeof(packet_bytes_ping));
+  rx(packet_bytes_arp, sizeof(packet_bytes_arp));
+  rx(udp_drop_rx, sizeof(udp_drop_rx));
+  rx(packet_bytes_udp_frag_5k_1, sizeof(packet_bytes_udp_frag_5k_1));
+  rx(packet_bytes_udp_frag_5k_3, sizeof(packet_bytes_udp_frag_5k_3));
+  rx(packet_bytes_udp_frag_5k_2, sizeof(packet_bytes_udp_frag_5k_2));
+  rx(packet_bytes_udp_frag_5k_4, sizeof(packet_bytes_udp_frag_5k_4));
+
+  // every 16th round leaves a fragment behind in each direction
+  if ((round % 16) == 0) {
+    set_abandoned_ident(0x8000 | ((round / 16) & 0x7fff));
+    bench_client_tx(abandoned_frag, sizeof(abandoned_frag));
+    rx(abandoned_frag, sizeof(abandoned_frag));
+  }
+}
+
+static uint64_t read_rss(void)
+{
+  unsigned long size, resident;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL) {
+    return 0;
+  }
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(f);
+  return (uint64_t) resident * sysconf(_SC_PAGESIZE);
+}
+
+static void take_sample(struct sample *s)
+{
+  struct firewall_stats stats;
+  firewall_stats_get(&stats);
+  s->values[RSS] = read_rss();
+  s->values[HEAP_BYTES] = stats.heap_bytes;
+  s->values[PACKETS_RX_DEPTH] = stats.packets_rx_depth;
+  s->values[PACKETS_TX_DEPTH] = stats.packets_tx_depth;
+  s->values[FRAGMENTS_RX_SLOTS] = stats.fragments_rx_slots;
+  s->values[FRAGMENTS_TX_SLOTS] = stats.fragments_tx_slots;
+  s->values[FRAGMENTS_RX_BYTES] = stats.fragments_rx_bytes;
+  s->values[FRAGMENTS_TX_BYTES] = stats.fragments_tx_bytes;
+}
+
+/**
+ * Number of samples judged for trends out of `count`, the ones after warm-up
+ */
+static int trend_samples(int count, int *first)
+{
+  *first = (int) (count * WARMUP_FRACTION);
+  *first = (*first < 1) ? 1 : *first;
+  return count - *first;
+}
+
+/**
+ * A metric trends upward if the second half of the run reached a higher
+ * maximum than the first one, beyond the tolerance, and the least squares
+ * slope over the whole run is positive. Comparing maxima keeps bounded
+ * but noisy gauges (e.g. reassembly bytes) from triggering on their own.
+ */
+static bool trends_upward(const struct sample *samples, int first, int count,
+    int m, double *slope)
+{
+  int half = first + count / 2;
+  uint64_t first_max = 0, second_max = 0;
+  double sum_x = 0, sum_y = 0, sum_xy = 0, sum_xx = 0;
+
+  for (int i = first; i < first + count; i++) {
+    uint64_t v = samples[i].values[m];
+    if (i < half) {
+      first_max = (v > first_max) ? v : first_max;
+    } else {
+      second_max = (v > second_max) ? v : second_max;
+    }
+    sum_x += i;
+    sum_y += v;
+    sum_xy += (double) i * v;
+    sum_xx += (double) i * i;
+  }
+  *slope = (count * sum_xy - sum_x * sum_y) / (count * sum_xx - sum_x * sum_x);
+  return (second_max > first_max + metrics[m].tolerance) && (*slope > 0);
+}
+
+int main(int argc, char **argv)
+{
+  int seconds = (argc > 1) ? atoi(argv[1]) : DEFAULT_SECONDS;
+  int interval = (argc > 2) ? atoi(argv[2]) : DEFAULT_INTERVAL;
+  if ((seconds <= 0) || (interval <= 0) || (interval > seconds)) {
+    printf("Usage: %s [seconds] [sample interval seconds]\n", argv[0]);
+    exit(1);
+  }
+
+  int max_samples = seconds / interval + 1;
+  int first;
+  if (trend_samples(max_samples, &first) < MIN_TREND_SAMPLES) {
+    printf("%d seconds sampled every %d seconds leave fewer than %d samples "
+        "after warm-up to judge trends\n", seconds, interval,
+        MIN_TREND_SAMPLES);
+    exit(1);
+  }
+  struct sample *samples = malloc(max_samples * sizeof(struct sample));
+  if (samples == NULL) {
+    printf("Out of memory\n");
+    exit(1);
+  }
+
+  make_udp_drop(udp_drop_rx, 6968);
+  make_udp_drop(udp_drop_tx, 6966);
+  memcpy(abandoned_frag, packet_bytes_udp_frag1, sizeof(abandoned_frag));
+
+  printf("%8s %12s %10s %12s %12s %8s %8s %8s %8s %10s %10s\n", "seconds",
+      "rounds", "rss", "heap bytes", "heap allocs", "rx depth", "tx depth",
+      "rx slots", "tx slots", "rx bytes", "tx bytes");
+
+  uint64_t start = bench_now_ns();
+  uint64_t end = start + (uint64_t) seconds * 1000000000ull;
+  uint64_t next_sample = start;
+  uint64_t round = 0;
+  int count = 0;
+  while (count < max_samples) {
+    uint64_t now = bench_now_ns();
+    if (now >= next_sample) {
+      struct sample *s = &samples[count];
+      struct firewall_stats stats;
+      take_sample(s);
+      firewall_stats_get(&stats);
+      printf("%8" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 " %12"
+          PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10"
+          PRIu64 " %10" PRIu64 "\n", (uint64_t) ((now - start) / 1000000000),
+          round, s->values[RSS], s->values[HEAP_BYTES], stats.heap_allocations,
+          s->values[PACKETS_RX_DEPTH], s->values[PACKETS_TX_DEPTH],
+          s->values[FRAGMENTS_RX_SLOTS], s->values[FRAGMENTS_TX_SLOTS],
+          s->values[FRAGMENTS_RX_BYTES], s->values[FRAGMENTS_TX_BYTES]);
+      fflush(stdout);
+      count++;
+      next_sample += (uint64_t) interval * 1000000000ull;
+      if (next_sample > end) {
+        break;
+      }
+    }
+    run_round(round++);
+  }
+
+  // the last sample can fall past the end of the run and be missed
+  int judged = trend_samples(count, &first);
+  if (judged < MIN_TREND_SAMPLES) {
+    printf("\nSOAK: only %d samples after warm-up, need %d to judge trends\n",
+        judged, MIN_TREND_SAMPLES);
+    free(samples);
+    return 1;
+  }
+
+  int failed = 0;
+  printf("\n");
+  for (int m = 0; m < METRIC_COUNT; m++) {
+    double slope;
+    bool upward = trends_upward(samples, first, judged, m, &slope);
+    printf("SOAK: %-20s %10" PRIu64 " -> %10" PRIu64
+        ", slope %12.2f/sample: %s\n",
+        metrics[m].name, samples[first].values[m],
+        samples[count - 1].values[m], slope, upward ? "FAILED" : "OK");
+    failed += upward;
+  }
+  free(samples);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,497 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use constants;
+
+/// A value that goes up and down, together with its high-water mark
+pub struct Gauge {
+    value: AtomicUsize,
+    high: AtomicUsize,
+}
+
+impl Gauge {
+    pub const fn new() -> Gauge {
+        Gauge {
+            value: AtomicUsize::new(0),
+            high: AtomicUsize::new(0),
+        }
+    }
+
+    pub fn get(&self) -> usize {
+        self.value.load(Ordering::Relaxed)
+    }
+
+    pub fn high(&self) -> usize {
+        self.high.load(Ordering::Relaxed)
+    }
+
+    pub fn set(&self, val: usize) {
+        self.value.store(val, Ordering::Relaxed);
+        self.update_high(val);
+    }
+
+    pub fn add(&self, val: usize) {
+        let new = self.value.fetch_add(val, Ordering::Relaxed) + val;
+        self.update_high(new);
+    }
+
+    pub fn sub(&self, val: usize) {
+        self.value.fetch_sub(val, Ordering::Relaxed);
+    }
+
+    /// Restart the high-water mark from the current value
+    pub fn reset_high(&self) {
+        self.high.store(self.get(), Ordering::Relaxed);
+    }
+
+    fn update_high(&self, val: usize) {
+        store_max(&self.high, val);
+    }
+}
+
+/// Raise `atomic` to `val` unless it is already larger
+fn store_max(atomic: &AtomicUsize, val: usize) {
+    let mut current = atomic.load(Ordering::Relaxed);
+    while val > current {
+        match atomic.compare_exchange_weak(current, val, Ordering::Relaxed, Ordering::Relaxed) {
+            Ok(_) => break,
+            Err(c) => current = c,
+        }
+    }
+}
+
+/// Is there a counter behind `cycles()`?
+pub const HAS_CYCLES: bool = cfg!(any(target_arch = "x86", target_arch = "x86_64", target_arch = "aarch64"));
+
+/// CPU timestamp counter, used to time short sections of code.
+/// On aarch64 the virtual counter of the generic timer, which ticks at the
+/// frequency of `cntfrq_el0` rather than the CPU clock.
+/// Returns 0 on architectures where we don't have one, see `HAS_CYCLES`.
+#[cfg(target_arch = "x86_64")]
+pub fn cycles() -> u64 {
+    unsafe { ::std::arch::x86_64::_rdtsc() }
+}
+
+#[cfg(target_arch = "x86")]
+pub fn cycles() -> u64 {
+    unsafe { ::std::arch::x86::_rdtsc() }
+}
+
+#[cfg(target_arch = "aarch64")]
+pub fn cycles() -> u64 {
+    let counter: u64;
+    unsafe { ::std::arch::asm!("mrs {}, cntvct_el0", out(reg) counter, options(nomem, nostack)) };
+    counter
+}
+
+#[cfg(not(any(target_arch = "x86", target_arch = "x86_64", target_arch = "aarch64")))]
+pub fn cycles() -> u64 {
+    0
+}
+
+/// Log2 histogram, bucket 0 counts zeros, bucket `i` counts values in [2^(i-1), 2^i),
+/// the last bucket also counts everything above
+pub struct Histogram {
+    buckets: Vec<AtomicUsize>,
+}
+
+impl Histogram {
+    pub fn new() -> Histogram {
+        let mut buckets = Vec::with_capacity(constants::STATS_HISTOGRAM_BUCKETS);
+        for _idx in 0..constants::STATS_HISTOGRAM_BUCKETS {
+            buckets.push(AtomicUsize::new(0));
+        }
+        Histogram { buckets: buckets }
+    }
+
+    pub fn record(&self, val: usize) {
+        let bits = (0usize.leading_zeros() - val.leading_zeros()) as usize;
+        let idx = bits.min(constants::STATS_HISTOGRAM_BUCKETS - 1);
+        self.buckets[idx].fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn copy_to(&self, out: &mut [u64; constants::STATS_HISTOGRAM_BUCKETS]) {
+        for (o, b) in out.iter_mut().zip(self.buckets.iter()) {
+            *o = b.load(Ordering::Relaxed) as u64;
+        }
+    }
+}
+
+/// Occupancy of `PACKETS_RX` or `PACKETS_TX`
+pub struct QueueStats {
+    pub depth: Gauge,
+    pub bytes: Gauge,
+    /// queue depth seen by each enqueued frame
+    pub enqueue_depth: Histogram,
+    /// frames dropped because the queue already had `max_enqueued_packets`
+    pub full_drops: AtomicUsize,
+}
+
+impl QueueStats {
+    fn new() -> QueueStats {
+        QueueStats {
+            depth: Gauge::new(),
+            bytes: Gauge::new(),
+            enqueue_depth: Histogram::new(),
+            full_drops: AtomicUsize::new(0),
+        }
+    }
+
+    /// Call with the queue depth *before* a frame of `len` bytes was pushed
+    pub fn pushed(&self, depth: usize, len: usize) {
+        self.enqueue_depth.record(depth);
+        self.depth.set(depth + 1);
+        self.bytes.add(len);
+    }
+
+    /// Call with the queue depth *after* a frame of `len` bytes was removed
+    pub fn popped(&self, depth: usize, len: usize) {
+        self.depth.set(depth);
+        self.bytes.sub(len);
+    }
+
+    pub fn dropped_full(&self) {
+        self.full_drops.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// Occupancy and outcomes of the reassembly slots of a direction, kept up to
+/// date by `reassembly::FragmentSlots`
+pub struct ReassemblyStats {
+    pub slots: Gauge,
+    pub bytes: Gauge,
+    /// packets successfully reassembled
+    pub completed: AtomicUsize,
+    /// fragments of new packets dropped with `Error::FragmentSetFull`
+    pub set_full_drops: AtomicUsize,
+    /// fragments dropped with `Error::TooManyFragments`, taking their slot with them
+    pub too_many_drops: AtomicUsize,
+    /// slots reset because no fragment arrived for `fragment_timeout_ms`
+    pub expired: AtomicUsize,
+}
+
+impl ReassemblyStats {
+    fn new() -> ReassemblyStats {
+        ReassemblyStats {
+            slots: Gauge::new(),
+            bytes: Gauge::new(),
+            completed: AtomicUsize::new(0),
+            set_full_drops: AtomicUsize::new(0),
+            too_many_drops: AtomicUsize::new(0),
+            expired: AtomicUsize::new(0),
+        }
+    }
+}
+
+/// Everything tracked per direction
+pub struct DirectionStats {
+    pub queue: QueueStats,
+    pub reassembly: ReassemblyStats,
+}
+
+impl DirectionStats {
+    fn new() -> DirectionStats {
+        DirectionStats {
+            queue: QueueStats::new(),
+            reassembly: ReassemblyStats::new(),
+        }
+    }
+}
+
+lazy_static! {
+    /// client_rx side, i.e. `PACKETS_RX` and `FRAGMENTS_RX`
+    pub static ref RX: DirectionStats = DirectionStats::new();
+
+    /// client_tx side, i.e. `PACKETS_TX` and `FRAGMENTS_TX`
+    pub static ref TX: DirectionStats = DirectionStats::new();
+}
+
+/// Per lock counters, only updated with the `lock-stats` feature.
+/// A lock acquisition is contended if another thread held or was waiting
+/// for the lock when we asked for it. Times are in `cycles()`.
+#[derive(Debug)]
+pub struct LockStats {
+    /// NUL terminated, so that it can be handed to C as is
+    name: &'static [u8],
+    /// number of threads holding or waiting for the lock
+    in_use: AtomicUsize,
+    acquisitions: AtomicUsize,
+    contended: AtomicUsize,
+    wait_cycles: AtomicUsize,
+    max_wait_cycles: AtomicUsize,
+    hold_cycles: AtomicUsize,
+    max_hold_cycles: AtomicUsize,
+    #[cfg(feature = "lock-stats")]
+    locked_at: AtomicUsize,
+}
+
+impl LockStats {
+    pub const fn new(name: &'static [u8]) -> LockStats {
+        LockStats {
+            name: name,
+            in_use: AtomicUsize::new(0),
+            acquisitions: AtomicUsize::new(0),
+            contended: AtomicUsize::new(0),
+            wait_cycles: AtomicUsize::new(0),
+            max_wait_cycles: AtomicUsize::new(0),
+            hold_cycles: AtomicUsize::new(0),
+            max_hold_cycles: AtomicUsize::new(0),
+            #[cfg(feature = "lock-stats")]
+            locked_at: AtomicUsize::new(0),
+        }
+    }
+
+    /// Call right before taking the lock, returns the start of the wait
+    #[cfg(feature = "lock-stats")]
+    pub fn acquiring(&self) -> u64 {
+        if self.in_use.fetch_add(1, Ordering::Relaxed) > 0 {
+            self.contended.fetch_add(1, Ordering::Relaxed);
+        }
+        cycles()
+    }
+
+    /// Call right after the lock was taken, with the value returned by `acquiring()`
+    #[cfg(feature = "lock-stats")]
+    pub fn acquired(&self, wait_start: u64) {
+        let now = cycles();
+        let wait = now.saturating_sub(wait_start) as usize;
+        self.acquisitions.fetch_add(1, Ordering::Relaxed);
+        self.wait_cycles.fetch_add(wait, Ordering::Relaxed);
+        store_max(&self.max_wait_cycles, wait);
+        self.locked_at.store(now as usize, Ordering::Relaxed);
+    }
+
+    /// Call right before releasing the lock
+    #[cfg(feature = "lock-stats")]
+    pub fn releasing(&self) {
+        let hold = (cycles() as usize).saturating_sub(self.locked_at.load(Ordering::Relaxed));
+        self.hold_cycles.fetch_add(hold, Ordering::Relaxed);
+        store_max(&self.max_hold_cycles, hold);
+        self.in_use.fetch_sub(1, Ordering::Relaxed);
+    }
+
+    /// Number of threads currently holding or waiting for the lock
+    pub fn in_use(&self) -> usize {
+        self.in_use.load(Ordering::Relaxed)
+    }
+}
+
+/// One entry per lock taken on the packet path
+pub static LOCK_ETHDRIVER_BUF: LockStats = LockStats::new(b"MTX_ETHDRIVER_BUF\0");
+pub static LOCK_CLIENT_BUF: LockStats = LockStats::new(b"MTX_CLIENT_BUF\0");
+pub static LOCK_FN_PACKET_IN: LockStats = LockStats::new(b"FN_PACKET_IN\0");
+pub static LOCK_FN_PACKET_OUT: LockStats = LockStats::new(b"FN_PACKET_OUT\0");
+pub static LOCK_FRAGMENTS_RX: LockStats = LockStats::new(b"FRAGMENTS_RX\0");
+pub static LOCK_FRAGMENTS_TX: LockStats = LockStats::new(b"FRAGMENTS_TX\0");
+pub static LOCK_PACKETS_RX: LockStats = LockStats::new(b"PACKETS_RX\0");
+pub static LOCK_PACKETS_TX: LockStats = LockStats::new(b"PACKETS_TX\0");
+pub static LOCK_RET_CLIENT_RX: LockStats = LockStats::new(b"RET_CLIENT_RX\0");
+pub static LOCK_RET_CLIENT_TX: LockStats = LockStats::new(b"RET_CLIENT_TX\0");
+
+pub static LOCKS: [&'static LockStats; 10] = [
+    &LOCK_ETHDRIVER_BUF,
+    &LOCK_CLIENT_BUF,
+    &LOCK_FN_PACKET_IN,
+    &LOCK_FN_PACKET_OUT,
+    &LOCK_FRAGMENTS_RX,
+    &LOCK_FRAGMENTS_TX,
+    &LOCK_PACKETS_RX,
+    &LOCK_PACKETS_TX,
+    &LOCK_RET_CLIENT_RX,
+    &LOCK_RET_CLIENT_TX,
+];
+
+/// Heap usage, only tracked with the `alloc-stats` or `static-memory` feature.
+/// These are plain statics because the allocator can't depend on lazy_static.
+pub static HEAP_BYTES: Gauge = Gauge::new();
+pub static HEAP_ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+/// Counts every allocation made by the Rust side of the firewall.
+/// Wraps the system allocator, so it is meant for the Linux test builds,
+/// on seL4 the allocator is set up by `camkesrust`. `slab.rs` counts on its
+/// own and takes precedence with the `static-memory` feature.
+#[cfg(all(feature = "alloc-stats", not(feature = "static-memory")))]
+pub struct CountingAllocator;
+
+#[cfg(all(feature = "alloc-stats", not(feature = "static-memory")))]
+unsafe impl ::std::alloc::GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: ::std::alloc::Layout) -> *mut u8 {
+        let ptr = ::std::alloc::System.alloc(layout);
+        if !ptr.is_null() {
+            HEAP_BYTES.add(layout.size());
+            HEAP_ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        }
+        ptr
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: ::std::alloc::Layout) {
+        ::std::alloc::System.dealloc(ptr, layout);
+        HEAP_BYTES.sub(layout.size());
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: ::std::alloc::Layout, new_size: usize) -> *mut u8 {
+        let new_ptr = ::std::alloc::System.realloc(ptr, layout, new_size);
+        if !new_ptr.is_null() {
+            HEAP_BYTES.sub(layout.size());
+            HEAP_BYTES.add(new_size);
+            HEAP_ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        }
+        new_ptr
+    }
+}
+
+#[cfg(all(feature = "alloc-stats", not(feature = "static-memory")))]
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// C view of the statistics, keep in sync with `struct firewall_stats` in `rustwall.h`
+/// Every gauge comes as a (current, high-water mark) pair.
+#[repr(C)]
+pub struct FirewallStats {
+    pub packets_rx_depth: u64,
+    pub packets_rx_depth_max: u64,
+    pub packets_rx_bytes: u64,
+    pub packets_rx_bytes_max: u64,
+    pub packets_rx_full_drops: u64,
+    pub packets_tx_depth: u64,
+    pub packets_tx_depth_max: u64,
+    pub packets_tx_bytes: u64,
+    pub packets_tx_bytes_max: u64,
+    pub packets_tx_full_drops: u64,
+    pub fragments_rx_slots: u64,
+    pub fragments_rx_slots_max: u64,
+    pub fragments_rx_bytes: u64,
+    pub fragments_rx_bytes_max: u64,
+    pub fragments_rx_completed: u64,
+    pub fragments_rx_set_full_drops: u64,
+    pub fragments_rx_too_many_drops: u64,
+    pub fragments_rx_expired: u64,
+    pub fragments_tx_slots: u64,
+    pub fragments_tx_slots_max: u64,
+    pub fragments_tx_bytes: u64,
+    pub fragments_tx_bytes_max: u64,
+    pub fragments_tx_completed: u64,
+    pub fragments_tx_set_full_drops: u64,
+    pub fragments_tx_too_many_drops: u64,
+    pub fragments_tx_expired: u64,
+    pub arp_replies: u64,
+    pub arp_reply_failures: u64,
+    pub multicast_drops: u64,
+    pub flow_replies: u64,
+    pub fast_lane_skipped: u64,
+    pub fast_lane_sampled: u64,
+    pub fast_lane_demoted: u64,
+    pub shadow_samples: u64,
+    pub shadow_drops: u64,
+    pub shadow_passes: u64,
+    pub shadow_live_cycles: u64,
+    pub shadow_cycles: u64,
+    pub stalls: u64,
+    pub heap_bytes: u64,
+    pub heap_bytes_max: u64,
+    pub heap_allocations: u64,
+    pub packets_rx_enqueue_depth: [u64; constants::STATS_HISTOGRAM_BUCKETS],
+    pub packets_tx_enqueue_depth: [u64; constants::STATS_HISTOGRAM_BUCKETS],
+}
+
+/// Fill `stats` with a snapshot of all gauges and histograms
+/// returns 0 on success, -1 if `stats` is NULL
+#[no_mangle]
+pub extern "C" fn firewall_stats_get(stats: *mut FirewallStats) -> i32 {
+    let stats = match unsafe { stats.as_mut() } {
+        Some(s) => s,
+        None => return -1,
+    };
+    stats.packets_rx_depth = RX.queue.depth.get() as u64;
+    stats.packets_rx_depth_max = RX.queue.depth.high() as u64;
+    stats.packets_rx_bytes = RX.queue.bytes.get() as u64;
+    stats.packets_rx_bytes_max = RX.queue.bytes.high() as u64;
+    stats.packets_rx_full_drops = RX.queue.full_drops.load(Ordering::Relaxed) as u64;
+    stats.packets_tx_depth = TX.queue.depth.get() as u64;
+    stats.packets_tx_depth_max = TX.queue.depth.high() as u64;
+    stats.packets_tx_bytes = TX.queue.bytes.get() as u64;
+    stats.packets_tx_bytes_max = TX.queue.bytes.high() as u64;
+    stats.packets_tx_full_drops = TX.queue.full_drops.load(Ordering::Relaxed) as u64;
+    stats.fragments_rx_slots = RX.reassembly.slots.get() as u64;
+    stats.fragments_rx_slots_max = RX.reassembly.slots.high() as u64;
+    stats.fragments_rx_bytes = RX.reassembly.bytes.get() as u64;
+    stats.fragments_rx_bytes_max = RX.reassembly.bytes.high() as u64;
+    stats.fragments_rx_completed = RX.reassembly.completed.load(Ordering::Relaxed) as u64;
+    stats.fragments_rx_set_full_drops = RX.reassembly.set_full_drops.load(Ordering::Relaxed) as u64;
+    stats.fragments_rx_too_many_drops = RX.reassembly.too_many_drops.load(Ordering::Relaxed) as u64;
+    stats.fragments_rx_expired = RX.reassembly.expired.load(Ordering::Relaxed) as u64;
+    stats.fragments_tx_slots = TX.reassembly.slots.get() as u64;
+    stats.fragments_tx_slots_max = TX.reassembly.slots.high() as u64;
+    stats.fragments_tx_bytes = TX.reassembly.bytes.get() as u64;
+    stats.fragments_tx_bytes_max = TX.reassembly.bytes.high() as u64;
+    stats.fragments_tx_completed = TX.reassembly.completed.load(Ordering::Relaxed) as u64;
+    stats.fragments_tx_set_full_drops = TX.reassembly.set_full_drops.load(Ordering::Relaxed) as u64;
+    stats.fragments_tx_too_many_drops = TX.reassembly.too_many_drops.load(Ordering::Relaxed) as u64;
+    stats.fragments_tx_expired = TX.reassembly.expired.load(Ordering::Relaxed) as u64;
+    stats.arp_replies = ::arp::REPLIES.load(Ordering::Relaxed) as u64;
+    stats.arp_reply_failures = ::arp::REPLY_FAILURES.load(Ordering::Relaxed) as u64;
+    stats.multicast_drops = ::mcast::DROPS.load(Ordering::Relaxed) as u64;
+    stats.flow_replies = ::flows::REPLIES.load(Ordering::Relaxed) as u64;
+    stats.fast_lane_skipped = ::flows::LANE_SKIPPED.load(Ordering::Relaxed) as u64;
+    stats.fast_lane_sampled = ::flows::LANE_SAMPLED.load(Ordering::Relaxed) as u64;
+    stats.fast_lane_demoted = ::flows::LANE_DEMOTED.load(Ordering::Relaxed) as u64;
+    stats.shadow_samples = ::shadow::SAMPLES.load(Ordering::Relaxed) as u64;
+    stats.shadow_drops = ::shadow::DROPS.load(Ordering::Relaxed) as u64;
+    stats.shadow_passes = ::shadow::PASSES.load(Ordering::Relaxed) as u64;
+    stats.shadow_live_cycles = ::shadow::LIVE_CYCLES.load(Ordering::Relaxed);
+    stats.shadow_cycles = ::shadow::CYCLES.load(Ordering::Relaxed);
+    stats.stalls = ::watchdog::STALLS.load(Ordering::Relaxed) as u64;
+    stats.heap_bytes = HEAP_BYTES.get() as u64;
+    stats.heap_bytes_max = HEAP_BYTES.high() as u64;
+    stats.heap_allocations = HEAP_ALLOCATIONS.load(Ordering::Relaxed) as u64;
+    RX.queue.enqueue_depth.copy_to(&mut stats.packets_rx_enqueue_depth);
+    TX.queue.enqueue_depth.copy_to(&mut stats.packets_tx_enqueue_depth);
+    0
+}
+
+/// Restart all high-water marks from the current values,
+/// e.g. after warming up a benchmark
+#[no_mangle]
+pub extern "C" fn firewall_stats_reset_high_water() {
+    for dir in [&*RX, &*TX].iter() {
+        dir.queue.depth.reset_high();
+        dir.queue.bytes.reset_high();
+        dir.reassembly.slots.reset_high();
+        dir.reassembly.bytes.reset_high();
+    }
+    HEAP_BYTES.reset_high();
+}
+
+/// C view of `LockStats`, keep in sync with `struct firewall_lock_stats` in `rustwall.h`
+#[repr(C)]
+pub struct FirewallLockStats {
+    pub name: *const u8,
+    pub acquisitions: u64,
+    pub contended: u64,
+    pub wait_cycles: u64,
+    pub max_wait_cycles: u64,
+    pub hold_cycles: u64,
+    pub max_hold_cycles: u64,
+}
+
+/// Fill `stats` with the counters of lock number `idx`, see `LOCKS`.
+/// The counters stay at zero unless built with the `lock-stats` feature.
+/// returns 0 on success, -1 if `idx` is past the last lock or `stats` is NULL
+#[no_mangle]
+pub extern "C" fn firewall_lock_stats_get(idx: u32, stats: *mut FirewallLockStats) -> i32 {
+    let stats = match unsafe { stats.as_mut() } {
+        Some(s) => s,
+        None => return -1,
+    };
+    let lock = match LOCKS.get(idx as usize) {
+        Some(l) => l,
+        None => return -1,
+    };
+    stats.name = lock.name.as_ptr();
+    stats.acquisitions = lock.acquisitions.load(Ordering::Relaxed) as u64;
+    stats.contended = lock.contended.load(Ordering::Relaxed) as u64;
+    stats.wait_cycles = lock.wait_cycles.load(Ordering::Relaxed) as u64;
+    stats.max_wait_cycles = lock.max_wait_cycles.load(Ordering::Relaxed) as u64;
+    stats.hold_cycles = lock.hold_cycles.load(Ordering::Relaxed) as u64;
+    stats.max_hold_cycles = lock.max_hold_cycles.load(Ordering::Relaxed) as u64;
+    0
+}
@@ -18,6 +18,8 @@
 #include <fcntl.h>
 
 #include "test_data.h"
+#include "rustwall.h"
+#include "pktgen.h"
 #include <pthread.h>
 
 pthread_mutex_t mutex_ethdriver_buf = PTHREAD_MUTEX_INITIALIZER;
@@ -59,18 +61,26 @@ void ethdriver_mac(uint8_t *b1, uint8_t *b2, uint8_t *b3, uint8_t *b4,
   *b6 = mac[5];
 }
 
+int ethdriver_tx_frames = 0;
 int ethdriver_tx(int len)
 {
   printf("ethdriver_TX: len = %i\n", len);
+  ethdriver_tx_frames++;
   return 0;
 }
 
 int ethdbuf_len = 0;
 int ethdriver_ret = 0;
+// the frame in the buffer is reported this many more times, like a burst
+int ethdriver_burst = 0;
 int ethdriver_rx(int* len)
 {
   *len = ethdbuf_len;
   printf("ethdriver_RX: len = %i\n", *len);
+  if (ethdriver_burst > 0) {
+    ethdriver_burst--;
+    return 1;
+  }
   return ethdriver_ret;
 }
 
@@ -116,6 +126,26 @@ void client_emit(unsigned int badge)
  * END OF AUTOGENERATED CODE
  */
 
+/**
+ * IPv6 filters of `external_firewall.c`, registered in the IPV6 TEST
+ */
+int32_t packet_in6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len);
+int32_t packet_out6(const uint8_t *src_addr, uint16_t src_port,
+    const uint8_t *dst_addr, uint16_t dst_port, uint16_t payload_len,
+    uint8_t *payload, uint16_t max_payload_len);
+
+/**
+ * Shadow filter of the SHADOW TEST, drops port 7002
+ */
+int32_t shadow_in(uint32_t src_addr, uint16_t src_port, uint32_t dst_addr,
+    uint16_t dst_port, uint16_t payload_len, uint8_t *payload,
+    uint16_t max_payload_len)
+{
+  return (dst_port == 7002) ? -1 : payload_len;
+}
+
 bool compare_buffers(uint8_t* origin, uint8_t* destination, int len)
 {
   if (len <= 0) {
@@ -166,16 +196,76 @@ bool receive_and_test_packet(uint8_t* data, int data_len, int* returnval)
   return compare_buffers(data, (uint8_t*) client_buf(1), len);
 }
 
+/**
+ * Offset of the last record in a pcap dump, -1 if it has none
+ */
+int capture_last_record(uint8_t* pcap, int pcap_len)
+{
+  int last_record = -1;
+  for (int pos = CAPTURE_PCAP_HEADER_LEN; pos < pcap_len;
+      pos += CAPTURE_RECORD_HEADER_LEN + (pcap[pos + 8] | (pcap[pos + 9] << 8))) {
+    last_record = pos;
+  }
+  return last_record;
+}
+
+/**
+ * Pass a configuration blob to the firewall, true if it was accepted
+ */
+static bool configure(const char *blob)
+{
+  return firewall_configure(blob, strlen(blob)) == 0;
+}
+
 /**
  * Main program
  */
 int main()
 {
 
-  printf("\n\nTRANSMIT TEST\n\n");
+  // has to come before the first frame, sizes the pools
+  printf("\n\nCONFIG TEST\n\n");
 
   bool retval;
 
+  retval = !configure("mtu=9001\nbuffer_size=65535\n") && !configure("mtu=1500\nbuffer_size=1500\n")
+      && !configure("supported_fragments=0\n") && !configure("mtu\n")
+      && !configure("queue_depth=64\n");
+  if (retval == false) {
+    printf("TEST CONFIG: Testing invalid configurations: FAILED\n");
+    exit(1);
+  } else {
+    printf("TEST CONFIG: Testing invalid configurations: OK\n");
+  }
+
+  // the default limits, plus large send for the dataports of this file,
+  // the ARP responder, connection tracking with flows that time out after
+  // 16 calls and two fast lanes
+  retval = configure("# defaults\nmtu = 1500\nbuffer_size=65535\n\n"
+      "max_enqueued_packets=1024\nsupported_fragments=10\nlarge_send=1\n"
+      "arp_responder=1\nconntrack=1\nflow_timeout_ms=16\n"
+      "fast_lane=7100-7199:3:4\nfast_lane=7200-7299:1:1000\n");
+  if (retval == false) {
+    printf("TEST CONFIG: Testing valid configuration: FAILED\n");
+    exit(1);
+  } else {
+    printf("TEST CONFIG: Testing valid configuration: OK\n");
+  }
+
+  // only the first configuration counts
+  retval = configure("mtu=1500\n");
+  if (retval == true) {
+    printf("TEST CONFIG: Testing reconfiguration: FAILED\n");
+    exit(1);
+  } else {
+    printf("TEST CONFIG: Testing reconfiguration: OK\n");
+  }
+
+  // keep the dropped frames for the CAPTURE TEST
+  firewall_capture_config(CAPTURE_DROPS, 0);
+
+  printf("\n\nTRANSMIT TEST\n\n");
+
   retval = send_and_test_packet(packet_bytes_ping, sizeof(packet_bytes_ping));
   if (retval == false) {
     printf("TEST TX: Testing ping: FAILED\n");
@@ -196,11 +286,11 @@ int main()
 
   retval = send_and_test_packet(packet_bytes_multicast_report,
       sizeof(packet_bytes_multicast_report));
-  if (retval == true) {
-    printf("TEST TX: Testing IPv6: FAILED\n");
+  if (retval == false) {
+    printf("TEST TX: Testing IPv6 MLD report: FAILED\n");
     exit(1);
   } else {
-    printf("TEST TX: Testing IPv6: OK\n");
+    printf("TEST TX: Testing IPv6 MLD report: OK\n");
   }
   printf("\n");
 
@@ -316,11 +406,11 @@ int main()
 
   retval = receive_and_test_packet(packet_bytes_multicast_report,
       sizeof(packet_bytes_multicast_report), &returnval);
-  if ((retval == false) && (returnval == -1)) {
-    printf("TEST RX: Testing IPv6: OK\n");
+  if ((retval == true) && (returnval == 0)) {
+    printf("TEST RX: Testing IPv6 MLD report: OK\n");
   } else {
 
-    printf("TEST RX: Testing IPv6: FAILED\n");
+    printf("TEST RX: Testing IPv6 MLD report: FAILED\n");
     exit(1);
   }
   printf("\n");
@@ -495,6 +585,719 @@ int main()
     printf("Round %i OK\n", i);
   }
   printf("Done Testing many fragmented 5k packets...\n");
+
+  printf("\n\n"
+      "CAPTURE TEST"
+      "\n\n");
+
+  // an ICMPv6 message of unknown type is dropped, and is the last record
+  static uint8_t pcap[65535];
+  static uint8_t unknown_icmpv6[sizeof(packet_bytes_multicast_report)];
+  memcpy(unknown_icmpv6, packet_bytes_multicast_report, sizeof(unknown_icmpv6));
+  unknown_icmpv6[PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV6_HEADER_LEN + 8] = 200;
+  retval = send_and_test_packet(unknown_icmpv6, sizeof(unknown_icmpv6));
+  int pcap_len = firewall_capture_dump(pcap, sizeof(pcap));
+  uint32_t pcap_magic = pcap[0] | (pcap[1] << 8) | (pcap[2] << 16)
+      | ((uint32_t) pcap[3] << 24);
+  int last_record = capture_last_record(pcap, pcap_len);
+  if (!retval && (pcap_magic == 0xa1b2c3d4) && (last_record > 0)
+      && compare_buffers(unknown_icmpv6,
+          pcap + last_record + CAPTURE_RECORD_HEADER_LEN,
+          sizeof(unknown_icmpv6))) {
+    printf("TEST CAPTURE: Testing dropped IPv6: OK\n");
+  } else {
+    printf("TEST CAPTURE: Testing dropped IPv6: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // a frame for another host is dropped without an error, and recorded too
+  static uint8_t other_host[sizeof(packet_bytes_ping)];
+  memcpy(other_host, packet_bytes_ping, sizeof(other_host));
+  memcpy(other_host, (uint8_t[]) { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 }, 6);
+  retval = receive_and_test_packet(other_host, sizeof(other_host), &returnval);
+  pcap_len = firewall_capture_dump(pcap, sizeof(pcap));
+  last_record = capture_last_record(pcap, pcap_len);
+  if (!retval && (returnval == -1) && (last_record > 0)
+      && compare_buffers(other_host,
+          pcap + last_record + CAPTURE_RECORD_HEADER_LEN,
+          sizeof(other_host))) {
+    printf("TEST CAPTURE: Testing frame for another host: OK\n");
+  } else {
+    printf("TEST CAPTURE: Testing frame for another host: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // with a rate of 1 a forwarded frame is recorded too, as the last record
+  firewall_capture_config(CAPTURE_SAMPLED, 1);
+  retval = send_and_test_packet(packet_bytes_ping, sizeof(packet_bytes_ping));
+  firewall_capture_config(CAPTURE_OFF, 0);
+  pcap_len = firewall_capture_dump(pcap, sizeof(pcap));
+  last_record = capture_last_record(pcap, pcap_len);
+  if (retval && (last_record > 0)
+      && compare_buffers(packet_bytes_ping,
+          pcap + last_record + CAPTURE_RECORD_HEADER_LEN,
+          sizeof(packet_bytes_ping))) {
+    printf("TEST CAPTURE: Testing sampled: OK\n");
+  } else {
+    printf("TEST CAPTURE: Testing sampled: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "STATS TEST"
+      "\n\n");
+
+  // all queues were drained and all fragment trains completed
+  struct firewall_stats stats;
+  if ((firewall_stats_get(&stats) == 0) && (stats.packets_rx_depth == 0)
+      && (stats.packets_rx_depth_max >= 1) && (stats.packets_tx_depth == 0)
+      && (stats.fragments_rx_slots == 0) && (stats.fragments_rx_bytes == 0)
+      && (stats.fragments_tx_slots == 0) && (stats.fragments_tx_bytes == 0)
+      && (stats.fragments_rx_completed >= 1)
+      && (stats.fragments_rx_set_full_drops == 0)
+      && (stats.fragments_rx_too_many_drops == 0)
+      && (stats.packets_rx_enqueue_depth[0] >= 1)) {
+    printf("TEST STATS: Testing gauges: OK\n");
+  } else {
+    printf("TEST STATS: Testing gauges: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // every lock was taken by the TX and RX tests above, but is only counted
+  // with the `lock-stats` feature
+  struct firewall_lock_stats lock_stats;
+  int locks = 0;
+  int counted = 0;
+  while (firewall_lock_stats_get(locks, &lock_stats) == 0) {
+    printf("%s: %lu acquisitions, %lu contended, %lu wait cycles, "
+        "%lu hold cycles\n", lock_stats.name, lock_stats.acquisitions,
+        lock_stats.contended, lock_stats.wait_cycles, lock_stats.hold_cycles);
+#ifdef LOCK_STATS
+    counted += (lock_stats.acquisitions > 0);
+#else
+    counted += (lock_stats.acquisitions == 0) && (lock_stats.contended == 0)
+        && (lock_stats.wait_cycles == 0) && (lock_stats.hold_cycles == 0);
+#endif
+    locks++;
+  }
+  if ((locks == FIREWALL_LOCKS) && (counted == FIREWALL_LOCKS)) {
+    printf("TEST STATS: Testing lock stats: OK\n");
+  } else {
+    printf("TEST STATS: Testing lock stats: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "PKTGEN TEST"
+      "\n\n");
+
+  static struct pktgen gen;
+  static uint8_t frame[1514];
+  struct pktgen_config config;
+  int delivered = 0;
+
+  // generated UDP from many ports comes through unchanged
+  pktgen_default_config(&config);
+  config.src_port.count = 1000;
+  pktgen_init(&gen, &config);
+  for (int i = 0; i < 20; i++) {
+    int len = pktgen_next(&gen, frame, sizeof(frame));
+    delivered += receive_and_test_packet(frame, len, &returnval);
+  }
+  if (delivered == 20) {
+    printf("TEST PKTGEN: Testing UDP: OK\n");
+  } else {
+    printf("TEST PKTGEN: Testing UDP: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // and is dropped with a broken IPv4 or UDP checksum
+  config.bad_checksum_pct = 100;
+  pktgen_init(&gen, &config);
+  delivered = 0;
+  for (int i = 0; i < 20; i++) {
+    int len = pktgen_next(&gen, frame, sizeof(frame));
+    delivered += receive_and_test_packet(frame, len, &returnval);
+  }
+  if (delivered == 0) {
+    printf("TEST PKTGEN: Testing bad checksums: OK\n");
+  } else {
+    printf("TEST PKTGEN: Testing bad checksums: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // shuffled fragment trains are reassembled
+  config.bad_checksum_pct = 0;
+  config.min_payload = 1000;
+  config.max_payload = 3000;
+  config.mtu = 576;
+  config.frag_order = PKTGEN_SHUFFLED;
+  pktgen_init(&gen, &config);
+  delivered = 0;
+  for (int i = 0; i < 5; i++) {
+    do {
+      int len = pktgen_next(&gen, frame, sizeof(frame));
+      receive_and_test_packet(frame, len, &returnval);
+    } while (pktgen_in_train(&gen));
+    delivered += (returnval != -1);
+    while (returnval == 1) {
+      int len;
+      returnval = client_rx(&len);
+    }
+  }
+  if (delivered == 5) {
+    printf("TEST PKTGEN: Testing fragment trains: OK\n");
+  } else {
+    printf("TEST PKTGEN: Testing fragment trains: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "LARGE SEND TEST"
+      "\n\n");
+
+  // a whole datagram from the client leaves as MTU sized fragments
+  static uint8_t large_frame[PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV4_HEADER_LEN
+      + PKTGEN_L4_HEADER_LEN + 4000];
+  struct pktgen_flow flow = {
+    .src_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .dst_mac = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x02 },
+    .src_ip = 0xc0a84501,
+    .dst_ip = 0xc0a84502,
+    .src_port = 40000,
+    .dst_port = 6969,
+  };
+  int large_len = pktgen_udp(large_frame, sizeof(large_frame), &flow, 1, 4000,
+      0);
+  memcpy(client_buf(1), large_frame, large_len);
+  ethdriver_tx_frames = 0;
+  client_tx(large_len);
+  if (ethdriver_tx_frames == 3) {
+    printf("TEST LARGE SEND: Testing UDP: OK\n");
+  } else {
+    printf("TEST LARGE SEND: Testing UDP: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // anything else can't be fragmented on the way out
+  large_len = pktgen_icmp_echo(large_frame, sizeof(large_frame), &flow, 1,
+      4000, 0);
+  memcpy(client_buf(1), large_frame, large_len);
+  ethdriver_tx_frames = 0;
+  client_tx(large_len);
+  if (ethdriver_tx_frames == 0) {
+    printf("TEST LARGE SEND: Testing ICMP: OK\n");
+  } else {
+    printf("TEST LARGE SEND: Testing ICMP: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "ARP TEST"
+      "\n\n");
+
+  // the client sent an ARP request from 192.168.69.2 above, so the firewall
+  // answers for it
+  struct pktgen_flow arp_flow = {
+    .src_mac = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x02 },
+    .src_ip = 0xc0a84509,
+    .dst_ip = 0xc0a84502,
+  };
+  uint8_t arp_request[PKTGEN_ETH_HEADER_LEN + PKTGEN_ARP_LEN];
+  int arp_len = pktgen_arp_request(arp_request, sizeof(arp_request),
+      &arp_flow);
+  ethdriver_tx_frames = 0;
+  retval = receive_and_test_packet(arp_request, arp_len, &returnval);
+  uint8_t *arp_reply = (uint8_t *) ethdriver_buf;
+  uint8_t reply_sender[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0xc0, 0xa8,
+      0x45, 0x02 };
+  if ((returnval == -1) && (ethdriver_tx_frames == 1)
+      && compare_buffers(arp_flow.src_mac, arp_reply, 6)
+      && (arp_reply[21] == 2)
+      && compare_buffers(reply_sender, arp_reply + 22, sizeof(reply_sender))) {
+    printf("TEST ARP: Testing request for the client: OK\n");
+  } else {
+    printf("TEST ARP: Testing request for the client: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // anyone else's are still the client's business
+  arp_flow.dst_ip = 0xc0a8454d;
+  arp_len = pktgen_arp_request(arp_request, sizeof(arp_request), &arp_flow);
+  ethdriver_tx_frames = 0;
+  retval = receive_and_test_packet(arp_request, arp_len, &returnval);
+  if ((retval == true) && (returnval == 0) && (ethdriver_tx_frames == 0)) {
+    printf("TEST ARP: Testing request for another host: OK\n");
+  } else {
+    printf("TEST ARP: Testing request for another host: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // the client only sent IPv4 from 192.168.69.1, that's not an announcement
+  arp_flow.dst_ip = 0xc0a84501;
+  arp_len = pktgen_arp_request(arp_request, sizeof(arp_request), &arp_flow);
+  ethdriver_tx_frames = 0;
+  retval = receive_and_test_packet(arp_request, arp_len, &returnval);
+  if ((retval == true) && (returnval == 0) && (ethdriver_tx_frames == 0)) {
+    printf("TEST ARP: Testing request for an IPv4 source: OK\n");
+  } else {
+    printf("TEST ARP: Testing request for an IPv4 source: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "**************************************************\n"
+      "MULTICAST TEST"
+      "\n\n");
+
+  // 239.1.2.3, which the client hasn't joined yet
+  struct pktgen_flow mcast_flow = {
+    .src_mac = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x02 },
+    .dst_mac = { 0x01, 0x00, 0x5e, 0x01, 0x02, 0x03 },
+    .src_ip = 0xc0a84502,
+    .dst_ip = 0xef010203,
+    .src_port = 40000,
+    .dst_port = 7000,
+  };
+  uint8_t mcast_frame[PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV4_HEADER_LEN
+      + PKTGEN_L4_HEADER_LEN + 64];
+  int mcast_len = pktgen_udp(mcast_frame, sizeof(mcast_frame), &mcast_flow,
+      1, 64, 0);
+  retval = receive_and_test_packet(mcast_frame, mcast_len, &returnval);
+  if ((retval == false) && (returnval == -1)) {
+    printf("TEST MULTICAST: Testing group not joined: OK\n");
+  } else {
+    printf("TEST MULTICAST: Testing group not joined: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // IGMPv2 membership report for 239.1.2.3 from the client
+  uint8_t igmp_report[] = { 0x01, 0x00, 0x5e, 0x01, 0x02, 0x03, 0x02, 0x00,
+      0x00, 0x00, 0x00, 0x01, 0x08, 0x00, 0x45, 0x00, 0x00, 0x1c, 0x00, 0x00,
+      0x00, 0x00, 0x01, 0x02, 0xc3, 0x32, 0xc0, 0xa8, 0x45, 0x01, 0xef, 0x01,
+      0x02, 0x03, 0x16, 0x00, 0xf8, 0xfa, 0xef, 0x01, 0x02, 0x03 };
+  send_and_test_packet(igmp_report, sizeof(igmp_report));
+  retval = receive_and_test_packet(mcast_frame, mcast_len, &returnval);
+  if ((retval == true) && (returnval == 0)) {
+    printf("TEST MULTICAST: Testing group joined: OK\n");
+  } else {
+    printf("TEST MULTICAST: Testing group joined: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // and the IGMPv2 leave, to all routers
+  uint8_t igmp_leave[] = { 0x01, 0x00, 0x5e, 0x00, 0x00, 0x02, 0x02, 0x00,
+      0x00, 0x00, 0x00, 0x01, 0x08, 0x00, 0x45, 0x00, 0x00, 0x1c, 0x00, 0x00,
+      0x00, 0x00, 0x01, 0x02, 0xd4, 0x34, 0xc0, 0xa8, 0x45, 0x01, 0xe0, 0x00,
+      0x00, 0x02, 0x17, 0x00, 0xf7, 0xfa, 0xef, 0x01, 0x02, 0x03 };
+  send_and_test_packet(igmp_leave, sizeof(igmp_leave));
+  retval = receive_and_test_packet(mcast_frame, mcast_len, &returnval);
+  if ((retval == false) && (returnval == -1)) {
+    printf("TEST MULTICAST: Testing group left: OK\n");
+  } else {
+    printf("TEST MULTICAST: Testing group left: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "**************************************************\n"
+      "IPV6 TEST"
+      "\n\n");
+
+  // 2001:db8::c0a8:4502 to 2001:db8::c0a8:4501, the client
+  struct pktgen_flow flow6 = {
+    .src_mac = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x02 },
+    .dst_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .src_ip = 0xc0a84502,
+    .dst_ip = 0xc0a84501,
+    .src_port = 40000,
+    .dst_port = 7000,
+  };
+  static uint8_t frame6[4][PKTGEN_ETH_HEADER_LEN + 1500];
+  int len6[4];
+  len6[0] = pktgen_udp6(frame6[0], sizeof(frame6[0]), &flow6, 64, 0);
+  retval = receive_and_test_packet(frame6[0], len6[0], &returnval);
+  if ((retval == false) && (returnval == -1)
+      && (firewall_ipv6_filters(packet_in6, NULL) == -1)) {
+    printf("TEST IPV6: Testing UDP without IPv6 filters: OK\n");
+  } else {
+    printf("TEST IPV6: Testing UDP without IPv6 filters: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  firewall_ipv6_filters(packet_in6, packet_out6);
+  retval = receive_and_test_packet(frame6[0], len6[0], &returnval);
+  if ((retval == true) && (returnval == 0)) {
+    printf("TEST IPV6: Testing UDP: OK\n");
+  } else {
+    printf("TEST IPV6: Testing UDP: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  flow6.dst_port = 6968;
+  len6[0] = pktgen_udp6(frame6[0], sizeof(frame6[0]), &flow6, 64, 0);
+  retval = receive_and_test_packet(frame6[0], len6[0], &returnval);
+  if ((retval == false) && (returnval == -1)) {
+    printf("TEST IPV6: Testing UDP dropped by packet_in6: OK\n");
+  } else {
+    printf("TEST IPV6: Testing UDP dropped by packet_in6: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // a neighbor solicitation, the UDP header and payload become the ICMPv6 message
+  flow6.dst_port = 7000;
+  len6[0] = pktgen_udp6(frame6[0], sizeof(frame6[0]), &flow6, 16, 0);
+  frame6[0][PKTGEN_ETH_HEADER_LEN + 6] = 58;
+  frame6[0][PKTGEN_ETH_HEADER_LEN + 7] = 255;
+  frame6[0][PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV6_HEADER_LEN] = 135;
+  frame6[0][PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV6_HEADER_LEN + 1] = 0;
+  retval = receive_and_test_packet(frame6[0], len6[0], &returnval);
+  if ((retval == true) && (returnval == 0)) {
+    printf("TEST IPV6: Testing neighbor solicitation: OK\n");
+  } else {
+    printf("TEST IPV6: Testing neighbor solicitation: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // a packet too big, which path MTU discovery needs
+  frame6[0][PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV6_HEADER_LEN] = 2;
+  retval = receive_and_test_packet(frame6[0], len6[0], &returnval);
+  if ((retval == true) && (returnval == 0)) {
+    printf("TEST IPV6: Testing packet too big: OK\n");
+  } else {
+    printf("TEST IPV6: Testing packet too big: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // 3000 bytes in 3 fragments, reassembled and fragmented the same way again
+  int l4_len6 = PKTGEN_L4_HEADER_LEN + 3000;
+  int frag_len6 = (1500 - PKTGEN_IPV6_HEADER_LEN - PKTGEN_IPV6_FRAG_HEADER_LEN)
+      & ~7;
+  for (int i = 0; i < 3; i++) {
+    int offset = i * frag_len6;
+    int len = (l4_len6 - offset < frag_len6) ? l4_len6 - offset : frag_len6;
+    len6[i] = pktgen_ipv6_fragment(frame6[i], sizeof(frame6[i]), &flow6,
+        0x1234567, l4_len6, offset, len, i < 2, 0);
+  }
+  receive_and_test_packet(frame6[2], len6[2], &returnval);
+  bool fragments_ok = (returnval == -1);
+  receive_and_test_packet(frame6[1], len6[1], &returnval);
+  fragments_ok = fragments_ok && (returnval == -1);
+  retval = receive_and_test_packet(frame6[0], len6[0], &returnval);
+  fragments_ok = fragments_ok && retval && (returnval == 1);
+  int rx_len = 0;
+  ethdriver_ret = -1;
+  for (int i = 1; i < 3; i++) {
+    returnval = client_rx(&rx_len);
+    fragments_ok = fragments_ok && (rx_len == len6[i])
+        && compare_buffers(frame6[i], (uint8_t*) client_buf(1), rx_len);
+  }
+  ethdriver_ret = 0;
+  if (fragments_ok && (returnval == 0)) {
+    printf("TEST IPV6: Testing fragmented UDP: OK\n");
+  } else {
+    printf("TEST IPV6: Testing fragmented UDP: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // two datagrams whose identifications only differ in their halves, the
+  // first fragments of both arrive before the first one completes
+  uint32_t idents[] = { 0x00010002, 0x00020001 };
+  uint8_t fills[] = { 0, 0x40 };
+  int small_l4_len6 = PKTGEN_L4_HEADER_LEN + 24;
+  for (int i = 0; i < 2; i++) {
+    len6[i] = pktgen_ipv6_fragment(frame6[i], sizeof(frame6[i]), &flow6,
+        idents[i], small_l4_len6, 0, 16, true, fills[i]);
+  }
+  len6[2] = pktgen_ipv6_fragment(frame6[2], sizeof(frame6[2]), &flow6,
+      idents[0], small_l4_len6, 16, small_l4_len6 - 16, false, fills[0]);
+  len6[3] = pktgen_udp6(frame6[3], sizeof(frame6[3]), &flow6, 24, fills[0]);
+  receive_and_test_packet(frame6[0], len6[0], &returnval);
+  fragments_ok = (returnval == -1);
+  receive_and_test_packet(frame6[1], len6[1], &returnval);
+  fragments_ok = fragments_ok && (returnval == -1);
+  receive_and_test_packet(frame6[2], len6[2], &returnval);
+  fragments_ok = fragments_ok && (returnval == 0)
+      && compare_buffers(frame6[3], (uint8_t*) client_buf(1), len6[3]);
+  if (fragments_ok) {
+    printf("TEST IPV6: Testing interleaved fragmented UDP: OK\n");
+  } else {
+    printf("TEST IPV6: Testing interleaved fragmented UDP: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "**************************************************\n"
+      "CONNTRACK TEST"
+      "\n\n");
+
+  // from port 7000 on the wire to port 6968 of the client, which `packet_in`
+  // drops unless it answers a datagram the client sent
+  struct pktgen_flow reply_flow = {
+    .src_mac = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x02 },
+    .dst_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .src_ip = 0xc0a84502,
+    .dst_ip = 0xc0a84501,
+    .src_port = 7000,
+    .dst_port = 6968,
+  };
+  uint8_t reply_frame[PKTGEN_ETH_HEADER_LEN + PKTGEN_IPV4_HEADER_LEN
+      + PKTGEN_L4_HEADER_LEN + 64];
+  int reply_len = pktgen_udp(reply_frame, sizeof(reply_frame), &reply_flow,
+      1, 64, 0);
+  retval = receive_and_test_packet(reply_frame, reply_len, &returnval);
+  if ((retval == false) && (returnval == -1)) {
+    printf("TEST CONNTRACK: Testing no flow: OK\n");
+  } else {
+    printf("TEST CONNTRACK: Testing no flow: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // the client opens the flow
+  struct pktgen_flow request_flow = {
+    .src_mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .dst_mac = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x02 },
+    .src_ip = 0xc0a84501,
+    .dst_ip = 0xc0a84502,
+    .src_port = 6968,
+    .dst_port = 7000,
+  };
+  uint8_t request_frame[sizeof(reply_frame)];
+  int request_len = pktgen_udp(request_frame, sizeof(request_frame),
+      &request_flow, 1, 64, 0);
+  retval = send_and_test_packet(request_frame, request_len);
+  if (retval == true) {
+    printf("TEST CONNTRACK: Testing request: OK\n");
+  } else {
+    printf("TEST CONNTRACK: Testing request: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  retval = receive_and_test_packet(reply_frame, reply_len, &returnval);
+  if ((retval == true) && (returnval == 0)) {
+    printf("TEST CONNTRACK: Testing reply: OK\n");
+  } else {
+    printf("TEST CONNTRACK: Testing reply: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // a reply from another port of the same host is no reply
+  reply_flow.src_port = 7001;
+  reply_len = pktgen_udp(reply_frame, sizeof(reply_frame), &reply_flow, 1, 64,
+      0);
+  retval = receive_and_test_packet(reply_frame, reply_len, &returnval);
+  if ((retval == false) && (returnval == -1)) {
+    printf("TEST CONNTRACK: Testing other port: OK\n");
+  } else {
+    printf("TEST CONNTRACK: Testing other port: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "**************************************************\n"
+      "FAST LANE TEST"
+      "\n\n");
+
+  // 3 inspected datagrams to port 7100 make the flow trusted, of the next 8
+  // every 4th is inspected
+  struct firewall_stats lane_stats;
+  firewall_stats_get(&lane_stats);
+  uint64_t skipped = lane_stats.fast_lane_skipped;
+  uint64_t sampled = lane_stats.fast_lane_sampled;
+  request_flow.src_port = 40000;
+  request_flow.dst_port = 7100;
+  request_len = pktgen_udp(request_frame, sizeof(request_frame),
+      &request_flow, 1, 64, 0);
+  bool lane_ok = true;
+  for (int i = 0; i < 11; i++) {
+    lane_ok = lane_ok && send_and_test_packet(request_frame, request_len);
+  }
+  firewall_stats_get(&lane_stats);
+  if (lane_ok && (lane_stats.fast_lane_skipped - skipped == 6)
+      && (lane_stats.fast_lane_sampled - sampled == 2)) {
+    printf("TEST FAST LANE: Testing sampled inspection: OK\n");
+  } else {
+    printf("TEST FAST LANE: Testing sampled inspection: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  // a flow to port 7200 is inspected once, then its datagrams skip the
+  // filter for longer than `flow_timeout_ms` and still keep it open for
+  // replies to port 6968, which `packet_in` drops
+  request_flow.src_port = 6968;
+  request_flow.dst_port = 7200;
+  request_len = pktgen_udp(request_frame, sizeof(request_frame),
+      &request_flow, 1, 64, 0);
+  firewall_stats_get(&lane_stats);
+  skipped = lane_stats.fast_lane_skipped;
+  lane_ok = true;
+  for (int i = 0; i < 20; i++) {
+    lane_ok = lane_ok && send_and_test_packet(request_frame, request_len);
+  }
+  reply_flow.src_port = 7200;
+  reply_flow.dst_port = 6968;
+  reply_len = pktgen_udp(reply_frame, sizeof(reply_frame), &reply_flow, 1, 64,
+      0);
+  retval = receive_and_test_packet(reply_frame, reply_len, &returnval);
+  firewall_stats_get(&lane_stats);
+  if (lane_ok && (lane_stats.fast_lane_skipped - skipped == 19)
+      && (retval == true) && (returnval == 0)) {
+    printf("TEST FAST LANE: Testing replies to a skipping flow: OK\n");
+  } else {
+    printf("TEST FAST LANE: Testing replies to a skipping flow: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "**************************************************\n"
+      "SHADOW TEST"
+      "\n\n");
+
+  // every datagram from the wire goes through `shadow_in` as well, which
+  // drops port 7002 and passes port 6968, the other way round of `packet_in`
+  if (firewall_shadow_config(shadow_in, NULL, NULL, NULL, 1) != 0) {
+    printf("TEST SHADOW: Testing config: FAILED\n");
+    exit(1);
+  }
+  struct firewall_stats shadow_stats;
+  firewall_stats_get(&shadow_stats);
+  uint64_t samples = shadow_stats.shadow_samples;
+  uint64_t shadow_drops = shadow_stats.shadow_drops;
+  uint64_t shadow_passes = shadow_stats.shadow_passes;
+  reply_flow.src_port = 7002;
+  reply_flow.dst_port = 7002;
+  reply_len = pktgen_udp(reply_frame, sizeof(reply_frame), &reply_flow, 1, 64,
+      0);
+  retval = receive_and_test_packet(reply_frame, reply_len, &returnval);
+  firewall_stats_get(&shadow_stats);
+  if ((retval == true) && (returnval == 0)
+      && (shadow_stats.shadow_samples - samples == 1)
+      && (shadow_stats.shadow_drops - shadow_drops == 1)) {
+    printf("TEST SHADOW: Testing shadow drop: OK\n");
+  } else {
+    printf("TEST SHADOW: Testing shadow drop: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  reply_flow.src_port = 7003;
+  reply_flow.dst_port = 6968;
+  reply_len = pktgen_udp(reply_frame, sizeof(reply_frame), &reply_flow, 1, 64,
+      0);
+  retval = receive_and_test_packet(reply_frame, reply_len, &returnval);
+  firewall_stats_get(&shadow_stats);
+  if ((retval == false) && (returnval == -1)
+      && (shadow_stats.shadow_samples - samples == 2)
+      && (shadow_stats.shadow_passes - shadow_passes == 1)) {
+    printf("TEST SHADOW: Testing shadow pass: OK\n");
+  } else {
+    printf("TEST SHADOW: Testing shadow pass: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+  firewall_shadow_config(NULL, NULL, NULL, NULL, 0);
+
+  printf("\n\n"
+      "**************************************************\n"
+      "QUEUE TEST"
+      "\n\n");
+
+  // a burst of small frames, more than `max_enqueued_packets`, fills
+  // PACKETS_RX. With `static-memory` they outnumber the blocks of their class.
+  int burst = 1030;
+  struct firewall_stats queue_stats;
+  firewall_stats_get(&queue_stats);
+  uint64_t queue_drops = queue_stats.packets_rx_full_drops;
+  reply_flow.src_port = 7004;
+  reply_flow.dst_port = 7004;
+  reply_len = pktgen_udp(reply_frame, sizeof(reply_frame), &reply_flow, 1, 64,
+      0);
+  memcpy(ethdriver_buf, reply_frame, reply_len);
+  ethdbuf_len = reply_len;
+  ethdriver_burst = burst - 1;
+  int dequeued = 0;
+  returnval = client_rx(&rx_len);
+  ethdriver_ret = -1;
+  while (returnval != -1) {
+    dequeued++;
+    returnval = client_rx(&rx_len);
+  }
+  ethdriver_ret = 0;
+  firewall_stats_get(&queue_stats);
+  if ((dequeued == 1024)
+      && (queue_stats.packets_rx_full_drops - queue_drops == burst - 1024)) {
+    printf("TEST QUEUE: Testing burst of small frames: OK\n");
+  } else {
+    printf("TEST QUEUE: Testing burst of small frames: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
+
+  printf("\n\n"
+      "**************************************************\n"
+      "WATCHDOG TEST"
+      "\n\n");
+
+  // with a threshold of 1 cycle every call stalls, the snapshot of the last
+  // one is the `client_tx()` call of a datagram outside the fast lane,
+  // filter call included
+  firewall_watchdog_config(1, 0);
+  struct firewall_stats watchdog_stats;
+  firewall_stats_get(&watchdog_stats);
+  uint64_t stalls = watchdog_stats.stalls;
+  request_flow.dst_port = 7000;
+  request_len = pktgen_udp(request_frame, sizeof(request_frame),
+      &request_flow, 1, 64, 0);
+  retval = send_and_test_packet(request_frame, request_len);
+  firewall_watchdog_config(0, 0);
+  firewall_stats_get(&watchdog_stats);
+  struct firewall_stall stall;
+  bool filtered = false;
+  if (firewall_stall_get(0, &stall) == 0) {
+    for (int i = 0; i < WATCHDOG_TRACE_EVENTS; i++) {
+      filtered = filtered || ((stall.trace[i].direction == 0)
+          && (stall.trace[i].stage == STAGE_FILTER));
+    }
+  }
+  if (retval && (watchdog_stats.stalls - stalls == 1)
+      && (stall.sequence == watchdog_stats.stalls)
+      && (stall.kind == STALL_CALL) && (stall.direction == 0)
+      && (stall.stages[0] == STAGE_IDLE) && filtered) {
+    printf("TEST WATCHDOG: Testing stalled call: OK\n");
+  } else {
+    printf("TEST WATCHDOG: Testing stalled call: FAILED\n");
+    exit(1);
+  }
+  printf("\n");
   exit(1);
 
   printf("Testing many fragmented packets without clearing...\n");
@@ -46,7 +46,7 @@ uint8_t packet_bytes_arp[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x5e, 0x13,
     0x00, 0x01, 0x5e, 0x13, 0x5d, 0xa6, 0xc5, 0xf2, 0xc0, 0xa8, 0x45, 0x02,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0xa8, 0x45, 0x03 };
 
-// Multicast report, 110 bytes, should be dropped
+// MLDv2 report, 110 bytes, passed like IGMP
 uint8_t packet_bytes_multicast_report[] = { 0x33, 0x33, 0x00, 0x00, 0x00, 0x16,
     0x5e, 0x13, 0x5d, 0xa6, 0xc5, 0xf2, 0x86, 0xdd, 0x60, 0x00, 0x00, 0x00,
     0x00, 0x38, 0x00, 0x01, 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -1,54 +1,134 @@
 use super::*;
 use libc::c_void;
 use std::sync::Arc;
-use std::mem;
+use std::sync::atomic::Ordering;
+use std::ops::{Deref, DerefMut};
 
 use smoltcp::wire::{EthernetAddress, EthernetProtocol, EthernetFrame};
 use smoltcp::wire::{IpProtocol, IpAddress, Ipv4Repr, Ipv4Packet, Ipv4Address};
+use smoltcp::wire::{Ipv6Packet, Ipv6Address};
 use smoltcp::{Error, Result};
 use smoltcp::phy::ChecksumCapabilities;
 use smoltcp::wire::{UdpRepr, UdpPacket};
 use smoltcp::time::Instant;
-use smoltcp::iface::{FragmentSet, FragmentedPacket};
+
+use reassembly::{FragmentKey, FragmentSlots};
+use scratch::Arena;
 
 /// Custom implementation of a mutex struct
 /// Basically a wrapper around seL4/Camkes lock/unlock calls
+/// With the `lock-stats` feature every lock/unlock is recorded in `stats`
 #[derive(Debug)]
 pub struct Mutex {
     inner_lock: unsafe extern "C" fn(),
     inner_unlock: unsafe extern "C" fn(),
+    #[cfg(feature = "lock-stats")]
+    stats: &'static stats::LockStats,
 }
 
 impl Mutex {
-    pub fn new(lock: unsafe extern "C" fn(), unlock: unsafe extern "C" fn()) -> Mutex {
+    #[cfg_attr(not(feature = "lock-stats"), allow(unused_variables))]
+    pub fn new(
+        lock: unsafe extern "C" fn(),
+        unlock: unsafe extern "C" fn(),
+        stats: &'static stats::LockStats,
+    ) -> Mutex {
         Mutex {
             inner_lock: lock,
             inner_unlock: unlock,
+            #[cfg(feature = "lock-stats")]
+            stats: stats,
         }
     }
 
     pub fn lock(&self) {
+        #[cfg(feature = "lock-stats")]
+        let wait_start = self.stats.acquiring();
         unsafe {
             (self.inner_lock)();
         }
+        #[cfg(feature = "lock-stats")]
+        self.stats.acquired(wait_start);
     }
 
     pub fn unlock(&self) {
+        #[cfg(feature = "lock-stats")]
+        self.stats.releasing();
         unsafe {
             (self.inner_unlock)();
         }
     }
 }
 
+/// A `camkesrust::Mutex` that records its usage in `stats` with the `lock-stats` feature
+pub struct TrackedMutex<T> {
+    inner: camkesrust::Mutex<T>,
+    stats: &'static stats::LockStats,
+}
+
+impl<T> TrackedMutex<T> {
+    pub fn new(data: T, stats: &'static stats::LockStats) -> TrackedMutex<T> {
+        TrackedMutex {
+            inner: camkesrust::Mutex::new(data).unwrap(),
+            stats: stats,
+        }
+    }
+
+    pub fn lock<'a>(&'a self) -> TrackedGuard<impl DerefMut<Target = T> + 'a> {
+        #[cfg(feature = "lock-stats")]
+        let wait_start = self.stats.acquiring();
+        let guard = self.inner.lock();
+        #[cfg(feature = "lock-stats")]
+        self.stats.acquired(wait_start);
+        TrackedGuard {
+            guard: guard,
+            stats: self.stats,
+        }
+    }
+}
+
+/// Wraps the guard of the inner mutex, records the hold time when dropped
+pub struct TrackedGuard<G: DerefMut> {
+    guard: G,
+    #[allow(dead_code)]
+    stats: &'static stats::LockStats,
+}
+
+impl<G: DerefMut> Deref for TrackedGuard<G> {
+    type Target = G::Target;
+
+    fn deref(&self) -> &G::Target {
+        &self.guard
+    }
+}
+
+impl<G: DerefMut> DerefMut for TrackedGuard<G> {
+    fn deref_mut(&mut self) -> &mut G::Target {
+        &mut self.guard
+    }
+}
+
+#[cfg(feature = "lock-stats")]
+impl<G: DerefMut> Drop for TrackedGuard<G> {
+    fn drop(&mut self) {
+        self.stats.releasing();
+    }
+}
+
+/// `packet_in()` or `packet_out()` for UDP over IPv6: the addresses point to
+/// their 16 bytes in network byte order, the rest is the same
+pub type Filter6 = unsafe extern "C" fn(*const u8, u16, *const u8, u16, u16, *const u8, u16) -> i32;
+
 pub struct ExternalFirewallWrapper {
     f: unsafe extern "C" fn(u32, u16, u32, u16, u16, *const u8, u16) -> i32,
+    /// registered with `firewall_ipv6_filters()`, not linked, so that
+    /// external firewalls without IPv6 still link
+    f6: Option<Filter6>,
 }
 
 impl ExternalFirewallWrapper {
-    pub fn new(
-        f: unsafe extern "C" fn(u32, u16, u32, u16, u16, *const u8, u16) -> i32,
-    ) -> ExternalFirewallWrapper {
-        ExternalFirewallWrapper { f: f }
+    pub fn new(f: unsafe extern "C" fn(u32, u16, u32, u16, u16, *const u8, u16) -> i32) -> ExternalFirewallWrapper {
+        ExternalFirewallWrapper { f: f, f6: None }
     }
 
     pub fn call(
@@ -73,6 +153,37 @@ impl ExternalFirewallWrapper {
             )
         }
     }
+
+    /// `call` for UDP over IPv6, 0 (rejected) without an IPv6 filter
+    pub fn call6(
+        &self,
+        src_addr: &Ipv6Address,
+        src_port: u16,
+        dst_addr: &Ipv6Address,
+        dst_port: u16,
+        payload_len: u16,
+        payload: *const u8,
+        max_payload_len: u16,
+    ) -> i32 {
+        let f6 = match self.f6 {
+            Some(f6) => f6,
+            None => {
+                debug_print!("Firewall call6: no IPv6 filter, dropping");
+                return 0;
+            }
+        };
+        unsafe {
+            f6(
+                src_addr.as_bytes().as_ptr(),
+                src_port,
+                dst_addr.as_bytes().as_ptr(),
+                dst_port,
+                payload_len,
+                payload,
+                max_payload_len,
+            )
+        }
+    }
 }
 
 /// Declare static mutexes we wish to use
@@ -80,56 +191,97 @@ impl ExternalFirewallWrapper {
 /// lazy_statics use atomic spinlocks to ensure that the structures are only initialised once.
 lazy_static! {
     /// client/ethdriver protection
-    static ref MTX_ETHDRIVER_BUF: Arc<Mutex> = Arc::new(Mutex::new(externs::ethdriver_buf_lock, externs::ethdriver_buf_unlock));
-    static ref MTX_CLIENT_BUF: Arc<Mutex> = Arc::new(Mutex::new(externs::client_buf_lock, externs::client_buf_unlock));
+    static ref MTX_ETHDRIVER_BUF: Arc<Mutex> = Arc::new(Mutex::new(externs::ethdriver_buf_lock, externs::ethdriver_buf_unlock, &stats::LOCK_ETHDRIVER_BUF));
+    static ref MTX_CLIENT_BUF: Arc<Mutex> = Arc::new(Mutex::new(externs::client_buf_lock, externs::client_buf_unlock, &stats::LOCK_CLIENT_BUF));
 
     /// a wrapper for `packet_in`
-    pub static ref FN_PACKET_IN: Arc<camkesrust::Mutex<ExternalFirewallWrapper>> = {
+    pub static ref FN_PACKET_IN: Arc<TrackedMutex<ExternalFirewallWrapper>> = {
         let inner = ExternalFirewallWrapper::new(externs::packet_in);
-        Arc::new(camkesrust::Mutex::new(inner).unwrap())
+        Arc::new(TrackedMutex::new(inner, &stats::LOCK_FN_PACKET_IN))
     };
 
     /// a wrapper for `packet_out`
-    pub static ref FN_PACKET_OUT: Arc<camkesrust::Mutex<ExternalFirewallWrapper>> = {
+    pub static ref FN_PACKET_OUT: Arc<TrackedMutex<ExternalFirewallWrapper>> = {
         let inner = ExternalFirewallWrapper::new(externs::packet_out);
-        Arc::new(camkesrust::Mutex::new(inner).unwrap())
+        Arc::new(TrackedMutex::new(inner, &stats::LOCK_FN_PACKET_OUT))
     };
 
     /// fragments on rx side
-    pub static ref FRAGMENTS_RX: Arc<camkesrust::Mutex<FragmentSet<'static>>> = {
-        let mut fragments = FragmentSet::new(vec![]);
-        for _idx in 0..constants::SUPPORTED_FRAGMENTS {
-            let fragment = FragmentedPacket::new(vec![0; constants::MAX_REASSEMBLED_FRAGMENT_SIZE]);
-            fragments.add(fragment);
-        }
-        Arc::new(camkesrust::Mutex::new(fragments).unwrap())
+    pub static ref FRAGMENTS_RX: Arc<TrackedMutex<FragmentSlots>> = {
+        let config = config::get();
+        let fragments = FragmentSlots::new(config.supported_fragments, config.max_reassembled_fragment_size);
+        Arc::new(TrackedMutex::new(fragments, &stats::LOCK_FRAGMENTS_RX))
     };
 
     /// fragments on tx side
-    pub static ref FRAGMENTS_TX: Arc<camkesrust::Mutex<FragmentSet<'static>>> = {
-        let mut fragments = FragmentSet::new(vec![]);
-        for _idx in 0..constants::SUPPORTED_FRAGMENTS {
-            let fragment = FragmentedPacket::new(vec![0; constants::MAX_REASSEMBLED_FRAGMENT_SIZE]);
-            fragments.add(fragment);
-        }
-        Arc::new(camkesrust::Mutex::new(fragments).unwrap())
+    pub static ref FRAGMENTS_TX: Arc<TrackedMutex<FragmentSlots>> = {
+        let config = config::get();
+        let fragments = FragmentSlots::new(config.supported_fragments, config.max_reassembled_fragment_size);
+        Arc::new(TrackedMutex::new(fragments, &stats::LOCK_FRAGMENTS_TX))
     };
 
+    /// scratch memory of the frame being processed on tx side
+    pub static ref SCRATCH_TX: ::spin::Mutex<Arena> = ::spin::Mutex::new(new_scratch());
+
+    /// scratch memory of the frame being processed on rx side
+    pub static ref SCRATCH_RX: ::spin::Mutex<Arena> = ::spin::Mutex::new(new_scratch());
+
     /// enqued eth_frames to be send
-    pub static ref PACKETS_TX: Arc<camkesrust::Mutex<Vec<Vec<u8>>>> = Arc::new(camkesrust::Mutex::new(vec![]).unwrap());
+    pub static ref PACKETS_TX: Arc<TrackedMutex<Vec<Vec<u8>>>> = Arc::new(TrackedMutex::new(vec![], &stats::LOCK_PACKETS_TX));
 
     /// enqued eth_frames to be passed to the client
-    pub static ref PACKETS_RX: Arc<camkesrust::Mutex<Vec<Vec<u8>>>> = Arc::new(camkesrust::Mutex::new(vec![]).unwrap());
+    pub static ref PACKETS_RX: Arc<TrackedMutex<Vec<Vec<u8>>>> = Arc::new(TrackedMutex::new(vec![], &stats::LOCK_PACKETS_RX));
 
     /// kludge to prevent reentrancy around client_rx/tx calls
-    pub static ref RET_CLIENT_TX: Arc<camkesrust::Mutex<i32>> = Arc::new(camkesrust::Mutex::new(-1).unwrap());
-    pub static ref RET_CLIENT_RX: Arc<camkesrust::Mutex<i32>> = Arc::new(camkesrust::Mutex::new(-1).unwrap());
+    pub static ref RET_CLIENT_TX: Arc<TrackedMutex<i32>> = Arc::new(TrackedMutex::new(-1, &stats::LOCK_RET_CLIENT_TX));
+    pub static ref RET_CLIENT_RX: Arc<TrackedMutex<i32>> = Arc::new(TrackedMutex::new(-1, &stats::LOCK_RET_CLIENT_RX));
 
     /// Our mac address won't change at runtime, so we will save the value once we know it.
     pub static ref CLIENT_MAC_ADDRESS:EthernetAddress = get_device_mac();
 
 }
 
+/// Register the external firewall's filters for UDP over IPv6, e.g.
+/// `packet_in6()` and `packet_out6()`. Until then UDP over IPv6 is dropped.
+/// Returns 0, or -1 if either is NULL.
+#[no_mangle]
+pub extern "C" fn firewall_ipv6_filters(filter_in6: Option<Filter6>, filter_out6: Option<Filter6>) -> i32 {
+    if filter_in6.is_none() || filter_out6.is_none() {
+        return -1;
+    }
+    FN_PACKET_IN.lock().f6 = filter_in6;
+    FN_PACKET_OUT.lock().f6 = filter_out6;
+    0
+}
+
+/// `addr` the way the external firewall takes it, the address bytes in
+/// memory order
+pub fn ipv4_word(addr: &Ipv4Address) -> u32 {
+    let mut bytes = [0, 0, 0, 0];
+    bytes[..].clone_from_slice(addr.as_bytes());
+    unsafe { std::mem::transmute::<[u8; 4], u32>(bytes) }
+}
+
+/// Room for the temporaries of the largest packet, see `scratch.rs`
+fn new_scratch() -> Arena {
+    Arena::new(constants::SCRATCH_CHUNKS, config::get().max_reassembled_fragment_size)
+}
+
+/// Allocate the reassembly slots, the scratch arenas and both queues at their
+/// full size, so that frames only ever take blocks from the slabs for as long
+/// as they are queued or processed, see `slab.rs`
+#[cfg(feature = "static-memory")]
+pub fn reserve_pools() {
+    let max = config::get().max_enqueued_packets;
+    ::lazy_static::initialize(&FRAGMENTS_RX);
+    ::lazy_static::initialize(&FRAGMENTS_TX);
+    ::lazy_static::initialize(&SCRATCH_RX);
+    ::lazy_static::initialize(&SCRATCH_TX);
+    flows::reserve();
+    PACKETS_RX.lock().reserve_exact(max);
+    PACKETS_TX.lock().reserve_exact(max);
+}
+
 /// A safe wrapper around `client_buf` ptr
 pub fn client_buf_value() -> *mut c_void {
     unsafe {
@@ -153,7 +305,7 @@ fn sel4_buffer_insert(data: Vec<u8>, buffer: *mut c_void) -> usize {
     unsafe {
         let len = data.len();
         assert!(!buffer.is_null());
-        assert!(len < constants::BUFFER_SIZE);
+        assert!(len < config::get().buffer_size);
         let buf_ptr = std::mem::transmute::<*mut c_void, *mut u8>(buffer);
         let slice = std::slice::from_raw_parts_mut(buf_ptr, len);
         slice[..].clone_from_slice(data.as_slice());
@@ -165,7 +317,7 @@ fn sel4_buffer_insert(data: Vec<u8>, buffer: *mut c_void) -> usize {
 fn sel4_buffer_fetch(len: usize, buffer: *mut c_void) -> Vec<u8> {
     unsafe {
         assert!(!buffer.is_null());
-        assert!(len < constants::BUFFER_SIZE);
+        assert!(len < config::get().buffer_size);
         // create a slice of length `len` from the buffer
         let local_buf_ptr = std::mem::transmute::<*mut c_void, *mut u8>(buffer);
         let slice = std::slice::from_raw_parts(local_buf_ptr, len);
@@ -175,6 +327,15 @@ fn sel4_buffer_fetch(len: usize, buffer: *mut c_void) -> Vec<u8> {
     }
 }
 
+/// The destination MAC address of the frame in `buffer`
+fn sel4_buffer_peek_mac(buffer: *mut c_void) -> EthernetAddress {
+    unsafe {
+        assert!(!buffer.is_null());
+        let buf_ptr = std::mem::transmute::<*mut c_void, *const u8>(buffer);
+        EthernetAddress::from_bytes(std::slice::from_raw_parts(buf_ptr, 6))
+    }
+}
+
 /// attempt to send `data` to the outside world
 /// return 0 if data were successfully queued to the ethdriver
 /// return -1 otherwise
@@ -204,28 +365,36 @@ impl Iterator for EthdriverRxStatus {
 
     type Item = Vec<u8>;
     /// Attempt to recieve data from the ethdriver
+    /// Multicast frames for groups the client isn't in are skipped
+    /// before they are copied out of the buffer
     fn next(&mut self) -> Option<Vec<u8>> {
-        if self.finished {
-            return None;
-        }
-        MTX_ETHDRIVER_BUF.lock();
-        let mut len: i32 = 0;
-        let ret = unsafe { externs::ethdriver_rx(&mut len) };
-
-        let status = match ret {
-            -1 => None, // no data available
-            e @ 0 ... 1 => { // Data available
-                if let 0 = e {
-                    self.finished = true;  // This is the last packet available
-                }
-                let data = sel4_buffer_fetch(len as usize, ethdriver_buf_value());
-                Some(data)
-
+        loop {
+            if self.finished {
+                return None;
             }
-            _ => panic!("Unexpected return value from ethdriver_rx"),
-        };
-        MTX_ETHDRIVER_BUF.unlock();
-        status
+            MTX_ETHDRIVER_BUF.lock();
+            let mut len: i32 = 0;
+            let ret = unsafe { externs::ethdriver_rx(&mut len) };
+
+            let status = match ret {
+                -1 => None, // no data available
+                e @ 0 ... 1 => { // Data available
+                    if let 0 = e {
+                        self.finished = true;  // This is the last packet available
+                    }
+                    if len >= 6 && !mcast::accept(&sel4_buffer_peek_mac(ethdriver_buf_value())) {
+                        MTX_ETHDRIVER_BUF.unlock();
+                        continue;
+                    }
+                    let data = sel4_buffer_fetch(len as usize, ethdriver_buf_value());
+                    Some(data)
+
+                }
+                _ => panic!("Unexpected return value from ethdriver_rx"),
+            };
+            MTX_ETHDRIVER_BUF.unlock();
+            return status;
+        }
     }
 }
 
@@ -273,31 +442,27 @@ pub fn get_pseudorandom_packet_id() -> u16 {
     }
 }
 
-/// Get a "fake" timestamp to help purge fragmnets set
-fn timestamp() -> Instant {
-    static mut MS: i64 = 0;
-    unsafe {
-        MS += 1; // helper for managing too-old fragments
-    }
-    let timestamp = unsafe { Instant::from_millis(MS) };
-    timestamp
-}
-
 /// Return OK if an eth_packet was enqued to the packet buffer,
 /// otherwise return an error message
 /// The program flow is as follows:
 /// Check EtherType:
-///		- Arp: pass through (enqueue directly)
+///		- Arp: answer requests for the client from the wire (see `arp.rs`),
+///		       pass through (enqueue directly) the rest
 ///     - Ipv4: check further:
 ///				- 0 to N packedts returned: enqueue to `packet_buffer`
 ///				- error returned: propagate error
-///     - other: drop
+///     - Ipv6: same as Ipv4, see `process_ipv6()`
+///     - other: drop, return Error::Unrecognized
 pub fn process_ethernet(
     frame: Vec<u8>,
-    packet_buffer: Arc<camkesrust::Mutex<Vec<Vec<u8>>>>,
-    fragment_buffer: Arc<camkesrust::Mutex<FragmentSet<'static>>>,
-    external_firewall_fn: Arc<camkesrust::Mutex<ExternalFirewallWrapper>>,
+    packet_buffer: Arc<TrackedMutex<Vec<Vec<u8>>>>,
+    fragment_buffer: Arc<TrackedMutex<FragmentSlots>>,
+    external_firewall_fn: Arc<TrackedMutex<ExternalFirewallWrapper>>,
     check_mac: bool,
+    egress_mtu: usize,
+    stats: &'static stats::DirectionStats,
+    role: flows::Role,
+    scratch: &Arena,
 ) -> Result<()> {
     let eth_frame = EthernetFrame::new_checked(frame)?;
 
@@ -316,6 +481,7 @@ pub fn process_ethernet(
                 && eth_frame.dst_addr() != local_ethernet_addr
             {
                 debug_print!("Firewall process_ethernet: The packet wasn't for us, quitely drop it");
+                capture::record_dropped(&eth_frame.into_inner());
                 return Ok(());
             }
         }
@@ -328,60 +494,90 @@ pub fn process_ethernet(
     match eth_frame.ethertype() {
         EthernetProtocol::Ipv4 => {
             debug_print!("Firewall process_ethernet: processing IPv4");
-            match process_ipv4(eth_frame, fragment_buffer, external_firewall_fn) {
-                Ok(mut packets) => {
-                    // enqueue frames
-                    let mut buffer = packet_buffer.lock();
-                    while !packets.is_empty() && buffer.len() < constants::MAX_ENQUEUED_PACKETS {
-                        let eth_frame = packets.remove(0);
-                        buffer.push(eth_frame.into_inner());
-                    }
-                }
-                Err(e) => return Err(e),
-            }
+            let packets = process_ipv4(eth_frame, fragment_buffer, external_firewall_fn, egress_mtu, &stats.reassembly, role, scratch)?;
+            enqueue_frames(packets, &packet_buffer, stats);
         }
         EthernetProtocol::Ipv6 => {
-            // Ipv6 traffic is not allowed
-            debug_print!("Firewall process_ethernet: dropping IPV6 traffic");
+            debug_print!("Firewall process_ethernet: processing IPv6");
+            let packets = process_ipv6(eth_frame, fragment_buffer, external_firewall_fn, egress_mtu, &stats.reassembly, role, scratch)?;
+            enqueue_frames(packets, &packet_buffer, stats);
         }
         EthernetProtocol::Arp => {
+            let eth_frame = eth_frame.into_inner();
+            // requests from the wire for the client's addresses are answered right away
+            if check_mac {
+                if let Some(reply) = arp::reply_to(&eth_frame) {
+                    debug_print!("process_ethernet client_rx: answering ARP request for the client");
+                    if dispatch_data_to_ethdriver(reply) == -1 {
+                        arp::REPLY_FAILURES.fetch_add(1, Ordering::Relaxed);
+                    }
+                    return Ok(());
+                }
+            }
             // Arp traffic is allowed, pass-through
             debug_print!("process_ethernet client_tx: passing through ARP traffic");
             // enqueue unchanged frame
             let mut buffer = packet_buffer.lock();
-            if buffer.len() < constants::MAX_ENQUEUED_PACKETS {
-                buffer.push(eth_frame.into_inner());    
+            if buffer.len() < config::get().max_enqueued_packets {
+                stats.queue.pushed(buffer.len(), eth_frame.len());
+                buffer.push(eth_frame);
+            } else {
+                stats.queue.dropped_full();
+                capture::record_dropped(&eth_frame);
             }
         }
         _ => {
             // drop unrecognized protocol
             debug_print!("Firewall process_ethernet: drop unrecognized eth protocol");
+            return Err(Error::Unrecognized);
         }
     }
 
     Ok(())
 }
 
+/// Enqueue `packets` to `packet_buffer`, the ones that don't fit are dropped
+fn enqueue_frames(
+    mut packets: Vec<EthernetFrame<Vec<u8>>>,
+    packet_buffer: &TrackedMutex<Vec<Vec<u8>>>,
+    stats: &stats::DirectionStats,
+) {
+    let mut buffer = packet_buffer.lock();
+    while !packets.is_empty() && buffer.len() < config::get().max_enqueued_packets {
+        let eth_frame = packets.remove(0).into_inner();
+        stats.queue.pushed(buffer.len(), eth_frame.len());
+        buffer.push(eth_frame);
+    }
+    for eth_frame in packets {
+        stats.queue.dropped_full();
+        capture::record_dropped(&eth_frame.into_inner());
+    }
+}
+
 /// A helper function that splits a large IPv4 packet into multiple fragmented
-/// packets that fit MTU
+/// packets that fit `mtu`, the MTU of the port they leave through
 
-fn fragment_large_udp_packet(
-    udp_packet: UdpPacket<Vec<u8>>,
+fn fragment_large_udp_packet<'s>(
+    udp_packet: &[u8],
     src_addr: Ipv4Address,
     dst_addr: Ipv4Address,
     packet_id: u16,
-) -> Result<Vec<Ipv4Packet<Vec<u8>>>> {
+    mtu: usize,
+    scratch: &'s Arena,
+) -> Result<Vec<Ipv4Packet<&'s mut [u8]>>> {
     // initialize variables
-    let udp_packet = udp_packet.into_inner();
     let mut start_len = 0;
-    let mut end_len = constants::MTU_UDP;
+    // fragment offsets are in units of 8 bytes
+    let mtu_udp = (mtu - constants::IPV4_HEADER_SIZE) & !7;
+    let mut end_len = mtu_udp;
     let mut fragment_offset = 0;
     let mut remaining_len = udp_packet.len();
     let mut packet_id = packet_id;
 
     let mut ipv4_packet_buffer = vec![];
 
-    if remaining_len < end_len {
+    // a packet that fits the MTU goes out whole
+    if remaining_len <= mtu - constants::IPV4_HEADER_SIZE {
         let ip_repr = Ipv4Repr {
             src_addr: src_addr,
             dst_addr: dst_addr,
@@ -390,12 +586,12 @@ fn fragment_large_udp_packet(
             hop_limit: 64,
         };
         let ip_packet = {
-            let mut ip_packet = Ipv4Packet::new(vec![0; ip_repr.buffer_len() + udp_packet.len()]);
+            let mut ip_packet = Ipv4Packet::new(scratch.alloc(ip_repr.buffer_len() + udp_packet.len()).ok_or(Error::Exhausted)?);
             ip_repr.emit(&mut ip_packet, &ChecksumCapabilities::default());
             ip_packet.set_ident(packet_id);
             ip_packet
                 .payload_mut()
-                .copy_from_slice(udp_packet.as_slice());
+                .copy_from_slice(udp_packet);
             ip_packet.fill_checksum();
             ip_packet
         };
@@ -411,12 +607,12 @@ fn fragment_large_udp_packet(
                 src_addr: src_addr,
                 dst_addr: dst_addr,
                 protocol: IpProtocol::Udp,
-                payload_len: constants::MTU_UDP,
+                payload_len: mtu_udp,
                 hop_limit: 64,
             };
             let ip_packet = {
                 let mut ip_packet =
-                    Ipv4Packet::new(vec![0; ip_repr.buffer_len() + constants::MTU_UDP]);
+                    Ipv4Packet::new(scratch.alloc(ip_repr.buffer_len() + mtu_udp).ok_or(Error::Exhausted)?);
                 ip_repr.emit(&mut ip_packet, &ChecksumCapabilities::default());
                 ip_packet
                     .payload_mut()
@@ -432,26 +628,26 @@ fn fragment_large_udp_packet(
         }
 
         // update remaining len
-        remaining_len -= constants::MTU_UDP;
+        remaining_len -= mtu_udp;
 
-        while remaining_len > constants::MTU_UDP {
+        while remaining_len > mtu_udp {
             // create middle packets
 
             // update indices
-            start_len += constants::MTU_UDP;
-            end_len += constants::MTU_UDP;
-            fragment_offset += constants::MTU_UDP as u16;
+            start_len += mtu_udp;
+            end_len += mtu_udp;
+            fragment_offset += mtu_udp as u16;
 
             let ip_repr = Ipv4Repr {
                 src_addr: src_addr,
                 dst_addr: dst_addr,
                 protocol: IpProtocol::Udp,
-                payload_len: constants::MTU_UDP,
+                payload_len: mtu_udp,
                 hop_limit: 64,
             };
             let ip_packet = {
                 let mut ip_packet =
-                    Ipv4Packet::new(vec![0; ip_repr.buffer_len() + constants::MTU_UDP]);
+                    Ipv4Packet::new(scratch.alloc(ip_repr.buffer_len() + mtu_udp).ok_or(Error::Exhausted)?);
                 ip_repr.emit(&mut ip_packet, &ChecksumCapabilities::default());
                 ip_packet
                     .payload_mut()
@@ -465,14 +661,14 @@ fn fragment_large_udp_packet(
             };
             ipv4_packet_buffer.push(ip_packet);
             // update remaining len
-            remaining_len -= constants::MTU_UDP;
+            remaining_len -= mtu_udp;
         }
 
         {
             // create the last packet
             // update indices
-            start_len += constants::MTU_UDP;
-            fragment_offset += constants::MTU_UDP as u16;
+            start_len += mtu_udp;
+            fragment_offset += mtu_udp as u16;
 
             let ip_repr = Ipv4Repr {
                 src_addr: src_addr,
@@ -482,7 +678,7 @@ fn fragment_large_udp_packet(
                 hop_limit: 64,
             };
             let ip_packet = {
-                let mut ip_packet = Ipv4Packet::new(vec![0; ip_repr.buffer_len() + remaining_len]);
+                let mut ip_packet = Ipv4Packet::new(scratch.alloc(ip_repr.buffer_len() + remaining_len).ok_or(Error::Exhausted)?);
                 ip_repr.emit(&mut ip_packet, &ChecksumCapabilities::default());
                 ip_packet
                     .payload_mut()
@@ -531,30 +727,31 @@ fn shave_crc_from_ipv4<'frame>(
 ///
 ///  - check ipv4 protocol:
 ///		- ICMP/IGMP: pass through
+///	    - UDP replying to a flow of the client or in a fast lane: pass through
 ///	    - UDP: check payload further
 ///				- a single UDP packet returned
 ///             - no packet returned, return Error:Dropped
 ///				- error returned: propagate error
 ///     - other: drop
 ///
-///  - if Ipv4 packet > MTU, fragment the packet and enqueue the fragments
+///  - if Ipv4 packet > `egress_mtu`, fragment the packet and enqueue the fragments
 ///
 fn process_ipv4(
     eth_frame: EthernetFrame<Vec<u8>>,
-    fragment_buffer: Arc<camkesrust::Mutex<FragmentSet<'static>>>,
-    external_firewall_fn: Arc<camkesrust::Mutex<ExternalFirewallWrapper>>,
+    fragment_buffer: Arc<TrackedMutex<FragmentSlots>>,
+    external_firewall_fn: Arc<TrackedMutex<ExternalFirewallWrapper>>,
+    egress_mtu: usize,
+    reassembly_stats: &stats::ReassemblyStats,
+    role: flows::Role,
+    scratch: &Arena,
 ) -> Result<Vec<EthernetFrame<Vec<u8>>>> {
     // eth packet contains the original eth data
-    let mut eth_packet = eth_frame.into_inner();
-    // eth payload contains the payload only, and is to be modified
-    let mut eth_payload = {
-        let mut payload = vec![];
-        payload.extend_from_slice(&eth_packet[constants::ETHERNET_FRAME_PAYLOAD..]);
-        payload
-    };
+    let eth_packet = eth_frame.into_inner();
+    // the reassembled packet, if `eth_packet` completes one
+    let mut reassembled = None;
 
     // return structures
-    let mut ipv4_packet_buffer: Vec<Ipv4Packet<Vec<u8>>> = vec![];
+    let mut ipv4_packet_buffer: Vec<Ipv4Packet<&mut [u8]>> = vec![];
     let mut eth_packet_buffer: Vec<EthernetFrame<Vec<u8>>> = vec![];
     {
         let eth_frame = EthernetFrame::new_checked(&eth_packet)?;
@@ -568,17 +765,24 @@ fn process_ipv4(
                 && ipv4_packet.protocol() == IpProtocol::Udp
             {
                 debug_print!("Firewall process_ipv4: fragmented packet detected");
+                watchdog::stage(role, watchdog::Stage::Reassembly);
                 let mut fragments = fragment_buffer.lock();
-                match process_ipv4_fragment(ipv4_packet, timestamp(), &mut fragments)? {
+                let assembled = process_ipv4_fragment(ipv4_packet, clock::now(), &mut fragments, reassembly_stats);
+                watchdog::stage(role, watchdog::Stage::Ethernet);
+                match assembled? {
                     Some(assembled_ipv4_payload) => {
-                        eth_payload = assembled_ipv4_payload;
+                        reassembled = Some(assembled_ipv4_payload);
                     }
                     None => return Err(Error::Fragmented),
                 }
             }
         }
 
-        let ipv4_packet = shave_crc_from_ipv4(Ipv4Packet::new_checked(&eth_payload[..])?)?;
+        let eth_payload = match reassembled {
+            Some(ref packet) => &packet[..],
+            None => eth_frame.payload(),
+        };
+        let ipv4_packet = shave_crc_from_ipv4(Ipv4Packet::new_checked(eth_payload)?)?;
         //let ipv4_packet = shave_crc_from_ipv4(Ipv4Packet::new_checked(eth_frame.payload())?)?;
         //let ipv4_packet = Ipv4Packet::new_checked(eth_frame.payload())?;
         let checksum_caps = ChecksumCapabilities::default();
@@ -587,6 +791,11 @@ fn process_ipv4(
         debug_print!("Firewall process_ipv4: ipv4 protocol = {}", ipv4_repr.protocol);
 
         match ipv4_repr.protocol {
+            IpProtocol::Icmp | IpProtocol::Igmp if ipv4_packet.total_len() as usize > egress_mtu => {
+                // only UDP is fragmented on the way out, the rest has to fit as it is
+                debug_print!("Firewall process_ipv4: packet larger than the egress MTU, dropping");
+                return Err(Error::Exhausted);
+            }
             IpProtocol::Icmp => {
                 // passthrough
                 debug_print!("Firewall process_ipv4: ICMP protocol, returning unchanged");
@@ -595,18 +804,33 @@ fn process_ipv4(
                 //* passthrough
                 debug_print!("Firewall process_ipv4: I protocol, returning unchanged");
             }
+            IpProtocol::Udp
+                if reassembled.is_none() && ipv4_packet.total_len() as usize <= egress_mtu
+                    && skips_filter(
+                        role,
+                        IpAddress::from(ipv4_repr.src_addr),
+                        IpAddress::from(ipv4_repr.dst_addr),
+                        ipv4_packet.payload(),
+                    )? =>
+            {
+                // passthrough
+                debug_print!("Firewall process_ipv4: UDP of a known flow, returning unchanged");
+            }
             IpProtocol::Udp => {
                 // check with external firewall
                 debug_print!("Firewall process_ipv4: UDP protocol, parsing further");
                 let ident = ipv4_packet.ident();
-                match process_udp(ipv4_repr, ipv4_packet.payload(), external_firewall_fn) {
+                let (src_addr, dst_addr) = (IpAddress::from(ipv4_repr.src_addr), IpAddress::from(ipv4_repr.dst_addr));
+                match process_udp(src_addr, dst_addr, ipv4_packet.payload(), external_firewall_fn, role, scratch) {
                     Ok(udp_packet) => {
                         debug_print!("Firewall process_ipv4: UDP packet returned, parsing/fragmenting");
                         match fragment_large_udp_packet(
-                            udp_packet,
+                            udp_packet.into_inner(),
                             ipv4_packet.src_addr(),
                             ipv4_packet.dst_addr(),
                             ident,
+                            egress_mtu,
+                            scratch,
                         ) {
                             Ok(mut ipv4_packets) => {
                                 debug_print!(
@@ -647,19 +871,306 @@ fn process_ipv4(
     } else {
         debug_print!("Firewall process_ipv4: we have 1 to N Ipv4 packets we need to enqueue");
         let mut _cnt = 0;
-        while !ipv4_packet_buffer.is_empty() {
+        for ipv4_packet in ipv4_packet_buffer {
             _cnt += 1;
             debug_print!("Firewall process_ipv4: enqued {} packets", _cnt);
-            let ipv4_packet = ipv4_packet_buffer.remove(0);
-            eth_packet.truncate(constants::ETHERNET_FRAME_PAYLOAD);
-            eth_packet.append(&mut ipv4_packet.into_inner());
-            eth_packet_buffer.push(EthernetFrame::new_checked(eth_packet.clone())?);
+            let ipv4_packet = ipv4_packet.into_inner();
+            let mut frame = Vec::with_capacity(constants::ETHERNET_FRAME_PAYLOAD + ipv4_packet.len());
+            frame.extend_from_slice(&eth_packet[..constants::ETHERNET_FRAME_PAYLOAD]);
+            frame.extend_from_slice(ipv4_packet);
+            eth_packet_buffer.push(EthernetFrame::new_checked(frame)?);
         }
     }
 
     Ok(eth_packet_buffer)
 }
 
+/// ICMPv6 errors, destination unreachable to parameter problem (RFC 4443),
+/// packet too big among them, which path MTU discovery depends on
+const ICMPV6_DEST_UNREACHABLE: u8 = 1;
+const ICMPV6_PARAM_PROBLEM: u8 = 4;
+/// MLD queries, reports and done (RFC 2710), and MLDv2 reports (RFC 3810)
+const ICMPV6_MLD_QUERY: u8 = 130;
+const ICMPV6_MLD_DONE: u8 = 132;
+const ICMPV6_MLD2_REPORT: u8 = 143;
+/// ICMPv6 neighbor discovery messages, router solicitation to redirect (RFC 4861)
+const ICMPV6_ROUTER_SOLICIT: u8 = 133;
+const ICMPV6_REDIRECT: u8 = 137;
+
+/// Where the headers of an IPv6 packet are, see `walk_ipv6_headers()`
+#[derive(Debug, Clone, Copy)]
+struct Ipv6Headers {
+    /// upper-layer protocol, for a fragment the header after the fragment header
+    protocol: IpProtocol,
+    /// start of the upper-layer header
+    l4_offset: usize,
+    /// for a fragment, the start of its fragment header and of the next
+    /// header field pointing to it
+    fragment: Option<(usize, usize)>,
+}
+
+/// Find the upper-layer protocol of `packet`, an IPv6 header and its payload.
+/// At most `MAX_IPV6_EXTENSION_HEADERS` Hop-by-Hop, Routing, Fragment and
+/// Destination Options headers are followed, in place and without allocating.
+/// The walk ends at the fragment header of a fragment, the headers after it
+/// are only known after reassembly. Atomic fragments (RFC 6946) are walked through.
+fn walk_ipv6_headers(packet: &[u8]) -> Result<Ipv6Headers> {
+    let mut protocol = IpProtocol::from(packet[6]);
+    let mut next_header_offset = 6;
+    let mut offset = constants::IPV6_HEADER_SIZE;
+    for _ in 0..constants::MAX_IPV6_EXTENSION_HEADERS {
+        let header_len = match protocol {
+            // only allowed right after the IPv6 header (RFC 8200)
+            IpProtocol::HopByHop if offset != constants::IPV6_HEADER_SIZE => return Err(Error::Malformed),
+            IpProtocol::HopByHop | IpProtocol::Ipv6Route | IpProtocol::Ipv6Opts => {
+                if offset + 8 > packet.len() {
+                    return Err(Error::Truncated);
+                }
+                (packet[offset + 1] as usize + 1) * 8
+            }
+            IpProtocol::Ipv6Frag => constants::IPV6_FRAGMENT_HEADER_SIZE,
+            _ => {
+                return Ok(Ipv6Headers {
+                    protocol: protocol,
+                    l4_offset: offset,
+                    fragment: None,
+                })
+            }
+        };
+        if offset + header_len > packet.len() {
+            return Err(Error::Truncated);
+        }
+        match protocol {
+            // type 0 routing headers are deprecated (RFC 5095)
+            IpProtocol::Ipv6Route if packet[offset + 2] == 0 && packet[offset + 3] != 0 => {
+                return Err(Error::Malformed);
+            }
+            // a fragment offset or the more fragments flag
+            IpProtocol::Ipv6Frag if packet[offset + 2] != 0 || packet[offset + 3] & 0xf9 != 0 => {
+                return Ok(Ipv6Headers {
+                    protocol: IpProtocol::from(packet[offset]),
+                    l4_offset: offset + header_len,
+                    fragment: Some((offset, next_header_offset)),
+                });
+            }
+            _ => {}
+        }
+        protocol = IpProtocol::from(packet[offset]);
+        next_header_offset = offset;
+        offset += header_len;
+    }
+    debug_print!("Firewall walk_ipv6_headers: too many extension headers");
+    Err(Error::Malformed)
+}
+
+/// Return a vector of ethernet frames resulting from processing the `eth_frame`
+/// Input is a single Ipv6 ethernet frame, output can be zero or more frames
+/// Process frame:
+///  - walk the extension headers, see `walk_ipv6_headers()`
+///  - fragment: reassemble in `fragment_buffer`, next to the IPv4 fragments,
+///    and walk the reassembled packet
+///  - check the upper-layer protocol:
+///     - ICMPv6 errors and MLD: pass through
+///     - ICMPv6 neighbor discovery: pass through, unless it was fragmented
+///     - UDP: check with the external firewall, the packet is rebuilt
+///       without extension headers and fragmented to `egress_mtu`
+///     - other: drop
+fn process_ipv6(
+    eth_frame: EthernetFrame<Vec<u8>>,
+    fragment_buffer: Arc<TrackedMutex<FragmentSlots>>,
+    external_firewall_fn: Arc<TrackedMutex<ExternalFirewallWrapper>>,
+    egress_mtu: usize,
+    reassembly_stats: &stats::ReassemblyStats,
+    role: flows::Role,
+    scratch: &Arena,
+) -> Result<Vec<EthernetFrame<Vec<u8>>>> {
+    let eth_packet = eth_frame.into_inner();
+    let ipv6_packet_buffer = {
+        // without the Ethernet padding and CRC
+        let packet = {
+            let ipv6_packet = Ipv6Packet::new_checked(&eth_packet[constants::ETHERNET_FRAME_PAYLOAD..])?;
+            if ipv6_packet.version() != 6 {
+                return Err(Error::Malformed);
+            }
+            let len = constants::IPV6_HEADER_SIZE + ipv6_packet.payload_len() as usize;
+            &ipv6_packet.into_inner()[..len]
+        };
+
+        let mut headers = walk_ipv6_headers(packet)?;
+        let fragmented = headers.fragment.is_some();
+        let mut ident = None;
+        let reassembled;
+        let packet = match headers.fragment {
+            Some(fragment) => {
+                debug_print!("Firewall process_ipv6: fragmented packet detected");
+                let fragment_header = &packet[fragment.0..];
+                ident = Some(
+                    (fragment_header[4] as u32) << 24 | (fragment_header[5] as u32) << 16
+                        | (fragment_header[6] as u32) << 8 | fragment_header[7] as u32,
+                );
+                watchdog::stage(role, watchdog::Stage::Reassembly);
+                let mut fragments = fragment_buffer.lock();
+                let assembled = process_ipv6_fragment(packet, fragment, clock::now(), &mut fragments, reassembly_stats);
+                watchdog::stage(role, watchdog::Stage::Ethernet);
+                match assembled? {
+                    Some(assembled_ipv6_packet) => reassembled = assembled_ipv6_packet,
+                    None => return Err(Error::Fragmented),
+                }
+                headers = walk_ipv6_headers(&reassembled)?;
+                if headers.fragment.is_some() {
+                    return Err(Error::Malformed);
+                }
+                &reassembled[..]
+            }
+            None => packet,
+        };
+
+        debug_print!("Firewall process_ipv6: ipv6 protocol = {}", headers.protocol);
+
+        match headers.protocol {
+            IpProtocol::Icmpv6 => {
+                // errors and MLD pass like ICMP and IGMP over IPv4, neighbor
+                // discovery is never fragmented (RFC 6980)
+                match packet.get(headers.l4_offset) {
+                    Some(&(ICMPV6_DEST_UNREACHABLE..=ICMPV6_PARAM_PROBLEM)) => {}
+                    Some(&(ICMPV6_MLD_QUERY..=ICMPV6_MLD_DONE)) | Some(&ICMPV6_MLD2_REPORT) => {}
+                    Some(&(ICMPV6_ROUTER_SOLICIT..=ICMPV6_REDIRECT)) if !fragmented => {}
+                    _ => {
+                        debug_print!("Firewall process_ipv6: ICMPv6 other than errors, MLD and neighbor discovery, dropping");
+                        return Err(Error::Unrecognized);
+                    }
+                }
+                if packet.len() > egress_mtu {
+                    debug_print!("Firewall process_ipv6: packet larger than the egress MTU, dropping");
+                    return Err(Error::Exhausted);
+                }
+                // passthrough
+                debug_print!("Firewall process_ipv6: ICMPv6 control message, returning unchanged");
+                vec![]
+            }
+            IpProtocol::Udp => {
+                // check with external firewall
+                debug_print!("Firewall process_ipv6: UDP protocol, parsing further");
+                let udp_payload = &packet[headers.l4_offset..];
+                // the UDP checksum is mandatory with IPv6 (RFC 8200)
+                if udp_payload.len() >= constants::UDP_HEADER_SIZE && udp_payload[6..8] == [0, 0] {
+                    return Err(Error::Checksum);
+                }
+                let ipv6_packet = Ipv6Packet::new_checked(packet)?;
+                let (src_addr, dst_addr) = (IpAddress::from(ipv6_packet.src_addr()), IpAddress::from(ipv6_packet.dst_addr()));
+                if !fragmented && packet.len() <= egress_mtu && skips_filter(role, src_addr, dst_addr, udp_payload)? {
+                    // passthrough
+                    debug_print!("Firewall process_ipv6: UDP of a known flow, returning unchanged");
+                    vec![]
+                } else {
+                    let udp_packet = process_udp(src_addr, dst_addr, udp_payload, external_firewall_fn, role, scratch)?;
+                    fragment_large_udp6_packet(
+                        udp_packet.into_inner(),
+                        &packet[..constants::IPV6_HEADER_SIZE],
+                        ident,
+                        egress_mtu,
+                        scratch,
+                    )?
+                }
+            }
+            _ => {
+                // unknown protocol, drop packet
+                debug_print!("Firewall process_ipv6: Unknown protocol, dropping");
+                return Err(Error::Unrecognized);
+            }
+        }
+    };
+
+    if ipv6_packet_buffer.is_empty() {
+        debug_print!("Firewall process_ipv6: no data were changed, simply copy over the original data");
+        return Ok(vec![EthernetFrame::new_checked(eth_packet)?]);
+    }
+    let mut eth_packet_buffer = Vec::with_capacity(ipv6_packet_buffer.len());
+    for ipv6_packet in ipv6_packet_buffer {
+        let mut frame = Vec::with_capacity(constants::ETHERNET_FRAME_PAYLOAD + ipv6_packet.len());
+        frame.extend_from_slice(&eth_packet[..constants::ETHERNET_FRAME_PAYLOAD]);
+        frame.extend_from_slice(ipv6_packet);
+        eth_packet_buffer.push(EthernetFrame::new_checked(frame)?);
+    }
+    Ok(eth_packet_buffer)
+}
+
+/// Put `udp_packet` into IPv6 packets with the fixed `header` of the packet
+/// it came in, i.e. its addresses, traffic class, flow label and hop limit.
+/// Extension headers are not kept. Packets larger than `mtu`, the MTU of the
+/// port they leave through, are fragmented with `ident`, a new one if None.
+fn fragment_large_udp6_packet<'s>(
+    udp_packet: &[u8],
+    header: &[u8],
+    ident: Option<u32>,
+    mtu: usize,
+    scratch: &'s Arena,
+) -> Result<Vec<&'s mut [u8]>> {
+    let header_len = constants::IPV6_HEADER_SIZE;
+    let fragment_header_len = constants::IPV6_FRAGMENT_HEADER_SIZE;
+    let new_packet = |payload_len: usize, next_header: IpProtocol| -> Result<&'s mut [u8]> {
+        let packet = scratch.copy(&header[..header_len], header_len + payload_len).ok_or(Error::Exhausted)?;
+        {
+            let mut ipv6_packet = Ipv6Packet::new(&mut packet[..]);
+            ipv6_packet.set_payload_len(payload_len as u16);
+            ipv6_packet.set_next_header(next_header);
+        }
+        Ok(packet)
+    };
+
+    // a packet that fits the MTU goes out whole
+    if header_len + udp_packet.len() <= mtu {
+        let packet = new_packet(udp_packet.len(), IpProtocol::Udp)?;
+        packet[header_len..].copy_from_slice(udp_packet);
+        return Ok(vec![packet]);
+    }
+
+    // fragment offsets are in units of 8 bytes
+    let mtu_udp = (mtu - header_len - fragment_header_len) & !7;
+    let ident = ident.unwrap_or_else(|| get_pseudorandom_packet_id() as u32);
+    let mut ipv6_packet_buffer = vec![];
+    let mut offset = 0;
+    while offset < udp_packet.len() {
+        let len = mtu_udp.min(udp_packet.len() - offset);
+        let more_frags = offset + len < udp_packet.len();
+        let packet = new_packet(fragment_header_len + len, IpProtocol::Ipv6Frag)?;
+        {
+            let fragment_header = &mut packet[header_len..header_len + fragment_header_len];
+            fragment_header[0] = IpProtocol::Udp.into();
+            fragment_header[1] = 0;
+            fragment_header[2] = (offset >> 8) as u8;
+            fragment_header[3] = (offset & 0xf8) as u8 | more_frags as u8;
+            fragment_header[4] = (ident >> 24) as u8;
+            fragment_header[5] = (ident >> 16) as u8;
+            fragment_header[6] = (ident >> 8) as u8;
+            fragment_header[7] = ident as u8;
+        }
+        packet[header_len + fragment_header_len..].copy_from_slice(&udp_packet[offset..offset + len]);
+        ipv6_packet_buffer.push(packet);
+        offset += len;
+    }
+    Ok(ipv6_packet_buffer)
+}
+
+/// Reset the slots that haven't seen a fragment for
+/// `fragment_timeout_ms` of the configuration, so that a packet that will never
+/// complete doesn't hold its memory until the set runs out of slots
+fn expire_fragments(
+    fragments: &mut FragmentSlots,
+    now: Instant,
+    reassembly_stats: &stats::ReassemblyStats,
+) {
+    fragments.expire(now, config::get().fragment_timeout_ms, reassembly_stats);
+}
+
+/// Expire stale fragments in both directions, for a clock that moves
+/// without any traffic
+#[allow(dead_code)]
+pub fn expire_all_fragments(now: Instant) {
+    expire_fragments(&mut FRAGMENTS_RX.lock(), now, &stats::RX.reassembly);
+    expire_fragments(&mut FRAGMENTS_TX.lock(), now, &stats::TX.reassembly);
+}
+
 /// Process an IPv4 fragment
 /// Returns etiher a vector representing an assembled packet,
 /// nothing (in case no packets are available),
@@ -667,129 +1178,252 @@ fn process_ipv4(
 fn process_ipv4_fragment<'frame, 'r>(
     ipv4_packet: Ipv4Packet<&'frame [u8]>,
     timestamp: Instant,
-    fragments: &'r mut FragmentSet<'static>,
+    fragments: &'r mut FragmentSlots,
+    reassembly_stats: &stats::ReassemblyStats,
 ) -> Result<Option<Vec<u8>>> {
     debug_print!("Firewall process_ipv4_fragment: got a fragment with id = {}", ipv4_packet.ident());
-    // get an existing fragment or attempt to get a new one
-    let fragment = match fragments.get_packet(
-        ipv4_packet.ident(),
-        ipv4_packet.src_addr(),
-        ipv4_packet.dst_addr(),
+    let key = FragmentKey::Ipv4(ipv4_packet.ident(), ipv4_packet.src_addr(), ipv4_packet.dst_addr());
+    let (header_len, frag_offset, payload_len, more_frags) = (
+        ipv4_packet.header_len() as usize,
+        ipv4_packet.frag_offset() as usize,
+        ipv4_packet.payload().len(),
+        ipv4_packet.more_frags(),
+    );
+    reassemble_fragment(
+        key,
+        header_len,
+        frag_offset,
+        payload_len,
+        more_frags,
+        ipv4_packet.into_inner(),
+        finish_ipv4_reassembly,
         timestamp,
-    ) {
-        Some(frag) => frag,
-        None => return Err(Error::FragmentSetFull),
-    };
+        fragments,
+        reassembly_stats,
+    )
+}
 
-    if fragment.is_empty() {
-        // this is a new packet
-        debug_print!("Firewall process_ipv4_fragment: fragment is empty");
-        fragment.start(
-            ipv4_packet.ident(),
-            ipv4_packet.src_addr(),
-            ipv4_packet.dst_addr(),
-        );
-    }
+/// Set the length and checksum of a reassembled IPv4 `packet`
+fn finish_ipv4_reassembly(packet: &mut [u8]) -> Result<()> {
+    let len = packet.len();
+    let mut ipv4_packet = Ipv4Packet::new_checked(packet)?;
+    ipv4_packet.set_total_len(len as u16);
+    ipv4_packet.fill_checksum();
+    Ok(())
+}
+
+/// Add a fragment to the reassembly slot of `key`, the identification, source
+/// and destination of its IPv4 or IPv6 packet. `data` starts with the `header_len` bytes
+/// of the header, followed by `payload_len` bytes at `frag_offset` of the payload.
+/// `finish` sets the length fields of the reassembled packet.
+/// Returns the reassembled packet if this fragment completed it
+fn reassemble_fragment(
+    key: FragmentKey,
+    header_len: usize,
+    frag_offset: usize,
+    payload_len: usize,
+    more_frags: bool,
+    data: &[u8],
+    finish: fn(&mut [u8]) -> Result<()>,
+    timestamp: Instant,
+    fragments: &mut FragmentSlots,
+    reassembly_stats: &stats::ReassemblyStats,
+) -> Result<Option<Vec<u8>>> {
+    expire_fragments(fragments, timestamp, reassembly_stats);
+    // get an existing slot or attempt to start a new one
+    let slot = match fragments.get(key, timestamp, reassembly_stats) {
+        Some(slot) => slot,
+        None => {
+            reassembly_stats.set_full_drops.fetch_add(1, Ordering::Relaxed);
+            return Err(Error::FragmentSetFull);
+        }
+    };
+    let fragment = fragments.packet(slot);
 
-    if !ipv4_packet.more_frags() {
+    if !more_frags {
         // last fragment, remember data length
-        debug_print!("Firewall process_ipv4_fragment: this is the last fragment");
-        fragment
-            .set_total_len(ipv4_packet.frag_offset() as usize + ipv4_packet.total_len() as usize);
+        debug_print!("Firewall reassemble_fragment: this is the last fragment");
+        fragment.set_total_len(header_len + frag_offset + payload_len);
     }
 
     match fragment.add(
-        ipv4_packet.header_len() as usize,
-        ipv4_packet.frag_offset() as usize,
-        ipv4_packet.payload().len(),
-        ipv4_packet.into_inner(),
+        header_len,
+        frag_offset,
+        payload_len,
+        data,
         timestamp,
     ) {
         Ok(_) => {
-            debug_print!("Firewall process_ipv4_fragment: adding fragment OK");
+            debug_print!("Firewall reassemble_fragment: adding fragment OK");
         }
         Err(_e) => {
-            debug_print!("Firewall process_ipv4_fragment: adding fragment error {:?}", _e);
-            fragment.reset();
+            debug_print!("Firewall reassemble_fragment: adding fragment error {:?}", _e);
+            fragments.release(slot, reassembly_stats);
+            reassembly_stats.too_many_drops.fetch_add(1, Ordering::Relaxed);
             return Err(Error::TooManyFragments);
         }
     }
+    fragments.added(slot, payload_len, timestamp, reassembly_stats);
 
+    let fragment = fragments.packet(slot);
     if fragment.check_contig_range() {
         // this is the last packet, attempt reassembly
         let front = match fragment.front() {
             Some(f) => {
-                debug_print!("Firewall process_ipv4_fragment: fragment reassembly Some");
+                debug_print!("Firewall reassemble_fragment: fragment reassembly Some");
                 f
             }
             None => {
-                debug_print!("Firewall process_ipv4_fragment: fragment reassebly None, return Ok(None)");
+                debug_print!("Firewall reassemble_fragment: fragment reassebly None, return Ok(None)");
                 return Ok(None);
             }
         };
-        {
-            // because the different mutability of the underlying buffers, we have to do this exercise
-            let mut ipv4_packet = Ipv4Packet::new_checked(fragment.get_buffer_mut(0, front))?;
-            ipv4_packet.set_total_len(front as u16);
-            ipv4_packet.fill_checksum();
-        }
+        // because the different mutability of the underlying buffers, we have to do this exercise
+        finish(fragment.get_buffer_mut(0, front))?;
         let ret = {
             let mut ret = vec![0; front];
             ret.clone_from_slice(fragment.get_buffer(0, front));
             ret
         };
-        fragment.reset();
+        fragments.release(slot, reassembly_stats);
+        reassembly_stats.completed.fetch_add(1, Ordering::Relaxed);
         return Ok(Some(ret));
     }
 
     // not the last fragment
     let r = Ok(None);
-    debug_print!("Firewall process_ipv4_fragment: this wasn't the last fragment, returning {:?}", r);
+    debug_print!("Firewall reassemble_fragment: this wasn't the last fragment, returning {:?}", r);
     return r;
 }
 
+/// Process an IPv6 fragment, `fragment` is where `walk_ipv6_headers()` found
+/// its fragment header. The fragments share the reassembly slots of IPv4 and
+/// are reassembled without the fragment header.
+/// Returns the same as `process_ipv4_fragment()`
+fn process_ipv6_fragment(
+    packet: &[u8],
+    fragment: (usize, usize),
+    timestamp: Instant,
+    fragments: &mut FragmentSlots,
+    reassembly_stats: &stats::ReassemblyStats,
+) -> Result<Option<Vec<u8>>> {
+    let (header_len, next_header_offset) = fragment;
+    let fragment_header_len = constants::IPV6_FRAGMENT_HEADER_SIZE;
+    let fragment_header = &packet[header_len..header_len + fragment_header_len];
+    let frag_offset = ((fragment_header[2] as usize) << 8 | fragment_header[3] as usize) & !7;
+    let more_frags = fragment_header[3] & 1 != 0;
+    let ident = (fragment_header[4] as u32) << 24 | (fragment_header[5] as u32) << 16
+        | (fragment_header[6] as u32) << 8 | fragment_header[7] as u32;
+    let payload_len = packet.len() - header_len - fragment_header_len;
+    debug_print!("Firewall process_ipv6_fragment: got a fragment with id = {}", ident);
+    // all but the last fragment carry a multiple of 8 bytes (RFC 8200)
+    if payload_len == 0 || (more_frags && payload_len % 8 != 0) {
+        return Err(Error::Malformed);
+    }
+
+    // the slot only copies the header of the first fragment, the others are
+    // passed in place with the payload where the header ends
+    let first;
+    let data = if frag_offset == 0 {
+        first = {
+            let mut first = Vec::with_capacity(packet.len() - fragment_header_len);
+            first.extend_from_slice(&packet[..header_len]);
+            first[next_header_offset] = fragment_header[0];
+            first.extend_from_slice(&packet[header_len + fragment_header_len..]);
+            first
+        };
+        &first[..]
+    } else {
+        &packet[fragment_header_len..]
+    };
+
+    reassemble_fragment(
+        FragmentKey::Ipv6(ident, Ipv6Address::from_bytes(&packet[8..24]), Ipv6Address::from_bytes(&packet[24..40])),
+        header_len,
+        frag_offset,
+        payload_len,
+        more_frags,
+        data,
+        finish_ipv6_reassembly,
+        timestamp,
+        fragments,
+        reassembly_stats,
+    )
+}
+
+/// Set the payload length of a reassembled IPv6 `packet`
+fn finish_ipv6_reassembly(packet: &mut [u8]) -> Result<()> {
+    let payload_len = packet.len() - constants::IPV6_HEADER_SIZE;
+    Ipv6Packet::new(packet).set_payload_len(payload_len as u16);
+    Ok(())
+}
+
+/// Can the UDP packet in `ip_payload`, going in direction `role`, skip the
+/// external filter? Replies to a flow the client opened can, and so can
+/// most packets of a trusted flow, which keep their connection tracking flow
+/// open as well. It is forwarded as it is then, so its checksum is checked
+/// here, see `flows.rs`
+fn skips_filter(role: flows::Role, src_addr: IpAddress, dst_addr: IpAddress, ip_payload: &[u8]) -> Result<bool> {
+    let udp_packet = UdpPacket::new_checked(ip_payload)?;
+    let (src_port, dst_port) = (udp_packet.src_port(), udp_packet.dst_port());
+    let reply = role == flows::Role::Inbound && flows::is_reply(src_addr, src_port, dst_addr, dst_port);
+    if !reply && !flows::lane_skips(role, src_addr, src_port, dst_addr, dst_port) {
+        return Ok(false);
+    }
+    UdpRepr::parse(&udp_packet, &src_addr, &dst_addr, &ChecksumCapabilities::default())?;
+    if reply {
+        flows::REPLIES.fetch_add(1, Ordering::Relaxed);
+    } else if role == flows::Role::Outbound {
+        // keep the flow open for replies, like an approved datagram would
+        flows::record(src_addr, src_port, dst_addr, dst_port);
+    }
+    Ok(true)
+}
+
+/// Run the external filter `call`, and count the CPU cycles it took if `timed`
+/// is set, 0 otherwise. Only the call itself is timed, not the lock around it.
+fn time_filter<F: FnOnce() -> i32>(timed: bool, call: F) -> (i32, u64) {
+    if !timed {
+        return (call(), 0);
+    }
+    let start = stats::cycles();
+    let payload_len = call();
+    (payload_len, stats::cycles().wrapping_sub(start))
+}
+
 /// Process UDP data and eithe return an DP packet approved by the external firewall,
 /// or an error (including Error:Dropped)
 /// The processing is following:
 /// - parse UDP packet
 /// - create a new vector with the payload
-/// - call external firewall (if not NULL)
+/// - call external firewall (if not NULL), the filters of `firewall_ipv6_filters()` for IPv6
+/// - remember the verdict for the fast lane of its flow (see `flows.rs`)
 /// - if approved, assembled a new UDP packet
+/// - from the client, remember the flow it belongs to
 /// - otherwise return Error
-fn process_udp<'frame>(
-    ip_repr: Ipv4Repr,
+fn process_udp<'frame, 's>(
+    src_addr: IpAddress,
+    dst_addr: IpAddress,
     ip_payload: &'frame [u8],
-    external_firewall_fn: Arc<camkesrust::Mutex<ExternalFirewallWrapper>>,
-) -> Result<UdpPacket<Vec<u8>>> {
+    external_firewall_fn: Arc<TrackedMutex<ExternalFirewallWrapper>>,
+    role: flows::Role,
+    scratch: &'s Arena,
+) -> Result<UdpPacket<&'s mut [u8]>> {
     let udp_packet = UdpPacket::new_checked(ip_payload)?;
     let checksum_caps = ChecksumCapabilities::default();
     let _udp_repr = UdpRepr::parse(
         &udp_packet,
-        &IpAddress::from(ip_repr.src_addr),
-        &IpAddress::from(ip_repr.dst_addr),
+        &src_addr,
+        &dst_addr,
         &checksum_caps,
     )?; // to force checksum
 
-    // get proper addresses
-    let src_addr_bytes = {
-        let mut bytes = [0, 0, 0, 0];
-        bytes[..].clone_from_slice(ip_repr.src_addr.as_bytes());
-        let bytes = unsafe { std::mem::transmute::<[u8; 4], u32>(bytes) };
-        bytes
-    };
-
-    let dst_addr_bytes = {
-        let mut bytes = [0, 0, 0, 0];
-        bytes[..].clone_from_slice(ip_repr.dst_addr.as_bytes());
-        let bytes = unsafe { std::mem::transmute::<[u8; 4], u32>(bytes) };
-        bytes
-    };
-
-    // prepare data
-    let mut udp_data = Vec::with_capacity(constants::MAX_UDP_PAYLOAD_SIZE);
-    udp_data.extend_from_slice(udp_packet.payload());
-    let data_len = udp_data.len();
-    let max_data_len = udp_data.capacity();
+    // prepare data, the external firewall may grow the payload up to `max_data_len`
+    let data_len = udp_packet.payload().len();
+    let udp_data = scratch
+        .copy(udp_packet.payload(), config::get().max_udp_payload_size())
+        .ok_or(Error::Exhausted)?;
+    let max_data_len = udp_data.len();
     let data_ptr = udp_data.as_mut_ptr();
 
     // call external firewall
@@ -801,52 +1435,84 @@ fn process_udp<'frame>(
         udp_packet.dst_port = {},
         udp payload len = {}
         buffer size = {}",
-        ip_repr.src_addr,
+        src_addr,
         udp_packet.src_port(),
-        ip_repr.dst_addr,
+        dst_addr,
         udp_packet.dst_port(),
         data_len as u16,
         max_data_len as u16,
     );
 
-    let payload_len = external_firewall_fn.lock().call(
-        src_addr_bytes,
-        udp_packet.src_port(),
-        dst_addr_bytes,
-        udp_packet.dst_port(),
-        data_len as u16,
-        data_ptr,
-        max_data_len as u16,
-    );
+    let shadow = shadow::sample(role);
+    let timed = shadow.is_some();
+    let filter_start = watchdog::stage(role, watchdog::Stage::Filter);
+    let (payload_len, live_cycles) = match (src_addr, dst_addr) {
+        (IpAddress::Ipv4(src), IpAddress::Ipv4(dst)) => {
+            let wrapper = external_firewall_fn.lock();
+            time_filter(timed, || wrapper.call(
+                ipv4_word(&src),
+                udp_packet.src_port(),
+                ipv4_word(&dst),
+                udp_packet.dst_port(),
+                data_len as u16,
+                data_ptr,
+                max_data_len as u16,
+            ))
+        }
+        (IpAddress::Ipv6(src), IpAddress::Ipv6(dst)) => {
+            let wrapper = external_firewall_fn.lock();
+            time_filter(timed, || wrapper.call6(
+                &src,
+                udp_packet.src_port(),
+                &dst,
+                udp_packet.dst_port(),
+                data_len as u16,
+                data_ptr,
+                max_data_len as u16,
+            ))
+        }
+        _ => return Err(Error::Unrecognized),
+    };
 
-    // update vector
-    unsafe {
-        mem::forget(udp_data);
-        udp_data = Vec::from_raw_parts(data_ptr, payload_len as usize, max_data_len);
+    watchdog::filtered(role, filter_start);
+    let approved = payload_len > 0 && payload_len as usize <= max_data_len;
+    if let Some(filter) = shadow {
+        shadow::evaluate(
+            filter,
+            src_addr,
+            udp_packet.src_port(),
+            dst_addr,
+            udp_packet.dst_port(),
+            udp_packet.payload(),
+            max_data_len,
+            approved,
+            live_cycles,
+            scratch,
+        );
     }
-
-    if payload_len > 0 && payload_len as usize <= constants::MAX_UDP_PACKET_SIZE {
+    flows::lane_inspected(role, src_addr, udp_packet.src_port(), dst_addr, udp_packet.dst_port(), approved);
+    if approved {
         debug_print!("Firewall process_udp: packet approved, reassembling with payload len = {}",
             payload_len
         );
+        if role == flows::Role::Outbound {
+            flows::record(src_addr, udp_packet.src_port(), dst_addr, udp_packet.dst_port());
+        }
         let udp_repr = UdpRepr {
             src_port: udp_packet.src_port(),
             dst_port: udp_packet.dst_port(),
-            payload: &udp_data,
+            payload: &udp_data[..payload_len as usize],
         };
-        let mut udp_packet_data = vec![0; udp_repr.buffer_len()];
+        let udp_packet_data = scratch.alloc(udp_repr.buffer_len()).ok_or(Error::Exhausted)?;
         {
-            let mut udp_packet = UdpPacket::new(udp_packet_data.as_mut_slice());
+            let mut udp_packet = UdpPacket::new(&mut udp_packet_data[..]);
             udp_repr.emit(
                 &mut udp_packet,
-                &IpAddress::from(ip_repr.src_addr),
-                &IpAddress::from(ip_repr.dst_addr),
+                &src_addr,
+                &dst_addr,
                 &ChecksumCapabilities::default(),
             );
-            udp_packet.fill_checksum(
-                &IpAddress::from(ip_repr.src_addr),
-                &IpAddress::from(ip_repr.dst_addr),
-            );
+            udp_packet.fill_checksum(&src_addr, &dst_addr);
         }
 
         let r = Ok(UdpPacket::new_checked(udp_packet_data)?);
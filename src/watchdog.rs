@@ -0,0 +1,210 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use constants::{self, WATCHDOG_TRACE_EVENTS};
+use flows::Role;
+use stats;
+
+/// Calls of `client_rx()`/`client_tx()` and filter calls that took longer
+/// than their threshold
+pub static STALLS: AtomicUsize = AtomicUsize::new(0);
+
+/// Where a direction is, keep in sync with the `STAGE_` defines in `rustwall.h`
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Stage {
+    Idle = 0,
+    /// taking the frame from the client or the ethdriver
+    Fetch = 1,
+    /// anywhere in `process_ethernet()` not covered below
+    Ethernet = 2,
+    /// with the reassembly slots locked
+    Reassembly = 3,
+    /// in the external filter
+    Filter = 4,
+    /// handing queued frames to the ethdriver or the client
+    Dispatch = 5,
+}
+
+/// What took too long, keep in sync with the `STALL_` defines in `rustwall.h`
+const STALL_CALL: u32 = 0;
+const STALL_FILTER: u32 = 1;
+
+/// Thresholds in `stats::cycles()`, 0 is off
+static CALL_CYCLES: AtomicUsize = AtomicUsize::new(0);
+static FILTER_CYCLES: AtomicUsize = AtomicUsize::new(0);
+/// Set while either threshold is, everything else is skipped without it
+static ENABLED: AtomicUsize = AtomicUsize::new(0);
+
+/// Current stage of `Role::Outbound` (tx) and `Role::Inbound` (rx)
+static STAGES: [AtomicUsize; 2] = [AtomicUsize::new(0), AtomicUsize::new(0)];
+
+/// A stage change, `what` is the direction in the high byte and the stage
+/// in the low one
+struct Event {
+    cycles: AtomicUsize,
+    what: AtomicUsize,
+}
+
+/// The last `WATCHDOG_TRACE_EVENTS` stage changes of both directions,
+/// `next` is where the next one goes. Entries are written without a lock,
+/// a snapshot taken while the other direction moves on may be off by one.
+struct Trace {
+    events: Vec<Event>,
+    next: AtomicUsize,
+}
+
+impl Trace {
+    fn new() -> Trace {
+        Trace {
+            events: (0..WATCHDOG_TRACE_EVENTS)
+                .map(|_| Event { cycles: AtomicUsize::new(0), what: AtomicUsize::new(0) })
+                .collect(),
+            next: AtomicUsize::new(0),
+        }
+    }
+}
+
+/// C view of an `Event`, keep in sync with `struct firewall_trace_event` in `rustwall.h`
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+pub struct FirewallTraceEvent {
+    pub cycles: u64,
+    pub direction: u32,
+    pub stage: u32,
+}
+
+/// State of the firewall right after a stall, keep in sync with
+/// `struct firewall_stall` in `rustwall.h`
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct FirewallStall {
+    pub sequence: u64,
+    pub cycles: u64,
+    pub kind: u32,
+    pub direction: u32,
+    pub stages: [u32; 2],
+    pub packets_rx_depth: u64,
+    pub packets_tx_depth: u64,
+    pub fragments_rx_slots: u64,
+    pub fragments_tx_slots: u64,
+    pub locks_in_use: [u64; 10],
+    pub trace: [FirewallTraceEvent; WATCHDOG_TRACE_EVENTS],
+}
+
+lazy_static! {
+    static ref TRACE: Trace = Trace::new();
+    /// the most recent `WATCHDOG_STALLS` snapshots, oldest first
+    static ref SNAPSHOTS: ::spin::Mutex<Vec<FirewallStall>> =
+        ::spin::Mutex::new(Vec::with_capacity(constants::WATCHDOG_STALLS));
+}
+
+/// Watch `client_rx()`/`client_tx()` calls taking more than `call_cycles`
+/// and external filter calls taking more than `filter_cycles`, in ticks of
+/// `stats::cycles()`, 0 leaves either out. A stall is only noticed once the
+/// call returns, the snapshot of the firewall taken then is kept for
+/// `firewall_stall_get()`. Returns 0, or -1 if there is no counter to
+/// watch with on this architecture.
+#[no_mangle]
+pub extern "C" fn firewall_watchdog_config(call_cycles: u64, filter_cycles: u64) -> i32 {
+    if !stats::HAS_CYCLES && (call_cycles != 0 || filter_cycles != 0) {
+        return -1;
+    }
+    // the buffers are taken now, not in the middle of a stall
+    ::lazy_static::initialize(&TRACE);
+    ::lazy_static::initialize(&SNAPSHOTS);
+    CALL_CYCLES.store(call_cycles as usize, Ordering::Relaxed);
+    FILTER_CYCLES.store(filter_cycles as usize, Ordering::Relaxed);
+    ENABLED.store((call_cycles != 0 || filter_cycles != 0) as usize, Ordering::Release);
+    0
+}
+
+/// Snapshot of the `idx`th most recent stall, 0 is the last one,
+/// returns -1 if there aren't that many
+#[no_mangle]
+pub extern "C" fn firewall_stall_get(idx: u32, stall: *mut FirewallStall) -> i32 {
+    if stall.is_null() {
+        return -1;
+    }
+    let snapshots = SNAPSHOTS.lock();
+    match snapshots.iter().rev().nth(idx as usize) {
+        Some(snapshot) => {
+            unsafe { *stall = *snapshot };
+            0
+        }
+        None => -1,
+    }
+}
+
+/// `role` moves on to `stage`, returns when, or 0 with the watchdog off
+pub fn stage(role: Role, stage: Stage) -> u64 {
+    if ENABLED.load(Ordering::Acquire) == 0 {
+        return 0;
+    }
+    let now = stats::cycles();
+    STAGES[role as usize].store(stage as usize, Ordering::Relaxed);
+    let event = &TRACE.events[TRACE.next.fetch_add(1, Ordering::Relaxed) % WATCHDOG_TRACE_EVENTS];
+    event.cycles.store(now as usize, Ordering::Relaxed);
+    event.what.store((role as usize) << 8 | stage as usize, Ordering::Relaxed);
+    now
+}
+
+/// The filter call `role` started at `start` returned
+pub fn filtered(role: Role, start: u64) {
+    check(role, start, Stage::Ethernet, STALL_FILTER, &FILTER_CYCLES);
+}
+
+/// The `client_rx()`/`client_tx()` call `role` started at `start` returns
+pub fn finished(role: Role, start: u64) {
+    check(role, start, Stage::Idle, STALL_CALL, &CALL_CYCLES);
+}
+
+fn check(role: Role, start: u64, next: Stage, kind: u32, threshold: &AtomicUsize) {
+    // off, or turned on in the middle of the call
+    if start == 0 {
+        return;
+    }
+    let now = stage(role, next);
+    let limit = threshold.load(Ordering::Relaxed);
+    let cycles = now.wrapping_sub(start);
+    if limit != 0 && cycles > limit as u64 {
+        snapshot(role, kind, cycles);
+    }
+}
+
+fn snapshot(role: Role, kind: u32, cycles: u64) {
+    let sequence = STALLS.fetch_add(1, Ordering::Relaxed) + 1;
+    debug_print!("Firewall watchdog: stall {} of {:?}, {} cycles", sequence, role, cycles);
+    let mut stall = FirewallStall {
+        sequence: sequence as u64,
+        cycles: cycles,
+        kind: kind,
+        direction: role as u32,
+        stages: [
+            STAGES[0].load(Ordering::Relaxed) as u32,
+            STAGES[1].load(Ordering::Relaxed) as u32,
+        ],
+        packets_rx_depth: stats::RX.queue.depth.get() as u64,
+        packets_tx_depth: stats::TX.queue.depth.get() as u64,
+        fragments_rx_slots: stats::RX.reassembly.slots.get() as u64,
+        fragments_tx_slots: stats::TX.reassembly.slots.get() as u64,
+        locks_in_use: [0; 10],
+        trace: [FirewallTraceEvent::default(); WATCHDOG_TRACE_EVENTS],
+    };
+    for (in_use, lock) in stall.locks_in_use.iter_mut().zip(stats::LOCKS.iter()) {
+        *in_use = lock.in_use() as u64;
+    }
+    // oldest first
+    let next = TRACE.next.load(Ordering::Relaxed);
+    for (i, out) in stall.trace.iter_mut().enumerate() {
+        let event = &TRACE.events[(next + i) % WATCHDOG_TRACE_EVENTS];
+        let what = event.what.load(Ordering::Relaxed);
+        out.cycles = event.cycles.load(Ordering::Relaxed) as u64;
+        out.direction = (what >> 8) as u32;
+        out.stage = (what & 0xff) as u32;
+    }
+
+    let mut snapshots = SNAPSHOTS.lock();
+    if snapshots.len() == constants::WATCHDOG_STALLS {
+        snapshots.remove(0);
+    }
+    snapshots.push(stall);
+}